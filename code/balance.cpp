@@ -0,0 +1,146 @@
+#include "balance.h"
+
+namespace
+{
+    constexpr double defaultStartImbalance = 1.15;
+    constexpr double defaultStopImbalance = 1.05;
+
+    double Clamp(const double value, const double min, const double max)
+    {
+        return (value < min) ? min : ((value > max) ? max : value);
+    }
+
+    // Where the cuts would split the window's cost evenly, with each part's cost spread evenly over it.
+    void FindEvenCuts(const LoadBalancer* balancer, const double totalCost, double* evenCuts)
+    {
+        const int numParts = balancer->numParts;
+        evenCuts[0] = balancer->cuts[0];
+        evenCuts[numParts] = balancer->cuts[numParts];
+
+        int part = 0;
+        double costBefore = 0.0; // Of the parts before `part`.
+
+        for (int c = 1; c < numParts; c++)
+        {
+            const double goal = totalCost * c / numParts;
+            while (part < numParts - 1 && costBefore + balancer->windowCosts[part] < goal)
+            {
+                costBefore += balancer->windowCosts[part];
+                part++;
+            }
+
+            const double width = balancer->cuts[part + 1] - balancer->cuts[part];
+            const double cost = balancer->windowCosts[part];
+            const double fraction = (cost > 0.0) ? Clamp((goal - costBefore) / cost, 0.0, 1.0) : 0.5;
+            evenCuts[c] = balancer->cuts[part] + width * fraction;
+        }
+    }
+}
+
+bool ResetLoadBalancer(LoadBalancer* balancer, const int numParts, const double begin, const double end,
+    const double minWidth, const double maxShift, const int windowSize)
+{
+    const int parts = (numParts < 1) ? 1 : ((numParts > maxBalanceParts) ? maxBalanceParts : numParts);
+
+    balancer->numParts = parts;
+    for (int c = 0; c <= parts; c++)
+    {
+        balancer->cuts[c] = begin + (end - begin) * c / parts;
+    }
+
+    balancer->minWidth = minWidth;
+    balancer->startImbalance = defaultStartImbalance;
+    balancer->stopImbalance = defaultStopImbalance;
+    balancer->windowSize = (windowSize < 1) ? 1 : windowSize;
+    balancer->numSamples = 0;
+    balancer->balancing = false;
+    balancer->imbalance = 1.0;
+    balancer->numMoves = 0;
+
+    for (double& cost : balancer->windowCosts)
+    {
+        cost = 0.0;
+    }
+
+    // Parts that start out too narrow can't be shrunk, so nothing can move at all.
+    const bool movable = (end - begin) / parts >= minWidth;
+    balancer->maxShift = movable ? maxShift : 0.0;
+    return movable;
+}
+
+bool AddLoadSample(LoadBalancer* balancer, const double* costs)
+{
+    const int numParts = balancer->numParts;
+    for (int p = 0; p < numParts; p++)
+    {
+        balancer->windowCosts[p] += costs[p];
+    }
+
+    if (++balancer->numSamples < balancer->windowSize)
+    {
+        return false;
+    }
+
+    double totalCost = 0.0;
+    double maxCost = 0.0;
+    for (int p = 0; p < numParts; p++)
+    {
+        totalCost += balancer->windowCosts[p];
+        maxCost = (balancer->windowCosts[p] > maxCost) ? balancer->windowCosts[p] : maxCost;
+    }
+
+    balancer->imbalance = (totalCost > 0.0) ? maxCost * numParts / totalCost : 1.0;
+    if (balancer->imbalance > balancer->startImbalance)
+    {
+        balancer->balancing = true;
+    }
+    else if (balancer->imbalance < balancer->stopImbalance)
+    {
+        balancer->balancing = false;
+    }
+
+    if (balancer->balancing && balancer->maxShift > 0.0 && totalCost > 0.0)
+    {
+        double evenCuts[maxBalanceParts + 1];
+        FindEvenCuts(balancer, totalCost, evenCuts);
+
+        // Going from the first cut up, each stays within maxShift of where it was, at least minWidth past the one
+        // before, and far enough from the end to leave minWidth for every part after it. The old cuts always meet all
+        // three, so there is always somewhere for a cut to go.
+        const double end = balancer->cuts[numParts];
+        const double minWidth = balancer->minWidth;
+        const double maxShift = balancer->maxShift;
+
+        for (int c = 1; c < numParts; c++)
+        {
+            const double cut = balancer->cuts[c];
+            const double lowest = (cut - maxShift > balancer->cuts[c - 1] + minWidth) ?
+                cut - maxShift : balancer->cuts[c - 1] + minWidth;
+            const double highest = (cut + maxShift < end - (numParts - c) * minWidth) ?
+                cut + maxShift : end - (numParts - c) * minWidth;
+
+            balancer->cuts[c] = Clamp(cut + 0.5 * (evenCuts[c] - cut), lowest, highest);
+        }
+
+        balancer->numMoves++;
+    }
+
+    balancer->numSamples = 0;
+    for (int p = 0; p < numParts; p++)
+    {
+        balancer->windowCosts[p] = 0.0;
+    }
+
+    return true;
+}
+
+int FindLoadPart(const LoadBalancer* balancer, const double position)
+{
+    int part = 0;
+    while (part < balancer->numParts - 1 && position >= balancer->cuts[part + 1])
+    {
+        part++;
+    }
+
+    return part;
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include "jobs.h"
+
+// Keeps the parts of a line, split at a few cuts, about equally expensive to work on: the slabs of the world that the
+// domains own (see domain.h), or the shares of the steering pass that the threads start with (see jobs.h).
+//
+// Each sample is the measured cost of every part, over one tick. They are added up over a window of ticks, and at the
+// end of the window the cost of each part is taken to be spread evenly over it, which gives the cost along the whole
+// line; the cuts are then moved halfway towards where they would split that cost evenly. The flock moves while the
+// window fills, so the cuts follow it a window at a time rather than chasing one noisy tick.
+//
+// To keep the cuts from wandering back and forth on noise, balancing only starts once the dearest part costs more than
+// startImbalance times the average, and then carries on until it is back below stopImbalance. No cut moves more than
+// maxShift in one window, and no part gets narrower than minWidth.
+
+constexpr int maxBalanceParts = maxJobWorkers + 1;
+
+struct LoadBalancer
+{
+    int numParts; // 0 until reset.
+    double cuts[maxBalanceParts + 1]; // Part p runs from cuts[p] to cuts[p + 1]; the two ends never move.
+    double minWidth;
+    double maxShift;
+    double startImbalance;
+    double stopImbalance;
+
+    int windowSize; // In samples.
+    int numSamples; // In the current window.
+    double windowCosts[maxBalanceParts];
+
+    bool balancing;
+    double imbalance; // The dearest part's cost over the average, in the last window.
+    int numMoves; // Windows that moved the cuts.
+};
+
+// Cuts [begin, end] into numParts equal parts. Returns false, and leaves the cuts where they are for good, if equal parts
+// would already be narrower than minWidth.
+bool ResetLoadBalancer(LoadBalancer* balancer, const int numParts, const double begin, const double end,
+    const double minWidth, const double maxShift, const int windowSize);
+// Adds one sample, with a cost for every part. Returns true at the end of each window, once the cuts have been moved
+// or left alone.
+bool AddLoadSample(LoadBalancer* balancer, const double* costs);
+// The part that `position` falls in. Positions past the ends count as in the first or last part.
+int FindLoadPart(const LoadBalancer* balancer, const double position);
@@ -0,0 +1,1627 @@
+#include "bench.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <thread>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+#include "boid.h"
+#include "framecodec.h"
+#include "gamememory.h"
+#include "grid.h"
+#include "jobs.h"
+#include "mathutils.h"
+#include "metrics.h"
+#include "params.h"
+#include "perfcounters.h"
+#include "platform.h"
+#include "trajectory.h"
+
+namespace
+{
+    const float syntheticMaxSpeed = DefaultSimParams().maxSpeed;
+
+    double SecondsSince(const std::chrono::steady_clock::time_point start)
+    {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    void PrintDecodeResult(const char* name, const TrajectoryReader* reader, const uint64_t numFrames,
+        const double seconds)
+    {
+        const TrajectoryHeader* header = reader->header;
+        const double megabytes = (double)(reader->file.size - header->headerSize) / (1024.0 * 1024.0);
+        const double boidsPerSecond = (double)numFrames * header->numBoids / seconds;
+
+        std::printf("%-12s %8llu frames %10.3f ms %10.1f MB/s %10.1f frames/s %8.2f ns/boid\n",
+            name, (unsigned long long)numFrames, seconds * 1000.0, megabytes / seconds, numFrames / seconds,
+            1e9 / boidsPerSecond);
+    }
+
+    // --- Microbenchmarks ---------------------------------------------------------------------------------------------
+    //
+    // A small harness in the style of Google Benchmark. Each benchmark is a function that wraps the code being timed in
+    // a `while (state->KeepRunning())` loop. The harness first grows the iteration count until one run takes at least
+    // benchmarkMinSeconds, then repeats the run benchmarkRepetitions times and reports the median time per iteration.
+
+    constexpr double benchmarkMinSeconds = 0.1;
+    constexpr int benchmarkRepetitions = 3;
+    constexpr uint64_t benchmarkMaxIterations = 1000000000;
+    constexpr int maxBenchmarkCounters = 8 + PERF_COUNTER_COUNT;
+
+    struct BenchmarkState
+    {
+        int arg;
+        uint64_t maxIterations;
+        uint64_t iterations;
+        std::chrono::steady_clock::time_point start;
+        double seconds;
+
+        // Work done per iteration, for the items/s column.
+        int64_t itemsPerIteration;
+
+        // Extra results of the run, written out next to the timing.
+        int numCounters;
+        const char* counterNames[maxBenchmarkCounters];
+        double counterValues[maxBenchmarkCounters];
+
+        // Hardware counters over the timed loop, when they are enabled.
+        bool countersStarted;
+        PerfCounterValues countersStart;
+        PerfCounterValues counters;
+
+        const char* error;
+
+        bool KeepRunning()
+        {
+            if (iterations == 0)
+            {
+                countersStarted = ReadPerfCounters(&countersStart);
+                start = std::chrono::steady_clock::now();
+            }
+
+            if (iterations < maxIterations)
+            {
+                iterations++;
+                return true;
+            }
+
+            seconds = SecondsSince(start);
+            if (countersStarted && ReadPerfCounters(&counters))
+            {
+                for (int i = 0; i < PERF_COUNTER_COUNT; i++)
+                {
+                    counters.counts[i] -= countersStart.counts[i];
+                }
+            }
+
+            return false;
+        }
+
+        void SetCounter(const char* name, const double value)
+        {
+            for (int i = 0; i < numCounters; i++)
+            {
+                if (std::strcmp(counterNames[i], name) == 0)
+                {
+                    counterValues[i] = value;
+                    return;
+                }
+            }
+
+            if (numCounters < maxBenchmarkCounters)
+            {
+                counterNames[numCounters] = name;
+                counterValues[numCounters] = value;
+                numCounters++;
+            }
+        }
+    };
+
+    // Keeps the compiler from throwing away a result that nothing else reads.
+    template <typename T>
+    inline void DoNotOptimize(const T& value)
+    {
+#if defined(_MSC_VER)
+        static const void* volatile sink;
+        sink = &value;
+        _ReadWriteBarrier();
+#else
+        asm volatile("" : : "r,m"(value) : "memory");
+#endif
+    }
+
+    typedef void BenchmarkFunction(BenchmarkState* state);
+
+    struct Benchmark
+    {
+        const char* name;
+        BenchmarkFunction* function;
+        int arg;
+
+        // A million boids take around a second per iteration on one thread, so these only run when asked for.
+        bool large;
+    };
+
+    struct BenchmarkResult
+    {
+        char name[64];
+        uint64_t iterations;
+        double nanoseconds; // Per iteration, median of the repetitions.
+        double itemsPerSecond;
+        int numCounters;
+        const char* counterNames[maxBenchmarkCounters];
+        double counterValues[maxBenchmarkCounters];
+        double baselineNanoseconds; // Zero when the baseline has no entry for this benchmark.
+        bool regression;
+    };
+
+    // A flock laid out the same way main() lays out the game's memory. The world grows with the flock so every size
+    // runs at the density of the default 300 boids in a 200 unit cube. Given a job system, the flock is first touched
+    // from its threads, as main() does, and left set up to tick on them.
+    struct BenchmarkFlock
+    {
+        GameMemory memory;
+        GameState* gameState;
+    };
+
+    bool CreateBenchmarkFlock(BenchmarkFlock* flock, const int numBoids, JobSystem* jobs = nullptr)
+    {
+        const float worldSizeHalf = 100.0f * std::cbrt((float)numBoids / 300.0f);
+        const SimParams params = DefaultSimParams();
+
+        const MemoryBudget budget = PlanGameMemory(numBoids, worldSizeHalf, &params, false);
+        GameState* gameState = AllocateGameMemory(&budget, &flock->memory);
+
+        if (!gameState)
+        {
+            return false;
+        }
+
+        gameState->jobs = jobs;
+        FirstTouchBoids(gameState);
+
+        gameState->worldSize = worldSizeHalf;
+        gameState->params = params;
+
+        SeedRandom(1);
+        for (int i = 0; i < numBoids; i++)
+        {
+            Boid boid = {};
+            boid.position = { RandomFloat(-worldSizeHalf, worldSizeHalf), RandomFloat(-worldSizeHalf, worldSizeHalf),
+                RandomFloat(-worldSizeHalf, worldSizeHalf) };
+            boid.velocity = CreateRandomVector3() * (syntheticMaxSpeed * 0.5f);
+            gameState->boids[i] = boid;
+        }
+
+        flock->gameState = gameState;
+        return true;
+    }
+
+    void FreeBenchmarkFlock(BenchmarkFlock* flock)
+    {
+        FreeGameMemory(&flock->memory);
+        *flock = {};
+    }
+
+    // Moves a synthetic flock roughly the way the simulation does: small steering changes, clamped speed, integrate,
+    // and turn around at the walls. Cheap enough to generate codec input for large flocks.
+    void StepSyntheticFlock(Boid* boids, const int numBoids, const float worldSize)
+    {
+        for (int i = 0; i < numBoids; i++)
+        {
+            Boid& boid = boids[i];
+            boid.velocity += CreateRandomVector3() * 0.05f;
+            boid.velocity = Vector3ClampValue(boid.velocity, 0.0f, syntheticMaxSpeed);
+
+            if (std::fabs(boid.position.x) > worldSize)
+            {
+                boid.velocity.x = -boid.velocity.x;
+            }
+            if (std::fabs(boid.position.y) > worldSize)
+            {
+                boid.velocity.y = -boid.velocity.y;
+            }
+            if (std::fabs(boid.position.z) > worldSize)
+            {
+                boid.velocity.z = -boid.velocity.z;
+            }
+
+            boid.position += boid.velocity;
+        }
+    }
+
+    enum BoidRule
+    {
+        BOID_RULE_ALIGN,
+        BOID_RULE_COHERE,
+        BOID_RULE_SEPARATE,
+    };
+
+    // One rule evaluated for one boid per iteration, cycling through the flock.
+    void BenchmarkBoidRule(BenchmarkState* state, const BoidRule rule)
+    {
+        BenchmarkFlock flock = {};
+        if (!CreateBenchmarkFlock(&flock, state->arg))
+        {
+            state->error = "out of memory";
+            return;
+        }
+
+        const GameState* gameState = flock.gameState;
+        int i = 0;
+        while (state->KeepRunning())
+        {
+            const Boid& boid = gameState->boids[i];
+            switch (rule)
+            {
+            case BOID_RULE_ALIGN: DoNotOptimize(boid.Align(gameState)); break;
+            case BOID_RULE_COHERE: DoNotOptimize(boid.Cohere(gameState)); break;
+            case BOID_RULE_SEPARATE: DoNotOptimize(boid.Separate(gameState)); break;
+            }
+
+            i = (i + 1 < gameState->numBoids) ? i + 1 : 0;
+        }
+
+        state->itemsPerIteration = 1;
+        FreeBenchmarkFlock(&flock);
+    }
+
+    void BM_Align(BenchmarkState* state)
+    {
+        BenchmarkBoidRule(state, BOID_RULE_ALIGN);
+    }
+
+    void BM_Cohere(BenchmarkState* state)
+    {
+        BenchmarkBoidRule(state, BOID_RULE_COHERE);
+    }
+
+    void BM_Separate(BenchmarkState* state)
+    {
+        BenchmarkBoidRule(state, BOID_RULE_SEPARATE);
+    }
+
+    // Wall avoidance for the whole flock, one boid at a time through the branching reference or in bulk.
+    void BenchmarkBoundaryForces(BenchmarkState* state, const bool bulk)
+    {
+        BenchmarkFlock flock = {};
+        if (!CreateBenchmarkFlock(&flock, state->arg))
+        {
+            state->error = "out of memory";
+            return;
+        }
+
+        const GameState* gameState = flock.gameState;
+        const Boid* boids = gameState->boids;
+        const int numBoids = gameState->numBoids;
+
+        const size_t forcesSize = sizeof(Vector3) * numBoids * 2;
+        Vector3* forces = (Vector3*)PlatformAllocateMemory(forcesSize);
+        if (!forces)
+        {
+            state->error = "out of memory";
+            FreeBenchmarkFlock(&flock);
+            return;
+        }
+
+        // The bulk version has to give exactly the same forces as the reference before its time means anything.
+        Vector3* referenceForces = forces + numBoids;
+        for (int i = 0; i < numBoids; i++)
+        {
+            referenceForces[i] = boids[i].SteerFromBoundary(gameState);
+        }
+        ComputeBoundaryForces(boids, numBoids, gameState->worldSize, &gameState->params, forces);
+
+        if (std::memcmp(forces, referenceForces, sizeof(Vector3) * numBoids) != 0)
+        {
+            state->error = "bulk forces differ from Boid::SteerFromBoundary";
+        }
+
+        while (!state->error && state->KeepRunning())
+        {
+            if (bulk)
+            {
+                ComputeBoundaryForces(boids, numBoids, gameState->worldSize, &gameState->params, forces);
+            }
+            else
+            {
+                for (int i = 0; i < numBoids; i++)
+                {
+                    forces[i] = boids[i].SteerFromBoundary(gameState);
+                }
+            }
+            DoNotOptimize(forces[0]);
+        }
+
+        state->itemsPerIteration = numBoids;
+        PlatformFreeMemory(forces, forcesSize);
+        FreeBenchmarkFlock(&flock);
+    }
+
+    void BM_SteerFromBoundary(BenchmarkState* state)
+    {
+        BenchmarkBoundaryForces(state, false);
+    }
+
+    void BM_ComputeBoundaryForces(BenchmarkState* state)
+    {
+        BenchmarkBoundaryForces(state, true);
+    }
+
+    enum UpdateKernel
+    {
+        UPDATE_KERNEL_SPECIALIZED,
+        UPDATE_KERNEL_GENERIC,
+    };
+
+    void BenchmarkUpdateBoids(BenchmarkState* state, const bool deterministic, const UpdateKernel kernel,
+        const NeighborMode neighborMode, const BoundaryMode boundaryMode = BOUNDARY_MODE_STEER)
+    {
+        BenchmarkFlock flock = {};
+        if (!CreateBenchmarkFlock(&flock, state->arg))
+        {
+            state->error = "out of memory";
+            return;
+        }
+
+        flock.gameState->deterministic = deterministic;
+        flock.gameState->params.neighborMode = neighborMode;
+        flock.gameState->params.boundaryMode = boundaryMode;
+
+        ResetMetrics();
+        while (state->KeepRunning())
+        {
+            if (kernel == UPDATE_KERNEL_GENERIC)
+            {
+                UpdateBoidsGeneric(flock.gameState);
+            }
+            else
+            {
+                UpdateBoids(flock.gameState);
+            }
+        }
+
+        // UpdateBoids times itself into the metrics registry as well, which gives the spread across ticks.
+        const MetricSummary sim = SummarizeMetric(METRIC_SIM_TIME);
+        state->SetCounter("sim_p50_ms", sim.p50);
+        state->SetCounter("sim_p99_ms", sim.p99);
+        state->SetCounter("neighbors_mean", SummarizeMetric(METRIC_NEIGHBORS_MEAN).average);
+        state->SetCounter("cell_max", SummarizeMetric(METRIC_GRID_CELL_MAX).average);
+
+        state->itemsPerIteration = state->arg;
+        FreeBenchmarkFlock(&flock);
+    }
+
+    void BM_UpdateBoids(BenchmarkState* state)
+    {
+        BenchmarkUpdateBoids(state, false, UPDATE_KERNEL_SPECIALIZED, NEIGHBOR_MODE_METRIC);
+    }
+
+    void BM_UpdateBoidsDeterministic(BenchmarkState* state)
+    {
+        BenchmarkUpdateBoids(state, true, UPDATE_KERNEL_SPECIALIZED, NEIGHBOR_MODE_METRIC);
+    }
+
+    // The same ticks through the kernel that checks the rules and modes at runtime, to measure what specializing
+    // the kernels buys.
+    void BM_UpdateBoidsGeneric(BenchmarkState* state)
+    {
+        BenchmarkUpdateBoids(state, false, UPDATE_KERNEL_GENERIC, NEIGHBOR_MODE_METRIC);
+    }
+
+    void BM_UpdateBoidsTopological(BenchmarkState* state)
+    {
+        BenchmarkUpdateBoids(state, false, UPDATE_KERNEL_SPECIALIZED, NEIGHBOR_MODE_TOPOLOGICAL);
+    }
+
+    void BM_UpdateBoidsTopologicalGeneric(BenchmarkState* state)
+    {
+        BenchmarkUpdateBoids(state, false, UPDATE_KERNEL_GENERIC, NEIGHBOR_MODE_TOPOLOGICAL);
+    }
+
+    // With the world wrapping around there are no walls to crowd against, so the density, and with it the work per
+    // boid, stays even across the world.
+    void BM_UpdateBoidsWrap(BenchmarkState* state)
+    {
+        BenchmarkUpdateBoids(state, false, UPDATE_KERNEL_SPECIALIZED, NEIGHBOR_MODE_METRIC, BOUNDARY_MODE_WRAP);
+    }
+
+    // The tick spread over a thread per hardware thread. Every tick starts again from the same flock, so a clustered
+    // one doesn't disperse over a long run; the copy is a small part of the tick. Besides the spread of tick times,
+    // reports how long the threads were busy per tick: with work stealing the busiest one should finish close to the
+    // average even when a twentieth of the flock is packed into one tight ball, where each boid has over a hundred
+    // neighbours instead of one or two. The threads' starting shares are rebalanced as it runs, so the steals drop, and
+    // the cost of the dearest share over the average (share_imbalance) falls towards 1, once they have settled.
+    void BenchmarkUpdateBoidsThreaded(BenchmarkState* state, const bool clustered)
+    {
+        JobSystem jobs = {};
+        StartJobSystem(&jobs, 0);
+        const int numThreads = GetJobThreadCount(&jobs);
+
+        BenchmarkFlock flock = {};
+        if (!CreateBenchmarkFlock(&flock, state->arg, &jobs))
+        {
+            state->error = "out of memory";
+            StopJobSystem(&jobs);
+            return;
+        }
+
+        GameState* gameState = flock.gameState;
+        const int numBoids = gameState->numBoids;
+
+        if (clustered)
+        {
+            const float radius = 3.0f * gameState->params.separationDistance;
+
+            SeedRandom(2);
+            for (int i = 0; i < numBoids / 20; i++)
+            {
+                Vector3 offset = {};
+                do
+                {
+                    offset = { RandomFloat(-1.0f, 1.0f), RandomFloat(-1.0f, 1.0f), RandomFloat(-1.0f, 1.0f) };
+                } while (Vector3LengthSqr(offset) > 1.0f);
+
+                gameState->boids[i].position = offset * radius;
+            }
+        }
+
+        const size_t boidsSize = sizeof(Boid) * numBoids * 2;
+        Boid* initialBoids = (Boid*)PlatformAllocateMemory(boidsSize);
+        if (!initialBoids)
+        {
+            state->error = "out of memory";
+            FreeBenchmarkFlock(&flock);
+            StopJobSystem(&jobs);
+            return;
+        }
+        std::memcpy(initialBoids, gameState->boids, sizeof(Boid) * numBoids);
+
+        // However the flock is split between the threads, the tick has to come out exactly as on one thread.
+        Boid* singleThreaded = initialBoids + numBoids;
+        gameState->jobs = nullptr;
+        UpdateBoids(gameState);
+        std::memcpy(singleThreaded, gameState->boids, sizeof(Boid) * numBoids);
+
+        gameState->jobs = &jobs;
+        std::memcpy(gameState->boids, initialBoids, sizeof(Boid) * numBoids);
+        UpdateBoids(gameState);
+
+        if (std::memcmp(gameState->boids, singleThreaded, sizeof(Boid) * numBoids) != 0)
+        {
+            state->error = "threaded tick differs from the single-threaded one";
+        }
+
+        double busyMilliseconds[maxJobWorkers + 1] = {};
+        int64_t steals = 0;
+        uint64_t ticks = 0;
+
+        ResetMetrics();
+        while (!state->error && state->KeepRunning())
+        {
+            std::memcpy(gameState->boids, initialBoids, sizeof(Boid) * numBoids);
+            UpdateBoids(gameState);
+
+            for (int t = 0; t < numThreads; t++)
+            {
+                busyMilliseconds[t] += jobs.queues[t].busyMilliseconds;
+                steals += jobs.queues[t].steals;
+            }
+            ticks++;
+        }
+
+        if (ticks > 0)
+        {
+            double busyMin = busyMilliseconds[0];
+            double busyMax = busyMilliseconds[0];
+            double busyTotal = 0.0;
+            for (int t = 0; t < numThreads; t++)
+            {
+                busyMin = (busyMilliseconds[t] < busyMin) ? busyMilliseconds[t] : busyMin;
+                busyMax = (busyMilliseconds[t] > busyMax) ? busyMilliseconds[t] : busyMax;
+                busyTotal += busyMilliseconds[t];
+            }
+
+            const MetricSummary sim = SummarizeMetric(METRIC_SIM_TIME);
+            state->SetCounter("sim_p50_ms", sim.p50);
+            state->SetCounter("sim_p99_ms", sim.p99);
+            state->SetCounter("threads", (double)numThreads);
+            state->SetCounter("busy_min_ms", busyMin / ticks);
+            state->SetCounter("busy_mean_ms", busyTotal / numThreads / ticks);
+            state->SetCounter("busy_max_ms", busyMax / ticks);
+            state->SetCounter("steals", (double)steals / ticks);
+            state->SetCounter("share_imbalance", SummarizeMetric(METRIC_LOAD_IMBALANCE).last);
+            state->SetCounter("share_moves", (double)gameState->steerBalancer.numMoves);
+            state->SetCounter("neighbors_mean", SummarizeMetric(METRIC_NEIGHBORS_MEAN).average);
+        }
+
+        state->itemsPerIteration = state->arg;
+        StopJobSystem(&jobs);
+        PlatformFreeMemory(initialBoids, boidsSize);
+        FreeBenchmarkFlock(&flock);
+    }
+
+    void BM_UpdateBoidsThreaded(BenchmarkState* state)
+    {
+        BenchmarkUpdateBoidsThreaded(state, false);
+    }
+
+    void BM_UpdateBoidsClustered(BenchmarkState* state)
+    {
+        BenchmarkUpdateBoidsThreaded(state, true);
+    }
+
+    // Ticks on free-floating workers and then on workers pinned to a core each, all cores but the first so the main
+    // thread has one to itself, and reports how far the slow ticks (p99) stray from the typical one (p50) either way.
+    // Jitter comes from the OS moving threads around and from other work landing on their cores, so the difference
+    // shows best on a busy machine, or with the pinned cores isolated from the scheduler.
+    void BM_TickJitter(BenchmarkState* state)
+    {
+        BenchmarkFlock flock = {};
+        if (!CreateBenchmarkFlock(&flock, state->arg))
+        {
+            state->error = "out of memory";
+            return;
+        }
+
+        GameState* gameState = flock.gameState;
+        const int numBoids = gameState->numBoids;
+
+        JobAffinity affinity = {};
+        const int numCores = (int)std::thread::hardware_concurrency();
+        for (int core = (numCores > 1) ? 1 : 0; core < numCores && affinity.numCores < maxJobWorkers; core++)
+        {
+            affinity.cores[affinity.numCores++] = core;
+        }
+
+        JobSystem jobs = {};
+        StartJobSystem(&jobs, affinity.numCores);
+        gameState->jobs = &jobs;
+
+        uint64_t ticks = 0;
+        ResetMetrics();
+        while (state->KeepRunning())
+        {
+            UpdateBoids(gameState);
+            ticks++;
+        }
+        const MetricSummary floating = SummarizeMetric(METRIC_SIM_TIME);
+
+        StopJobSystem(&jobs);
+        StartJobSystem(&jobs, affinity.numCores, &affinity);
+
+        ResetMetrics();
+        for (uint64_t i = 0; i < ticks; i++)
+        {
+            UpdateBoids(gameState);
+        }
+        const MetricSummary pinned = SummarizeMetric(METRIC_SIM_TIME);
+
+        if (ticks > 0)
+        {
+            state->SetCounter("free_p50_ms", floating.p50);
+            state->SetCounter("free_p99_ms", floating.p99);
+            state->SetCounter("free_jitter_ms", floating.p99 - floating.p50);
+            state->SetCounter("pinned_p50_ms", pinned.p50);
+            state->SetCounter("pinned_p99_ms", pinned.p99);
+            state->SetCounter("pinned_jitter_ms", pinned.p99 - pinned.p50);
+            state->SetCounter("pinned_workers", (double)jobs.numPinnedWorkers);
+        }
+
+        state->itemsPerIteration = numBoids;
+        StopJobSystem(&jobs);
+        FreeBenchmarkFlock(&flock);
+    }
+
+    // Reading through a flock as the steering pass splits it between the threads, from memory that was first touched
+    // by those threads (see FirstTouchBoids), and then from a copy of it that was all written by the main thread, the
+    // way GameMemory was filled before. On a machine with several NUMA nodes the first is read locally by every node
+    // and the second only by the main thread's node; the per-node numbers show the difference node by node.
+    constexpr int maxBandwidthNodes = 4;
+    constexpr int boidsPerStreamTask = 4096;
+
+    struct alignas(64) ThreadStreamTotals
+    {
+        int64_t bytes;
+        uint64_t sum;
+    };
+
+    struct StreamJob
+    {
+        const Boid* boids;
+        int numBoids;
+        ThreadStreamTotals threads[maxJobWorkers + 1];
+        double busyMilliseconds[maxJobWorkers + 1];
+    };
+
+    void RunStreamTask(void* data, const int taskIndex, const int threadIndex)
+    {
+        StreamJob* job = (StreamJob*)data;
+
+        const int first = taskIndex * boidsPerStreamTask;
+        const int last = (job->numBoids - first < boidsPerStreamTask) ? job->numBoids : first + boidsPerStreamTask;
+
+        // Summed as whole words, which vectorizes, so the loop is bound by memory rather than by float additions.
+        const uint64_t* words = (const uint64_t*)(job->boids + first);
+        const size_t numWords = sizeof(Boid) * (last - first) / sizeof(uint64_t);
+
+        uint64_t sum = 0;
+        for (size_t i = 0; i < numWords; i++)
+        {
+            sum += words[i];
+        }
+
+        job->threads[threadIndex].bytes += (int64_t)(sizeof(Boid) * (last - first));
+        job->threads[threadIndex].sum += sum;
+    }
+
+    void StreamFlock(JobSystem* jobs, StreamJob* job)
+    {
+        RunJobs(jobs, RunStreamTask, job, (job->numBoids + boidsPerStreamTask - 1) / boidsPerStreamTask);
+
+        for (int t = 0; t < GetJobThreadCount(jobs); t++)
+        {
+            job->busyMilliseconds[t] += jobs->queues[t].busyMilliseconds;
+        }
+    }
+
+    int64_t GetStreamedBytes(const JobSystem* jobs, const StreamJob* job, const int node)
+    {
+        int64_t bytes = 0;
+        uint64_t sum = 0;
+        for (int t = 0; t < GetJobThreadCount(jobs); t++)
+        {
+            if (node < 0 || jobs->queues[t].node == node)
+            {
+                bytes += job->threads[t].bytes;
+                sum += job->threads[t].sum;
+            }
+        }
+
+        DoNotOptimize(sum);
+        return bytes;
+    }
+
+    // A node's bytes over the time its busiest thread took.
+    double GetNodeGigabytesPerSecond(const JobSystem* jobs, const StreamJob* job, const int node)
+    {
+        double milliseconds = 0.0;
+        for (int t = 0; t < GetJobThreadCount(jobs); t++)
+        {
+            if (jobs->queues[t].node == node && job->busyMilliseconds[t] > milliseconds)
+            {
+                milliseconds = job->busyMilliseconds[t];
+            }
+        }
+
+        return (milliseconds > 0.0) ? GetStreamedBytes(jobs, job, node) / (milliseconds * 1e6) : 0.0;
+    }
+
+    void BM_NodeBandwidth(BenchmarkState* state)
+    {
+        static const char* const nodeCounterNames[maxBandwidthNodes] =
+        {
+            "node0_gb_s", "node1_gb_s", "node2_gb_s", "node3_gb_s",
+        };
+
+        JobSystem jobs = {};
+        StartJobSystem(&jobs, 0);
+
+        const int numBoids = state->arg;
+        const size_t boidsSize = sizeof(Boid) * numBoids;
+
+        BenchmarkFlock flock = {};
+        Boid* oneNodeBoids = (Boid*)PlatformAllocateMemory(boidsSize);
+        if (!oneNodeBoids || !CreateBenchmarkFlock(&flock, numBoids, &jobs))
+        {
+            state->error = "out of memory";
+            StopJobSystem(&jobs);
+            if (oneNodeBoids)
+            {
+                PlatformFreeMemory(oneNodeBoids, boidsSize);
+            }
+            FreeBenchmarkFlock(&flock);
+            return;
+        }
+
+        std::memcpy(oneNodeBoids, flock.gameState->boids, boidsSize);
+
+        // Both are big, and only used by this benchmark.
+        static StreamJob firstTouched;
+        static StreamJob oneNode;
+        firstTouched = {};
+        firstTouched.boids = flock.gameState->boids;
+        firstTouched.numBoids = numBoids;
+        oneNode = firstTouched;
+        oneNode.boids = oneNodeBoids;
+
+        uint64_t iterations = 0;
+        while (state->KeepRunning())
+        {
+            StreamFlock(&jobs, &firstTouched);
+            iterations++;
+        }
+
+        const auto oneNodeStart = std::chrono::steady_clock::now();
+        for (uint64_t i = 0; i < iterations; i++)
+        {
+            StreamFlock(&jobs, &oneNode);
+        }
+        const double oneNodeSeconds = SecondsSince(oneNodeStart);
+
+        if (iterations > 0 && state->seconds > 0.0 && oneNodeSeconds > 0.0)
+        {
+            state->SetCounter("nodes", (double)jobs.numNodes);
+            state->SetCounter("gb_s", GetStreamedBytes(&jobs, &firstTouched, -1) / (state->seconds * 1e9));
+            state->SetCounter("one_node_gb_s", GetStreamedBytes(&jobs, &oneNode, -1) / (oneNodeSeconds * 1e9));
+
+            for (int node = 0; node < jobs.numNodes && node < maxBandwidthNodes; node++)
+            {
+                state->SetCounter(nodeCounterNames[node], GetNodeGigabytesPerSecond(&jobs, &firstTouched, node));
+            }
+        }
+
+        state->itemsPerIteration = numBoids;
+        StopJobSystem(&jobs);
+        PlatformFreeMemory(oneNodeBoids, boidsSize);
+        FreeBenchmarkFlock(&flock);
+    }
+
+    // Every boid starts in exactly the same spot as another, with the same velocity. Besides timing the tick, this
+    // checks that such pairs are steered apart rather than dividing by their zero distance or ignoring each other.
+    void BM_UpdateBoidsColocated(BenchmarkState* state)
+    {
+        BenchmarkFlock flock = {};
+        if (!CreateBenchmarkFlock(&flock, state->arg))
+        {
+            state->error = "out of memory";
+            return;
+        }
+
+        GameState* gameState = flock.gameState;
+        Boid* boids = gameState->boids;
+        const int numPairs = gameState->numBoids / 2;
+
+        for (int pair = 0; pair < numPairs; pair++)
+        {
+            boids[pair * 2 + 1] = boids[pair * 2];
+        }
+
+        UpdateBoids(gameState);
+
+        for (int pair = 0; pair < numPairs && !state->error; pair++)
+        {
+            const Boid& first = gameState->boids[pair * 2];
+            const Boid& second = gameState->boids[pair * 2 + 1];
+
+            if (first.position.x != first.position.x || second.position.x != second.position.x)
+            {
+                state->error = "co-located boids produced NaN";
+            }
+            else if (first.position.x == second.position.x && first.position.y == second.position.y &&
+                first.position.z == second.position.z)
+            {
+                state->error = "co-located boids were not separated";
+            }
+        }
+
+        while (!state->error && state->KeepRunning())
+        {
+            UpdateBoids(gameState);
+        }
+
+        state->itemsPerIteration = state->arg;
+        FreeBenchmarkFlock(&flock);
+    }
+
+    // Builds the grid for a flock and for the same flock one simulated tick later, one after the other, with the cells
+    // the simulation uses, so every build after the first sees a tick's worth of boids change cell. The boids start as
+    // slow as a new run's do (see main.cpp); the synthetic flock's speeds would move several times as many. With a
+    // rebuildFraction of 0 each is a full counting sort.
+    void RunSpatialGridBenchmark(BenchmarkState* state, const float rebuildFraction)
+    {
+        BenchmarkFlock flock = {};
+        if (!CreateBenchmarkFlock(&flock, state->arg))
+        {
+            state->error = "out of memory";
+            return;
+        }
+
+        GameState* gameState = flock.gameState;
+        const int numBoids = gameState->numBoids;
+        const float cellSize = GetGridCellSize(&gameState->params, gameState->worldSize);
+
+        const size_t boidsSize = sizeof(Boid) * numBoids;
+        Boid* firstBoids = (Boid*)PlatformAllocateMemory(boidsSize);
+        if (!firstBoids)
+        {
+            state->error = "out of memory";
+            FreeBenchmarkFlock(&flock);
+            return;
+        }
+        for (int i = 0; i < numBoids; i++)
+        {
+            gameState->boids[i].velocity = CreateRandomVector3() * 0.3f;
+        }
+        std::memcpy(firstBoids, gameState->boids, boidsSize);
+        UpdateBoids(gameState);
+
+        SpatialGrid* grid = &gameState->grid;
+        grid->rebuildFraction = rebuildFraction;
+
+        const Boid* flocks[2] = { firstBoids, gameState->boids };
+        uint64_t builds = 0;
+        uint64_t updates = 0;
+        int64_t movers = 0;
+
+        while (state->KeepRunning())
+        {
+            if (!BuildSpatialGrid(grid, flocks[builds % 2], numBoids, gameState->worldSize, cellSize))
+            {
+                state->error = "out of memory";
+                break;
+            }
+            DoNotOptimize(grid->maxCellBoids);
+
+            builds++;
+            updates += grid->merging ? 1 : 0;
+            movers += grid->merging ? grid->numMovers : 0;
+        }
+
+        state->SetCounter("cells", (double)grid->numCells);
+        state->SetCounter("cell_max", (double)grid->maxCellBoids);
+        state->SetCounter("updated", (builds > 0) ? (double)updates / builds : 0.0);
+        state->SetCounter("movers", (updates > 0) ? (double)movers / updates / numBoids : 0.0);
+
+        state->itemsPerIteration = state->arg;
+        PlatformFreeMemory(firstBoids, boidsSize);
+        FreeBenchmarkFlock(&flock);
+    }
+
+    // The counting sort into grid cells, from scratch every tick.
+    void BM_BuildSpatialGrid(BenchmarkState* state)
+    {
+        RunSpatialGridBenchmark(state, 0.0f);
+    }
+
+    // The same grid updated from the last tick's, moving only the boids that changed cell.
+    void BM_UpdateSpatialGrid(BenchmarkState* state)
+    {
+        RunSpatialGridBenchmark(state, gridRebuildFraction);
+    }
+
+    void BM_RandomFloat(BenchmarkState* state)
+    {
+        SeedRandom(1);
+        while (state->KeepRunning())
+        {
+            DoNotOptimize(RandomFloat(-1.0f, 1.0f));
+        }
+
+        state->itemsPerIteration = 1;
+    }
+
+    void BM_CreateRandomVector3(BenchmarkState* state)
+    {
+        SeedRandom(1);
+        while (state->KeepRunning())
+        {
+            DoNotOptimize(CreateRandomVector3());
+        }
+
+        state->itemsPerIteration = 1;
+    }
+
+    // The operator mix the steering rules use: accumulate, subtract, scale and divide, over a small array that stays
+    // in the cache.
+    void BM_Vector3Operators(BenchmarkState* state)
+    {
+        constexpr int count = 1024;
+        Vector3 a[count];
+        Vector3 b[count];
+
+        SeedRandom(1);
+        for (int i = 0; i < count; i++)
+        {
+            a[i] = CreateRandomVector3();
+            b[i] = CreateRandomVector3();
+        }
+
+        while (state->KeepRunning())
+        {
+            Vector3 sum = {};
+            for (int i = 0; i < count; i++)
+            {
+                Vector3 v = (a[i] - b[i]) * 0.5f;
+                v /= 3.0f;
+                sum += v + b[i];
+                sum -= a[i] / 2.0f;
+            }
+            DoNotOptimize(sum);
+        }
+
+        state->itemsPerIteration = count;
+    }
+
+    // The CPU half of DrawBoids: turning positions and velocities into world-space triangles.
+    void BM_BuildBoidVertices(BenchmarkState* state)
+    {
+        BenchmarkFlock flock = {};
+        const size_t verticesSize = sizeof(float) * boidVertexCount * 3 * state->arg;
+        float* vertices = (float*)PlatformAllocateMemory(verticesSize);
+
+        if (!vertices || !CreateBenchmarkFlock(&flock, state->arg))
+        {
+            state->error = "out of memory";
+            return;
+        }
+
+        while (state->KeepRunning())
+        {
+            BuildBoidVertices(flock.gameState->boids, flock.gameState->numBoids, 3.0f, vertices);
+            DoNotOptimize(vertices[0]);
+        }
+
+        state->itemsPerIteration = state->arg;
+        FreeBenchmarkFlock(&flock);
+        PlatformFreeMemory(vertices, verticesSize);
+    }
+
+    // The codec cycles through a fixed run of frames so large flocks don't need a long recording in memory. The first
+    // frame of every cycle is a keyframe.
+    constexpr int codecBenchmarkFrames = 16;
+
+    struct CodecBenchmark
+    {
+        JobSystem jobs;
+        FrameCodec encoder;
+        FrameCodec decoder;
+        Boid* frames;
+        size_t framesSize;
+        Boid* decoded;
+        uint8_t* encoded[codecBenchmarkFrames];
+        size_t encodedSizes[codecBenchmarkFrames];
+        size_t maxEncodedSize;
+    };
+
+    bool InitCodecBenchmark(CodecBenchmark* bench, const int numBoids)
+    {
+        constexpr float worldSize = 100.0f;
+
+        StartJobSystem(&bench->jobs, 0);
+
+        bench->framesSize = sizeof(Boid) * numBoids * codecBenchmarkFrames;
+        bench->frames = (Boid*)PlatformAllocateMemory(bench->framesSize);
+        bench->decoded = (Boid*)PlatformAllocateMemory(sizeof(Boid) * numBoids);
+
+        if (!bench->frames || !bench->decoded ||
+            !InitFrameCodec(&bench->encoder, numBoids, worldSize, syntheticMaxSpeed, &bench->jobs) ||
+            !InitFrameCodec(&bench->decoder, numBoids, worldSize, syntheticMaxSpeed, &bench->jobs))
+        {
+            return false;
+        }
+
+        bench->maxEncodedSize = MaxEncodedFrameSize(&bench->encoder);
+
+        SeedRandom(1);
+        Boid* boids = bench->frames;
+        for (int i = 0; i < numBoids; i++)
+        {
+            boids[i].position = { RandomFloat(-worldSize, worldSize), RandomFloat(-worldSize, worldSize),
+                RandomFloat(-worldSize, worldSize) };
+            boids[i].velocity = CreateRandomVector3() * (syntheticMaxSpeed * 0.5f);
+        }
+
+        for (int frame = 1; frame < codecBenchmarkFrames; frame++)
+        {
+            Boid* next = bench->frames + (size_t)frame * numBoids;
+            std::memcpy(next, next - numBoids, sizeof(Boid) * numBoids);
+            StepSyntheticFlock(next, numBoids, worldSize);
+        }
+
+        for (int frame = 0; frame < codecBenchmarkFrames; frame++)
+        {
+            bench->encoded[frame] = (uint8_t*)PlatformAllocateMemory(bench->maxEncodedSize);
+            if (!bench->encoded[frame])
+            {
+                return false;
+            }
+
+            bench->encodedSizes[frame] = EncodeFrame(&bench->encoder, bench->frames + (size_t)frame * numBoids,
+                frame == 0, bench->encoded[frame]);
+        }
+
+        return true;
+    }
+
+    void FreeCodecBenchmark(CodecBenchmark* bench)
+    {
+        for (int frame = 0; frame < codecBenchmarkFrames; frame++)
+        {
+            PlatformFreeMemory(bench->encoded[frame], bench->maxEncodedSize);
+        }
+
+        FreeFrameCodec(&bench->decoder);
+        FreeFrameCodec(&bench->encoder);
+        PlatformFreeMemory(bench->decoded, sizeof(Boid) * bench->encoder.numBoids);
+        PlatformFreeMemory(bench->frames, bench->framesSize);
+        StopJobSystem(&bench->jobs);
+    }
+
+    void SetCodecCounters(BenchmarkState* state, const CodecBenchmark* bench)
+    {
+        size_t encodedBytes = 0;
+        for (int frame = 0; frame < codecBenchmarkFrames; frame++)
+        {
+            encodedBytes += bench->encodedSizes[frame];
+        }
+
+        state->SetCounter("compression_ratio", (double)bench->framesSize / encodedBytes);
+        state->SetCounter("bytes_per_boid", (double)encodedBytes / ((double)codecBenchmarkFrames * state->arg));
+        state->itemsPerIteration = state->arg;
+    }
+
+    void BM_EncodeFrame(BenchmarkState* state)
+    {
+        CodecBenchmark bench = {};
+        if (!InitCodecBenchmark(&bench, state->arg))
+        {
+            state->error = "out of memory";
+            FreeCodecBenchmark(&bench);
+            return;
+        }
+
+        int frame = 0;
+        while (state->KeepRunning())
+        {
+            bench.encodedSizes[frame] = EncodeFrame(&bench.encoder, bench.frames + (size_t)frame * state->arg,
+                frame == 0, bench.encoded[frame]);
+            frame = (frame + 1) % codecBenchmarkFrames;
+        }
+
+        SetCodecCounters(state, &bench);
+        FreeCodecBenchmark(&bench);
+    }
+
+    void BM_DecodeFrame(BenchmarkState* state)
+    {
+        CodecBenchmark bench = {};
+        if (!InitCodecBenchmark(&bench, state->arg))
+        {
+            state->error = "out of memory";
+            FreeCodecBenchmark(&bench);
+            return;
+        }
+
+        int frame = 0;
+        while (state->KeepRunning())
+        {
+            if (!DecodeFrame(&bench.decoder, bench.encoded[frame], bench.encodedSizes[frame], bench.decoded))
+            {
+                state->error = "decode failed";
+            }
+            frame = (frame + 1) % codecBenchmarkFrames;
+        }
+
+        SetCodecCounters(state, &bench);
+        FreeCodecBenchmark(&bench);
+    }
+
+    const Benchmark benchmarks[] = {
+        { "BM_Align/1000", BM_Align, 1000, false },
+        { "BM_Align/10000", BM_Align, 10000, false },
+        { "BM_Cohere/1000", BM_Cohere, 1000, false },
+        { "BM_Cohere/10000", BM_Cohere, 10000, false },
+        { "BM_Separate/1000", BM_Separate, 1000, false },
+        { "BM_Separate/10000", BM_Separate, 10000, false },
+        { "BM_SteerFromBoundary/10000", BM_SteerFromBoundary, 10000, false },
+        { "BM_ComputeBoundaryForces/10000", BM_ComputeBoundaryForces, 10000, false },
+        { "BM_UpdateBoids/1000", BM_UpdateBoids, 1000, false },
+        { "BM_UpdateBoids/10000", BM_UpdateBoids, 10000, false },
+        { "BM_UpdateBoids/100000", BM_UpdateBoids, 100000, false },
+        { "BM_UpdateBoids/1000000", BM_UpdateBoids, 1000000, true },
+        { "BM_UpdateBoidsDeterministic/1000", BM_UpdateBoidsDeterministic, 1000, false },
+        { "BM_UpdateBoidsDeterministic/10000", BM_UpdateBoidsDeterministic, 10000, false },
+        { "BM_UpdateBoidsGeneric/1000", BM_UpdateBoidsGeneric, 1000, false },
+        { "BM_UpdateBoidsGeneric/10000", BM_UpdateBoidsGeneric, 10000, false },
+        { "BM_UpdateBoidsTopological/1000", BM_UpdateBoidsTopological, 1000, false },
+        { "BM_UpdateBoidsTopologicalGeneric/1000", BM_UpdateBoidsTopologicalGeneric, 1000, false },
+        { "BM_UpdateBoidsWrap/1000", BM_UpdateBoidsWrap, 1000, false },
+        { "BM_UpdateBoidsWrap/10000", BM_UpdateBoidsWrap, 10000, false },
+        { "BM_UpdateBoidsThreaded/100000", BM_UpdateBoidsThreaded, 100000, false },
+        { "BM_UpdateBoidsThreaded/1000000", BM_UpdateBoidsThreaded, 1000000, true },
+        { "BM_UpdateBoidsClustered/100000", BM_UpdateBoidsClustered, 100000, false },
+        { "BM_UpdateBoidsColocated/1000", BM_UpdateBoidsColocated, 1000, false },
+        { "BM_NodeBandwidth/1000000", BM_NodeBandwidth, 1000000, false },
+        { "BM_TickJitter/100000", BM_TickJitter, 100000, false },
+        { "BM_BuildSpatialGrid/10000", BM_BuildSpatialGrid, 10000, false },
+        { "BM_BuildSpatialGrid/100000", BM_BuildSpatialGrid, 100000, false },
+        { "BM_BuildSpatialGrid/1000000", BM_BuildSpatialGrid, 1000000, true },
+        { "BM_UpdateSpatialGrid/10000", BM_UpdateSpatialGrid, 10000, false },
+        { "BM_UpdateSpatialGrid/100000", BM_UpdateSpatialGrid, 100000, false },
+        { "BM_UpdateSpatialGrid/1000000", BM_UpdateSpatialGrid, 1000000, true },
+        { "BM_RandomFloat", BM_RandomFloat, 0, false },
+        { "BM_CreateRandomVector3", BM_CreateRandomVector3, 0, false },
+        { "BM_Vector3Operators", BM_Vector3Operators, 0, false },
+        { "BM_BuildBoidVertices/1000", BM_BuildBoidVertices, 1000, false },
+        { "BM_BuildBoidVertices/100000", BM_BuildBoidVertices, 100000, false },
+        { "BM_EncodeFrame/10000", BM_EncodeFrame, 10000, false },
+        { "BM_EncodeFrame/100000", BM_EncodeFrame, 100000, false },
+        { "BM_DecodeFrame/10000", BM_DecodeFrame, 10000, false },
+        { "BM_DecodeFrame/100000", BM_DecodeFrame, 100000, false },
+    };
+
+    BenchmarkState RunBenchmarkOnce(const Benchmark* benchmark, const uint64_t iterations)
+    {
+        BenchmarkState state = {};
+        state.arg = benchmark->arg;
+        state.maxIterations = iterations;
+        benchmark->function(&state);
+        return state;
+    }
+
+    // Returns false if the benchmark reported an error.
+    bool RunBenchmark(const Benchmark* benchmark, BenchmarkResult* result)
+    {
+        // Grow the iteration count until a run is long enough to time reliably.
+        uint64_t iterations = 1;
+        BenchmarkState state = RunBenchmarkOnce(benchmark, iterations);
+        while (!state.error && state.seconds < benchmarkMinSeconds && iterations < benchmarkMaxIterations)
+        {
+            const double predicted = (state.seconds > 0.0) ? benchmarkMinSeconds * 1.4 / state.seconds * iterations :
+                (double)iterations * 10.0;
+            const double grown = (predicted > iterations * 10.0) ? iterations * 10.0 : predicted;
+            iterations = (grown > benchmarkMaxIterations) ? benchmarkMaxIterations : (uint64_t)grown + 1;
+
+            state = RunBenchmarkOnce(benchmark, iterations);
+        }
+
+        double nanoseconds[benchmarkRepetitions];
+        for (int repetition = 0; repetition < benchmarkRepetitions && !state.error; repetition++)
+        {
+            state = RunBenchmarkOnce(benchmark, iterations);
+            nanoseconds[repetition] = state.seconds * 1e9 / iterations;
+        }
+
+        if (state.error)
+        {
+            std::printf("%-40s ERROR: %s\n", benchmark->name, state.error);
+            return false;
+        }
+
+        std::sort(nanoseconds, nanoseconds + benchmarkRepetitions);
+
+        *result = {};
+        std::snprintf(result->name, sizeof(result->name), "%s", benchmark->name);
+        result->iterations = iterations;
+        result->nanoseconds = nanoseconds[benchmarkRepetitions / 2];
+        result->itemsPerSecond = (double)state.itemsPerIteration * 1e9 / result->nanoseconds;
+
+        // Hardware counters are reported per iteration, like Google Benchmark's perf counters.
+        for (int i = 0; i < PERF_COUNTER_COUNT; i++)
+        {
+            if (state.counters.availableMask & (1u << i))
+            {
+                state.SetCounter(GetPerfCounterName((PerfCounter)i), (double)state.counters.counts[i] / iterations);
+            }
+        }
+
+        result->numCounters = state.numCounters;
+        for (int i = 0; i < state.numCounters; i++)
+        {
+            result->counterNames[i] = state.counterNames[i];
+            result->counterValues[i] = state.counterValues[i];
+        }
+
+        return true;
+    }
+
+    void PrintBenchmarkResult(const BenchmarkResult* result)
+    {
+        double time = result->nanoseconds;
+        const char* unit = "ns";
+        if (time >= 1e6)
+        {
+            time /= 1e6;
+            unit = "ms";
+        }
+        else if (time >= 1e3)
+        {
+            time /= 1e3;
+            unit = "us";
+        }
+
+        std::printf("%-40s %10.3f %s %12llu %12.4gM/s", result->name, time, unit,
+            (unsigned long long)result->iterations, result->itemsPerSecond / 1e6);
+
+        for (int i = 0; i < result->numCounters; i++)
+        {
+            std::printf(" %s=%.4g", result->counterNames[i], result->counterValues[i]);
+        }
+
+        if (result->baselineNanoseconds > 0.0)
+        {
+            const double change = (result->nanoseconds - result->baselineNanoseconds) / result->baselineNanoseconds;
+            std::printf(" %+.1f%%%s", change * 100.0, result->regression ? " REGRESSION" : "");
+        }
+
+        std::putchar('\n');
+    }
+
+    bool WriteBenchmarkJson(const char* path, const BenchmarkResult* results, const int numResults)
+    {
+        FILE* file = std::fopen(path, "wb");
+        if (!file)
+        {
+            std::printf("ERROR: Failed to open '%s' for writing.\n", path);
+            return false;
+        }
+
+        char date[32] = {};
+        const std::time_t now = std::time(nullptr);
+        std::strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", std::localtime(&now));
+
+#if defined(NDEBUG)
+        const char* buildType = "release";
+#else
+        const char* buildType = "debug";
+#endif
+
+        std::fprintf(file, "{\n  \"context\": {\n");
+        std::fprintf(file, "    \"date\": \"%s\",\n", date);
+        std::fprintf(file, "    \"num_cpus\": %u,\n", std::thread::hardware_concurrency());
+        std::fprintf(file, "    \"library_build_type\": \"%s\"\n", buildType);
+        std::fprintf(file, "  },\n  \"benchmarks\": [\n");
+
+        for (int i = 0; i < numResults; i++)
+        {
+            const BenchmarkResult* result = &results[i];
+            std::fprintf(file, "    {\n");
+            std::fprintf(file, "      \"name\": \"%s\",\n", result->name);
+            std::fprintf(file, "      \"iterations\": %llu,\n", (unsigned long long)result->iterations);
+            std::fprintf(file, "      \"real_time\": %.6g,\n", result->nanoseconds);
+            std::fprintf(file, "      \"time_unit\": \"ns\",\n");
+            for (int c = 0; c < result->numCounters; c++)
+            {
+                std::fprintf(file, "      \"%s\": %.6g,\n", result->counterNames[c], result->counterValues[c]);
+            }
+            std::fprintf(file, "      \"items_per_second\": %.6g\n", result->itemsPerSecond);
+            std::fprintf(file, "    }%s\n", (i + 1 < numResults) ? "," : "");
+        }
+
+        std::fprintf(file, "  ]\n}\n");
+
+        const bool ok = std::ferror(file) == 0;
+        std::fclose(file);
+
+        if (!ok)
+        {
+            std::printf("ERROR: Failed to write '%s'.\n", path);
+        }
+
+        return ok;
+    }
+
+    // Reads back the real_time of every benchmark from a file written by WriteBenchmarkJson. This is only a scanner
+    // for our own output, not a JSON parser: it expects each "name" to come before that benchmark's "real_time".
+    bool ApplyBenchmarkBaseline(const char* path, BenchmarkResult* results, const int numResults,
+        const double thresholdPercent)
+    {
+        FILE* file = std::fopen(path, "rb");
+        if (!file)
+        {
+            std::printf("ERROR: Failed to open baseline '%s'.\n", path);
+            return false;
+        }
+
+        std::fseek(file, 0, SEEK_END);
+        const long size = std::ftell(file);
+        std::fseek(file, 0, SEEK_SET);
+
+        char* text = (char*)std::malloc(size + 1);
+        const size_t read = text ? std::fread(text, 1, size, file) : 0;
+        std::fclose(file);
+
+        if (!text || read != (size_t)size)
+        {
+            std::printf("ERROR: Failed to read baseline '%s'.\n", path);
+            std::free(text);
+            return false;
+        }
+        text[size] = '\0';
+
+        constexpr const char* nameKey = "\"name\": \"";
+        constexpr const char* timeKey = "\"real_time\": ";
+
+        const char* cursor = text;
+        while ((cursor = std::strstr(cursor, nameKey)) != nullptr)
+        {
+            const char* name = cursor + std::strlen(nameKey);
+            const char* nameEnd = std::strchr(name, '"');
+            const char* time = nameEnd ? std::strstr(nameEnd, timeKey) : nullptr;
+            if (!time)
+            {
+                break;
+            }
+
+            const size_t nameLength = nameEnd - name;
+            const double baselineNanoseconds = std::strtod(time + std::strlen(timeKey), nullptr);
+
+            for (int i = 0; i < numResults; i++)
+            {
+                BenchmarkResult* result = &results[i];
+                if (std::strlen(result->name) == nameLength && std::strncmp(result->name, name, nameLength) == 0)
+                {
+                    result->baselineNanoseconds = baselineNanoseconds;
+                    result->regression = baselineNanoseconds > 0.0 &&
+                        result->nanoseconds > baselineNanoseconds * (1.0 + thresholdPercent / 100.0);
+                }
+            }
+
+            cursor = nameEnd;
+        }
+
+        std::free(text);
+        return true;
+    }
+}
+
+int RunTrajectoryDecodeBenchmark(const char* path)
+{
+    TrajectoryReader reader = {};
+    if (!OpenTrajectory(path, &reader))
+    {
+        return -1;
+    }
+
+    const TrajectoryHeader* header = reader.header;
+    const uint64_t numFrames = header->frameCount;
+
+    if (numFrames == 0)
+    {
+        std::printf("ERROR: '%s' has no frames.\n", path);
+        CloseTrajectory(&reader);
+        return -1;
+    }
+
+    const size_t boidsSize = sizeof(Boid) * header->numBoids;
+    Boid* boids = (Boid*)PlatformAllocateMemory(boidsSize > 0 ? boidsSize : 1);
+    if (!boids)
+    {
+        std::puts("ERROR: Failed to allocate memory for decoding.");
+        CloseTrajectory(&reader);
+        return -1;
+    }
+
+    const char* format = (header->flags & trajectoryFlagCompressed) ? "compressed" :
+        ((header->flags & trajectoryFlagQuantizedPositions) ? "16-bit positions" : "float");
+
+    std::printf("%s: %d boids, %llu frames, %.1f KB per frame, %s\n",
+        path, header->numBoids, (unsigned long long)numFrames,
+        (double)(reader.file.size - header->headerSize) / numFrames / 1024.0, format);
+
+    // Nothing else runs during the benchmark, so decoding gets every core.
+    JobSystem decodeJobs = {};
+    StartJobSystem(&decodeJobs, 0);
+    SetTrajectoryDecodeJobs(&reader, (decodeJobs.numWorkers > 0) ? &decodeJobs : nullptr);
+
+    // Sequential playback, streamed the same way the replay viewer does it.
+    {
+        const auto start = std::chrono::steady_clock::now();
+        for (uint64_t frame = 0; frame < numFrames; frame++)
+        {
+            if (frame + 1 < numFrames)
+            {
+                PrefetchTrajectoryFrame(&reader, frame + 1);
+            }
+
+            DecodeTrajectoryFrame(&reader, frame, boids);
+            EvictTrajectoryFrame(&reader, frame);
+        }
+        PrintDecodeResult("sequential", &reader, numFrames, SecondsSince(start));
+    }
+
+    // Seeking around. Stepping by a large odd stride modulo the frame count visits every frame exactly once when the
+    // two are coprime, and most of them otherwise.
+    {
+        const uint64_t stride = 7919;
+        uint64_t frame = 0;
+
+        const auto start = std::chrono::steady_clock::now();
+        for (uint64_t i = 0; i < numFrames; i++)
+        {
+            DecodeTrajectoryFrame(&reader, frame, boids);
+            EvictTrajectoryFrame(&reader, frame);
+            frame = (frame + stride) % numFrames;
+        }
+        PrintDecodeResult("random", &reader, numFrames, SecondsSince(start));
+    }
+
+    StopJobSystem(&decodeJobs);
+    PlatformFreeMemory(boids, boidsSize > 0 ? boidsSize : 1);
+    CloseTrajectory(&reader);
+
+    return 0;
+}
+
+int RunFrameCodecBenchmark(const int numBoids)
+{
+    constexpr int numFrames = 64;
+    constexpr float worldSize = 100.0f;
+
+    if (numBoids <= 0)
+    {
+        std::puts("ERROR: The codec benchmark needs at least one boid.");
+        return -1;
+    }
+
+    JobSystem jobs = {};
+    StartJobSystem(&jobs, 0);
+
+    FrameCodec encoder = {};
+    FrameCodec decoder = {};
+
+    const size_t boidsSize = sizeof(Boid) * numBoids;
+    Boid* boids = (Boid*)PlatformAllocateMemory(boidsSize);
+    Boid* decoded = (Boid*)PlatformAllocateMemory(boidsSize);
+
+    const bool initialized =
+        boids && decoded &&
+        InitFrameCodec(&encoder, numBoids, worldSize, syntheticMaxSpeed, &jobs) &&
+        InitFrameCodec(&decoder, numBoids, worldSize, syntheticMaxSpeed, &jobs);
+
+    uint8_t* encoded = initialized ? (uint8_t*)PlatformAllocateMemory(MaxEncodedFrameSize(&encoder)) : nullptr;
+
+    if (!encoded)
+    {
+        std::puts("ERROR: Failed to allocate memory for the codec benchmark.");
+        return -1;
+    }
+
+    SeedRandom(1);
+    for (int i = 0; i < numBoids; i++)
+    {
+        boids[i].position = { RandomFloat(-worldSize, worldSize), RandomFloat(-worldSize, worldSize),
+            RandomFloat(-worldSize, worldSize) };
+        boids[i].velocity = CreateRandomVector3() * (syntheticMaxSpeed * 0.5f);
+    }
+
+    double encodeSeconds = 0.0;
+    double decodeSeconds = 0.0;
+    size_t encodedBytes = 0;
+    float maxPositionError = 0.0f;
+    float maxVelocityError = 0.0f;
+
+    for (int frame = 0; frame < numFrames; frame++)
+    {
+        if (frame > 0)
+        {
+            StepSyntheticFlock(boids, numBoids, worldSize);
+        }
+
+        const bool keyframe = (frame % 60) == 0;
+
+        auto start = std::chrono::steady_clock::now();
+        const size_t size = EncodeFrame(&encoder, boids, keyframe, encoded);
+        encodeSeconds += SecondsSince(start);
+
+        start = std::chrono::steady_clock::now();
+        const bool ok = DecodeFrame(&decoder, encoded, size, decoded);
+        decodeSeconds += SecondsSince(start);
+
+        if (!ok)
+        {
+            std::printf("ERROR: Frame %d failed to decode.\n", frame);
+            return -1;
+        }
+
+        encodedBytes += size;
+
+        for (int i = 0; i < numBoids; i++)
+        {
+            const float positionError = Vector3Distance(boids[i].position, decoded[i].position);
+            const float velocityError = Vector3Distance(boids[i].velocity, decoded[i].velocity);
+            maxPositionError = (positionError > maxPositionError) ? positionError : maxPositionError;
+            maxVelocityError = (velocityError > maxVelocityError) ? velocityError : maxVelocityError;
+        }
+    }
+
+    const double rawMegabytes = (double)boidsSize * numFrames / (1024.0 * 1024.0);
+    const double encodedMegabytes = (double)encodedBytes / (1024.0 * 1024.0);
+
+    std::printf("codec: %d boids, %d frames, %d threads\n", numBoids, numFrames, jobs.numWorkers + 1);
+    std::printf("  raw %.2f MB/frame, encoded %.2f MB/frame, ratio %.2fx (%.2f bytes/boid)\n",
+        rawMegabytes / numFrames, encodedMegabytes / numFrames, rawMegabytes / encodedMegabytes,
+        (double)encodedBytes / ((double)numBoids * numFrames));
+    std::printf("  encode %.1f MB/s (%.3f ms/frame), decode %.1f MB/s (%.3f ms/frame)\n",
+        rawMegabytes / encodeSeconds, encodeSeconds * 1000.0 / numFrames,
+        rawMegabytes / decodeSeconds, decodeSeconds * 1000.0 / numFrames);
+    std::printf("  max error: position %.5f, velocity %.5f\n", maxPositionError, maxVelocityError);
+
+    PlatformFreeMemory(encoded, MaxEncodedFrameSize(&encoder));
+    FreeFrameCodec(&decoder);
+    FreeFrameCodec(&encoder);
+    PlatformFreeMemory(decoded, boidsSize);
+    PlatformFreeMemory(boids, boidsSize);
+    StopJobSystem(&jobs);
+
+    return 0;
+}
+
+int RunBenchmarks(const BenchmarkOptions* options)
+{
+    constexpr int numBenchmarks = sizeof(benchmarks) / sizeof(benchmarks[0]);
+    BenchmarkResult results[numBenchmarks];
+    int numResults = 0;
+    bool failed = false;
+
+    std::printf("%-40s %13s %12s %14s\n", "Benchmark", "Time", "Iterations", "Items/s");
+
+    for (int i = 0; i < numBenchmarks; i++)
+    {
+        const Benchmark* benchmark = &benchmarks[i];
+
+        if (options->filter && !std::strstr(benchmark->name, options->filter))
+        {
+            continue;
+        }
+
+        // Giving the full name of a large benchmark as the filter is enough to run it.
+        if (benchmark->large && !options->includeLarge &&
+            !(options->filter && std::strcmp(options->filter, benchmark->name) == 0))
+        {
+            std::printf("%-40s skipped, run with --bench-large\n", benchmark->name);
+            continue;
+        }
+
+        if (RunBenchmark(benchmark, &results[numResults]))
+        {
+            PrintBenchmarkResult(&results[numResults]);
+            numResults++;
+        }
+        else
+        {
+            failed = true;
+        }
+    }
+
+    if (options->jsonPath && !WriteBenchmarkJson(options->jsonPath, results, numResults))
+    {
+        failed = true;
+    }
+
+    if (options->baselinePath)
+    {
+        if (!ApplyBenchmarkBaseline(options->baselinePath, results, numResults, options->regressionThreshold))
+        {
+            return -1;
+        }
+
+        std::printf("\nCompared with %s, regressions are more than %.1f%% slower:\n", options->baselinePath,
+            options->regressionThreshold);
+
+        int numRegressions = 0;
+        for (int i = 0; i < numResults; i++)
+        {
+            PrintBenchmarkResult(&results[i]);
+            numRegressions += results[i].regression ? 1 : 0;
+        }
+
+        if (numRegressions > 0)
+        {
+            std::printf("%d benchmark(s) regressed.\n", numRegressions);
+            return 1;
+        }
+    }
+
+    return failed ? -1 : 0;
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+// Headless benchmarks, run from the command line without opening a window.
+
+struct BenchmarkOptions
+{
+    const char* filter; // Only run benchmarks whose name contains this, or all of them when null.
+    const char* jsonPath; // Also write the results here, in a format close to Google Benchmark's JSON output.
+    const char* baselinePath; // Compare against results previously written with jsonPath.
+    double regressionThreshold; // Percent slower than the baseline that counts as a regression.
+    bool includeLarge; // Run the flock sizes that take minutes per iteration.
+};
+
+// Runs the registered microbenchmarks of the simulation kernels, the random number generator, the vector operators,
+// the draw preparation and the frame codec. Returns 1 if anything regressed against the baseline.
+int RunBenchmarks(const BenchmarkOptions* options);
+
+// Decodes every frame of a recorded trajectory, first in order and then in a scattered order, and prints the
+// throughput of each pass.
+int RunTrajectoryDecodeBenchmark(const char* path);
+
+// Compresses and decompresses a moving synthetic flock of `numBoids` boids with the frame codec and prints the
+// compression ratio against raw float frames and the encode/decode throughput.
+int RunFrameCodecBenchmark(const int numBoids);
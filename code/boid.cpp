@@ -1,97 +1,470 @@
 #include "boid.h"
 
+#include <algorithm>
+#include <array>
+#include <bit>
 #include <cstdio>
+#include <cstring>
+#include <utility>
 
 #include "rlgl.h"
 
+#include "grid.h"
+#include "jobs.h"
 #include "mathutils.h"
+#include "metrics.h"
+#include "perfcounters.h"
+#include "profiler.h"
 
 namespace
 {
-    constexpr float viewRadius = 16.0f;
-    constexpr float maxForce = 0.05f;
-    constexpr float boundaryThreshold = 5.0f;
-
-    Vector3 TurnBoidIfCloseToBoundary(const Boid& boid, const float worldLimit)
+    // The unit vector pointing from `other` to `position`, which separation pushes along. Two boids in exactly the same
+    // spot have no direction between them, so they are pushed apart along x instead, the one that comes first in the
+    // flock towards -x.
+    inline Vector3 GetSeparationDirection(const Vector3 position, const Vector3 other, const float distanceSquared,
+        const bool otherComesFirst)
     {
-        Vector3 steeringForce = {};
+        if (distanceSquared > 0.0f)
+        {
+            return (position - other) / std::sqrt(distanceSquared);
+        }
+
+        return { otherComesFirst ? 1.0f : -1.0f, 0.0f, 0.0f };
+    }
 
-        const float limit = worldLimit - boundaryThreshold;
-        const float bx = boid.position.x;
-        const float by = boid.position.y;
-        const float bz = boid.position.z;
+    // Boids that leave the world come back in at the opposite wall.
+    inline void WrapPosition(Boid* boid, const float worldLimit)
+    {
+        const float worldSize = 2.0f * worldLimit;
+        float* position[3] = { &boid->position.x, &boid->position.y, &boid->position.z };
 
-        if (bx > limit)
+        for (float* p : position)
         {
-            steeringForce.x = -maxForce * (1.0f - (worldLimit - bx) / boundaryThreshold);
+            if (*p >= worldLimit)
+            {
+                *p -= worldSize;
+            }
+            else if (*p < -worldLimit)
+            {
+                *p += worldSize;
+            }
         }
-        else if (bx < -limit)
+    }
+
+    // Boids that reach a wall are stopped there and bounce off it.
+    inline void ClampPosition(Boid* boid, const float worldLimit)
+    {
+        float* position[3] = { &boid->position.x, &boid->position.y, &boid->position.z };
+        float* velocity[3] = { &boid->velocity.x, &boid->velocity.y, &boid->velocity.z };
+
+        for (int axis = 0; axis < 3; axis++)
         {
-            steeringForce.x = maxForce * (1.0f - (worldLimit + bx) / boundaryThreshold);
+            if (*position[axis] > worldLimit)
+            {
+                *position[axis] = worldLimit;
+                *velocity[axis] = -*velocity[axis];
+            }
+            else if (*position[axis] < -worldLimit)
+            {
+                *position[axis] = -worldLimit;
+                *velocity[axis] = -*velocity[axis];
+            }
         }
+    }
+
+    // The steering kernel. One pass over the flock per boid gathers everything the enabled rules need, then the rules,
+    // the boundary and the integration are applied. The Config type says which rules are enabled and which neighbour
+    // and boundary modes are used: StaticKernelConfig has them as compile-time constants, so each instantiation only
+    // contains the branches it needs, while RuntimeKernelConfig reads them from SimParams as it goes.
+    //
+    // Boid::Align, Cohere and Separate compute the same forces by brute force over the whole flock. They add the
+    // neighbours up in index order rather than grid order, so they match the kernel to rounding, not bit for bit.
+    template <uint32_t Rules, NeighborMode Neighbors, BoundaryMode Boundary>
+    struct StaticKernelConfig
+    {
+        static constexpr bool align = (Rules & SIM_RULE_ALIGN) != 0;
+        static constexpr bool cohere = (Rules & SIM_RULE_COHERE) != 0;
+        static constexpr bool separate = (Rules & SIM_RULE_SEPARATE) != 0;
+        static constexpr NeighborMode neighborMode = Neighbors;
+        static constexpr BoundaryMode boundaryMode = Boundary;
+    };
+
+    struct RuntimeKernelConfig
+    {
+        bool align;
+        bool cohere;
+        bool separate;
+        NeighborMode neighborMode;
+        BoundaryMode boundaryMode;
+    };
 
-        if (by > limit)
+    // Keeps the `count` nearest boids seen so far sorted by distance. On equal distances the boid seen first stays
+    // ahead, so the result only depends on the flock, not on timing.
+    inline void InsertNearest(const int index, const float distanceSquared, const int count, int* numNearest,
+        int* nearest, float* nearestDistanceSquared)
+    {
+        int slot = *numNearest;
+        if (slot == count)
         {
-            steeringForce.y = -maxForce * (1.0f - (worldLimit - by) / boundaryThreshold);
+            if (distanceSquared >= nearestDistanceSquared[count - 1])
+            {
+                return;
+            }
+            slot--;
         }
-        else if (by < -limit)
+        else
         {
-            steeringForce.y = maxForce * (1.0f - (worldLimit + by) / boundaryThreshold);
+            (*numNearest)++;
         }
 
-        if (bz > limit)
+        while (slot > 0 && nearestDistanceSquared[slot - 1] > distanceSquared)
+        {
+            nearest[slot] = nearest[slot - 1];
+            nearestDistanceSquared[slot] = nearestDistanceSquared[slot - 1];
+            slot--;
+        }
+
+        nearest[slot] = index;
+        nearestDistanceSquared[slot] = distanceSquared;
+    }
+
+    // The image of `other` nearest to `position` in a world that wraps around, so that a boid just across a wall is as
+    // close as it looks from the inside and cohesion pulls towards it rather than back across the whole world.
+    inline Vector3 GetNearestImage(const Vector3 position, Vector3 other, const float worldLimit)
+    {
+        const float worldSize = 2.0f * worldLimit;
+        const float* from[3] = { &position.x, &position.y, &position.z };
+        float* to[3] = { &other.x, &other.y, &other.z };
+
+        for (int axis = 0; axis < 3; axis++)
         {
-            steeringForce.z = -maxForce * (1.0f - (worldLimit - bz) / boundaryThreshold);
+            const float delta = *to[axis] - *from[axis];
+            if (delta > worldLimit)
+            {
+                *to[axis] -= worldSize;
+            }
+            else if (delta < -worldLimit)
+            {
+                *to[axis] += worldSize;
+            }
         }
-        else if (bz < -limit)
+
+        return other;
+    }
+
+    // The sorted slots of the non-empty cells around one cell, its own included. Every boid in the cell reads the same
+    // ones, so they are worked out once per cell.
+    struct NeighborRanges
+    {
+        int start[27];
+        int end[27];
+        int count;
+    };
+
+    // The cell coordinates next to `cell` along one axis, in order -1, 0, +1. When wrapping they continue on the other
+    // side of the world, and with fewer than three cells along the axis each is only listed once.
+    inline int GetNeighborCellCoordinates(const int cell, const int cellsPerAxis, const bool wrap, int* coordinates)
+    {
+        int count = 0;
+        for (int offset = -1; offset <= 1; offset++)
         {
-            steeringForce.z = maxForce * (1.0f - (worldLimit + bz) / boundaryThreshold);
+            int c = cell + offset;
+            if (wrap)
+            {
+                c = (c < 0) ? c + cellsPerAxis : ((c >= cellsPerAxis) ? c - cellsPerAxis : c);
+                if ((count > 0 && coordinates[0] == c) || (count > 1 && coordinates[1] == c))
+                {
+                    continue;
+                }
+            }
+            else if (c < 0 || c >= cellsPerAxis)
+            {
+                continue;
+            }
+
+            coordinates[count++] = c;
         }
 
-        return steeringForce;
+        return count;
     }
 
-    void DrawBoid(const Boid& boid, const Color color, const float scale)
+    void GatherNeighborRanges(const SpatialGrid* grid, const int cx, const int cy, const int cz, const bool wrap,
+        NeighborRanges* ranges)
     {
-        constexpr int numIndices = 18;
-        constexpr int indices[numIndices] = {
-            2,1,0,
-            1,3,0,
-            4,3,1,
-            2,4,1,
-            0,4,2,
-            0,3,4,
-        };
+        int xs[3];
+        int ys[3];
+        int zs[3];
+        const int numXs = GetNeighborCellCoordinates(cx, grid->cellsPerAxis, wrap, xs);
+        const int numYs = GetNeighborCellCoordinates(cy, grid->cellsPerAxis, wrap, ys);
+        const int numZs = GetNeighborCellCoordinates(cz, grid->cellsPerAxis, wrap, zs);
 
-        constexpr int numVerts = 5;
-        constexpr float verts[numVerts * 3] = {
-            0.0f,  0.0f,  0.0f, // 0
-            0.0f,  0.0f, -1.0f, // 1
-            0.8f,  0.3f,  0.4f, // 2
-            -0.8f,  0.3f,  0.4f, // 3
-            0.0f, -0.1f,  0.0f, // 4
-        };
+        ranges->count = 0;
+        for (int z = 0; z < numZs; z++)
+        {
+            for (int y = 0; y < numYs; y++)
+            {
+                for (int x = 0; x < numXs; x++)
+                {
+                    const int cell = GetGridCellIndex(grid, xs[x], ys[y], zs[z]);
+                    if (grid->cellStart[cell] < grid->cellStart[cell + 1])
+                    {
+                        ranges->start[ranges->count] = grid->cellStart[cell];
+                        ranges->end[ranges->count] = grid->cellStart[cell + 1];
+                        ranges->count++;
+                    }
+                }
+            }
+        }
+    }
 
-        rlPushMatrix();
-        rlTranslatef(boid.position.x, boid.position.y, boid.position.z);
+    // Steers and moves the boid in sorted slot `slot`, reading its neighbours from the grid's sorted copy of the flock.
+    template <typename Config>
+    inline Boid StepBoid(const Config config, const GameState* gameState, const SpatialGrid* grid,
+        const NeighborRanges& ranges, const int slot, int* numNeighbors)
+    {
+        const SimParams& params = gameState->params;
+        const float worldLimit = gameState->worldSize;
+        const float maxForce = params.maxForce;
 
-        const float rotateAngle = (-RAD2DEG) * std::atan2(boid.velocity.x, -boid.velocity.z);
-        rlRotatef(rotateAngle, 0.0f, 1.0f, 0.0f);
+        const bool gathersView = config.align || config.cohere;
+        const bool topological = config.neighborMode == NEIGHBOR_MODE_TOPOLOGICAL;
+        const bool wrap = config.boundaryMode == BOUNDARY_MODE_WRAP;
 
-        rlScalef(scale, scale, scale);
+        const Boid* boids = grid->sortedBoids;
+        const Boid boid = boids[slot];
 
-        rlColor4ub(color.r, color.g, color.b, color.a);
+        Vector3 velocitySum = {};
+        Vector3 positionSum = {};
+        Vector3 separationSum = {};
+        int numAlignNeighbors = 0;
+        int numCohereNeighbors = 0;
+        int numSeparationNeighbors = 0;
 
-        rlBegin(RL_TRIANGLES);
-        for (int i = 0; i < numIndices; i++)
+        int nearest[maxTopologicalNeighbors];
+        float nearestDistanceSquared[maxTopologicalNeighbors];
+        int numNearest = 0;
+
+        for (int r = 0; r < ranges.count; r++)
         {
-            rlVertex3f(
-                verts[indices[i] * 3],
-                verts[indices[i] * 3 + 1],
-                verts[indices[i] * 3 + 2]);
+            for (int j = ranges.start[r]; j < ranges.end[r]; j++)
+            {
+                if (j == slot)
+                {
+                    continue;
+                }
+
+                const Boid other = boids[j];
+                const Vector3 otherPosition = wrap ?
+                    GetNearestImage(boid.position, other.position, worldLimit) : other.position;
+
+                const float distanceSquared = Vector3DistanceSqr(boid.position, otherPosition);
+
+                if (!topological)
+                {
+                    if (config.align && distanceSquared < params.alignRadiusSquared)
+                    {
+                        velocitySum += other.velocity;
+                        numAlignNeighbors++;
+                    }
+                    if (config.cohere && distanceSquared < params.cohereRadiusSquared)
+                    {
+                        positionSum += otherPosition;
+                        numCohereNeighbors++;
+                    }
+                }
+                else if (gathersView)
+                {
+                    InsertNearest(j, distanceSquared, params.topologicalNeighbors, &numNearest, nearest,
+                        nearestDistanceSquared);
+                }
+
+                if (config.separate && distanceSquared < params.separationDistanceSquared)
+                {
+                    numSeparationNeighbors++;
+                    // Divide by distance so closer boids have a higher impact on separation force. Boids in the
+                    // same cell are sorted by index, so the slots give the flock order of co-located boids.
+                    separationSum += GetSeparationDirection(boid.position, otherPosition, distanceSquared, j < slot);
+                }
+            }
         }
-        rlEnd();
-        rlPopMatrix();
+
+        if (gathersView && topological)
+        {
+            for (int n = 0; n < numNearest; n++)
+            {
+                const Boid& other = boids[nearest[n]];
+                if (config.align)
+                {
+                    velocitySum += other.velocity;
+                }
+                if (config.cohere)
+                {
+                    positionSum += wrap ? GetNearestImage(boid.position, other.position, worldLimit) : other.position;
+                }
+            }
+            numAlignNeighbors = numNearest;
+            numCohereNeighbors = numNearest;
+        }
+
+        Vector3 alignForce = {};
+        Vector3 cohereForce = {};
+        Vector3 separateForce = {};
+
+        if (config.align && numAlignNeighbors > 0)
+        {
+            alignForce = velocitySum;
+            alignForce /= (float)numAlignNeighbors;
+            alignForce -= boid.velocity;
+            alignForce = Vector3ClampValue(alignForce, 0.0f, maxForce);
+        }
+
+        if (config.cohere && numCohereNeighbors > 0)
+        {
+            cohereForce = positionSum;
+            cohereForce /= (float)numCohereNeighbors;
+            cohereForce -= boid.position;
+            cohereForce = Vector3ClampValue(cohereForce, 0, maxForce);
+        }
+
+        if (config.separate && numSeparationNeighbors > 0)
+        {
+            separateForce = separationSum;
+            separateForce /= (float)numSeparationNeighbors;
+            separateForce = Vector3ClampValue(separateForce, 0, maxForce);
+        }
+
+        Vector3 acceleration = alignForce * params.alignWeight + cohereForce * params.cohereWeight +
+            separateForce * params.separateWeight;
+
+        if (config.boundaryMode == BOUNDARY_MODE_STEER)
+        {
+            acceleration += grid->boundaryForces[slot];
+        }
+
+        Boid result = boid;
+        result.velocity += acceleration;
+        result.velocity = Vector3ClampValue(result.velocity, 0, params.maxSpeed);
+        result.position += result.velocity;
+
+        if (config.boundaryMode == BOUNDARY_MODE_WRAP)
+        {
+            WrapPosition(&result, worldLimit);
+        }
+        else if (config.boundaryMode == BOUNDARY_MODE_CLAMP)
+        {
+            ClampPosition(&result, worldLimit);
+        }
+
+        // The radii are all centred on the boid, so the largest count is the number of boids within reach of any
+        // enabled rule.
+        *numNeighbors = (numAlignNeighbors > numCohereNeighbors) ? numAlignNeighbors : numCohereNeighbors;
+        *numNeighbors = (numSeparationNeighbors > *numNeighbors) ? numSeparationNeighbors : *numNeighbors;
+
+        return result;
+    }
+
+    // Updates the boids in sorted slots [firstSlot, lastSlot) and writes each back to its own index in `destination`.
+    // The slots run through the grid cell by cell, so the neighbouring cells are gathered once for each cell the range
+    // touches. All neighbours are read from the grid's copy of the flock, so `destination` can be gameState->boids
+    // itself, and any split of the flock into ranges gives the same result.
+    template <typename Config>
+    void StepBoids(const Config config, const GameState* gameState, const SpatialGrid* grid, const int firstSlot,
+        const int lastSlot, Boid* destination, NeighborStats* stats)
+    {
+        if (firstSlot >= lastSlot)
+        {
+            return;
+        }
+
+        const bool wrap = config.boundaryMode == BOUNDARY_MODE_WRAP;
+        const int cellsPerAxis = grid->cellsPerAxis;
+        const int* cellStart = grid->cellStart;
+
+        // The cell holding the first slot: the last one that starts at or before it. Empty cells start at the same
+        // slot as the next one, so this skips them too.
+        const int cell = (int)(std::upper_bound(cellStart, cellStart + grid->numCells + 1, firstSlot) - cellStart) - 1;
+
+        NeighborRanges ranges;
+
+        for (int c = cell, slot = firstSlot; slot < lastSlot; c++)
+        {
+            const int cellEnd = cellStart[c + 1];
+            if (cellEnd <= slot)
+            {
+                continue;
+            }
+
+            const int cx = c % cellsPerAxis;
+            const int cy = (c / cellsPerAxis) % cellsPerAxis;
+            const int cz = c / (cellsPerAxis * cellsPerAxis);
+            GatherNeighborRanges(grid, cx, cy, cz, wrap, &ranges);
+
+            const int last = (cellEnd < lastSlot) ? cellEnd : lastSlot;
+            for (; slot < last; slot++)
+            {
+                int numNeighbors = 0;
+                destination[grid->sortedIndices[slot]] =
+                    StepBoid(config, gameState, grid, ranges, slot, &numNeighbors);
+
+                stats->total += numNeighbors;
+                stats->max = (numNeighbors > stats->max) ? numNeighbors : stats->max;
+            }
+        }
+    }
+
+    template <uint32_t Rules, NeighborMode Neighbors, BoundaryMode Boundary>
+    void StepBoidsSpecialized(const GameState* gameState, const SpatialGrid* grid, const int firstSlot,
+        const int lastSlot, Boid* destination, NeighborStats* stats)
+    {
+        StepBoids(StaticKernelConfig<Rules, Neighbors, Boundary>(), gameState, grid, firstSlot, lastSlot, destination,
+            stats);
+    }
+
+    void StepBoidsGeneric(const GameState* gameState, const SpatialGrid* grid, const int firstSlot, const int lastSlot,
+        Boid* destination, NeighborStats* stats)
+    {
+        const SimParams& params = gameState->params;
+
+        RuntimeKernelConfig config = {};
+        config.align = (params.rules & SIM_RULE_ALIGN) != 0;
+        config.cohere = (params.rules & SIM_RULE_COHERE) != 0;
+        config.separate = (params.rules & SIM_RULE_SEPARATE) != 0;
+        config.neighborMode = params.neighborMode;
+        config.boundaryMode = params.boundaryMode;
+
+        StepBoids(config, gameState, grid, firstSlot, lastSlot, destination, stats);
+    }
+
+    // One instantiation per combination of rules, neighbour mode and boundary mode, indexed by
+    // rules + (SIM_RULE_ALL + 1) * (neighborMode + NEIGHBOR_MODE_COUNT * boundaryMode).
+    constexpr int numRuleCombinations = SIM_RULE_ALL + 1;
+    constexpr int numKernels = numRuleCombinations * NEIGHBOR_MODE_COUNT * BOUNDARY_MODE_COUNT;
+
+    template <int Index>
+    constexpr StepBoidsKernel* GetSpecializedKernel()
+    {
+        constexpr uint32_t rules = Index % numRuleCombinations;
+        constexpr NeighborMode neighbors = (NeighborMode)((Index / numRuleCombinations) % NEIGHBOR_MODE_COUNT);
+        constexpr BoundaryMode boundary = (BoundaryMode)(Index / (numRuleCombinations * NEIGHBOR_MODE_COUNT));
+
+        return StepBoidsSpecialized<rules, neighbors, boundary>;
+    }
+
+    template <int... Indices>
+    constexpr std::array<StepBoidsKernel*, sizeof...(Indices)> MakeKernelTable(std::integer_sequence<int, Indices...>)
+    {
+        return { GetSpecializedKernel<Indices>()... };
+    }
+
+    constexpr std::array<StepBoidsKernel*, numKernels> specializedKernels =
+        MakeKernelTable(std::make_integer_sequence<int, numKernels>());
+
+    StepBoidsKernel* SelectKernel(const SimParams& params)
+    {
+        const int index = (int)(params.rules & SIM_RULE_ALL) +
+            numRuleCombinations * ((int)params.neighborMode + NEIGHBOR_MODE_COUNT * (int)params.boundaryMode);
+
+        return specializedKernels[index];
     }
 
     void PrintBoid(const Boid* boid)
@@ -102,10 +475,14 @@ namespace
     }
 }
 
-Vector3 Boid::Align(const GameState* gameState) const
+Vector3 Boid::Align(const GameState* gameState, int* numNeighbors) const
 {
+    PROFILE_ZONE("Align");
+
     const Boid* boids = gameState->boids;
     const int numBoids = gameState->numBoids;
+    const float alignRadiusSquared = gameState->params.alignRadiusSquared;
+    const float maxForce = gameState->params.maxForce;
 
     Vector3 steeringForce = {};
 
@@ -115,16 +492,20 @@ Vector3 Boid::Align(const GameState* gameState) const
     {
         const Boid boid = boids[i];
 
-        const float distance = Vector3Distance(position, boid.position);
-        const bool isOtherPosSameAsMe = (position == boid.position);
+        const float distanceSquared = Vector3DistanceSqr(position, boid.position);
 
-        if (!isOtherPosSameAsMe && distance < viewRadius)
+        if (&boids[i] != this && distanceSquared < alignRadiusSquared)
         {
             steeringForce += boid.velocity; // Sum up velocities of all nearby boids
             numNearbyBoids++;
         }
     }
 
+    if (numNeighbors)
+    {
+        *numNeighbors = numNearbyBoids;
+    }
+
     if (numNearbyBoids > 0)
     {
         steeringForce /= (float)numNearbyBoids; // Average the force
@@ -137,8 +518,12 @@ Vector3 Boid::Align(const GameState* gameState) const
 
 Vector3 Boid::Cohere(const GameState* gameState) const
 {
+    PROFILE_ZONE("Cohere");
+
     const Boid* boids = gameState->boids;
     const int numBoids = gameState->numBoids;
+    const float cohereRadiusSquared = gameState->params.cohereRadiusSquared;
+    const float maxForce = gameState->params.maxForce;
 
     Vector3 steeringForce = {};
 
@@ -148,10 +533,9 @@ Vector3 Boid::Cohere(const GameState* gameState) const
     {
         const Boid boid = boids[i];
 
-        const float distance = Vector3Distance(position, boid.position);
-        const bool isOtherPosSameAsMe = (position == boid.position);
+        const float distanceSquared = Vector3DistanceSqr(position, boid.position);
 
-        if (!isOtherPosSameAsMe && distance < viewRadius)
+        if (&boids[i] != this && distanceSquared < cohereRadiusSquared)
         {
             steeringForce += boid.position; // Sum up the position of all nearby boids
             numNearbyBoids++;
@@ -170,10 +554,12 @@ Vector3 Boid::Cohere(const GameState* gameState) const
 
 Vector3 Boid::Separate(const GameState* gameState) const
 {
+    PROFILE_ZONE("Separate");
+
     const Boid* boids = gameState->boids;
     const int numBoids = gameState->numBoids;
-
-    constexpr float separationDistance = 20.0f;
+    const float separationDistanceSquared = gameState->params.separationDistanceSquared;
+    const float maxForce = gameState->params.maxForce;
 
     Vector3 steeringForce = {};
     int numNearbyBoids = 0;
@@ -182,15 +568,14 @@ Vector3 Boid::Separate(const GameState* gameState) const
     {
         const Boid boid = boids[i];
 
-        const float distance = Vector3Distance(position, boid.position);
-        const bool isOtherPosSameAsMe = (position == boid.position);
+        const float distanceSquared = Vector3DistanceSqr(position, boid.position);
 
-        if (!isOtherPosSameAsMe && distance < separationDistance)
+        if (&boids[i] != this && distanceSquared < separationDistanceSquared)
         {
             numNearbyBoids++;
-            // Divide by distance so closer boids have a higher impact on separation force
-            Vector3 diff = (position - boid.position) / distance;
-            steeringForce += diff;
+            // Divide by distance so closer boids have a higher impact on separation force. The square root is only
+            // taken for boids that are actually in range.
+            steeringForce += GetSeparationDirection(position, boid.position, distanceSquared, &boids[i] < this);
         }
     }
 
@@ -203,39 +588,558 @@ Vector3 Boid::Separate(const GameState* gameState) const
     return steeringForce;
 }
 
-void DrawBoids(const GameState* gameState)
+Vector3 Boid::SteerFromBoundary(const GameState* gameState) const
 {
-    const Boid* boids = gameState->boids;
-    const int numBoids = gameState->numBoids;
+    const SimParams& params = gameState->params;
+    const float worldLimit = gameState->worldSize;
+    const float maxForce = params.maxForce;
+    const float inverseThreshold = params.inverseBoundaryThreshold;
+    const float limit = worldLimit - params.boundaryThreshold;
+
+    Vector3 steeringForce = {};
+
+    if (position.x > limit)
+    {
+        steeringForce.x = -maxForce * (1.0f - (worldLimit - position.x) * inverseThreshold);
+    }
+    else if (position.x < -limit)
+    {
+        steeringForce.x = maxForce * (1.0f - (worldLimit + position.x) * inverseThreshold);
+    }
+
+    if (position.y > limit)
+    {
+        steeringForce.y = -maxForce * (1.0f - (worldLimit - position.y) * inverseThreshold);
+    }
+    else if (position.y < -limit)
+    {
+        steeringForce.y = maxForce * (1.0f - (worldLimit + position.y) * inverseThreshold);
+    }
+
+    if (position.z > limit)
+    {
+        steeringForce.z = -maxForce * (1.0f - (worldLimit - position.z) * inverseThreshold);
+    }
+    else if (position.z < -limit)
+    {
+        steeringForce.z = maxForce * (1.0f - (worldLimit + position.z) * inverseThreshold);
+    }
+
+    return steeringForce;
+}
+
+void ComputeBoundaryForces(const Boid* boids, const int numBoids, const float worldLimit, const SimParams* params,
+    Vector3* forces)
+{
+    PROFILE_ZONE("ComputeBoundaryForces");
+
+    const float maxForce = params->maxForce;
+    const float inverseThreshold = params->inverseBoundaryThreshold;
+    const float limit = worldLimit - params->boundaryThreshold;
+
+    // Each component of the force only depends on the same component of the position, so a block of boids is turned
+    // into one flat run of position components, on the stack, and then into forces in place. Both candidate forces are
+    // always computed and the result picked with selects, with the same arithmetic as Boid::SteerFromBoundary, so the
+    // run has no branches, and being a fixed length it vectorizes even at /O2 and -O2. The forces of a block are next
+    // to each other in `forces`, so they are written out in one go.
+    constexpr int boidsPerBlock = 8;
+    constexpr int componentsPerBlock = boidsPerBlock * 3;
+    float components[componentsPerBlock] = {}; // A short last block leaves the end of it unused.
+
+    for (int first = 0; first < numBoids; first += boidsPerBlock)
+    {
+        const int count = (numBoids - first < boidsPerBlock) ? numBoids - first : boidsPerBlock;
+        for (int b = 0; b < count; b++)
+        {
+            const Vector3 position = boids[first + b].position;
+            components[b * 3] = position.x;
+            components[b * 3 + 1] = position.y;
+            components[b * 3 + 2] = position.z;
+        }
+
+        for (int c = 0; c < componentsPerBlock; c++)
+        {
+            const float p = components[c];
+            const float nearHighWall = -maxForce * (1.0f - (worldLimit - p) * inverseThreshold);
+            const float nearLowWall = maxForce * (1.0f - (worldLimit + p) * inverseThreshold);
+
+            // All ones where the boid is in that wall's band, zero elsewhere. A boid in neither gets the bits of +0.0f.
+            const uint32_t inHighBand = 0u - (uint32_t)(p > limit);
+            const uint32_t inLowBand = ~inHighBand & (0u - (uint32_t)(p < -limit));
+
+            components[c] = std::bit_cast<float>((std::bit_cast<uint32_t>(nearHighWall) & inHighBand) |
+                (std::bit_cast<uint32_t>(nearLowWall) & inLowBand));
+        }
+
+        std::memcpy(forces + first, components, sizeof(Vector3) * count);
+    }
+}
+
+void BuildBoidVertices(const Boid* boids, const int numBoids, const float scale, float* vertices)
+{
+    constexpr int indices[boidVertexCount] = {
+        2,1,0,
+        1,3,0,
+        4,3,1,
+        2,4,1,
+        0,4,2,
+        0,3,4,
+    };
+
+    constexpr int numVerts = 5;
+    constexpr float verts[numVerts * 3] = {
+        0.0f,  0.0f,  0.0f, // 0
+        0.0f,  0.0f, -1.0f, // 1
+        0.8f,  0.3f,  0.4f, // 2
+        -0.8f,  0.3f,  0.4f, // 3
+        0.0f, -0.1f,  0.0f, // 4
+    };
 
     for (int i = 0; i < numBoids; i++)
     {
-        const Boid boid = boids[i];
+        const Boid& boid = boids[i];
 
-        DrawBoid(boid, DARKBLUE, 3);
+        // Turn the model about the Y axis to face along the velocity. This is a rotation by
+        // -atan2(velocity.x, -velocity.z), worked out from the velocity directly instead of going through the angle.
+        const float horizontalSpeed = std::sqrt(boid.velocity.x * boid.velocity.x + boid.velocity.z * boid.velocity.z);
+        float cosAngle = 1.0f;
+        float sinAngle = 0.0f;
+        if (horizontalSpeed > 0.0f)
+        {
+            cosAngle = -boid.velocity.z / horizontalSpeed;
+            sinAngle = -boid.velocity.x / horizontalSpeed;
+        }
+
+        float* out = vertices + i * boidVertexCount * 3;
+        for (int v = 0; v < boidVertexCount; v++)
+        {
+            const float* vert = &verts[indices[v] * 3];
+            const float x = vert[0] * scale;
+            const float y = vert[1] * scale;
+            const float z = vert[2] * scale;
+
+            out[v * 3 + 0] = boid.position.x + cosAngle * x + sinAngle * z;
+            out[v * 3 + 1] = boid.position.y + y;
+            out[v * 3 + 2] = boid.position.z - sinAngle * x + cosAngle * z;
+        }
     }
 }
 
+namespace
+{
+    constexpr float boidScale = 3.0f;
+
+    // Bulk passes over the flock are handed to the job system in tasks of this many boids.
+    constexpr int boidsPerTask = 4096;
+    constexpr int boidsPerRenderPrepTask = 1024;
+
+    // The steering pass is split more finely, into runs of this many sorted slots. Being short, a clump where every
+    // boid has hundreds of neighbours still splits into plenty of tasks for idle threads to steal, and being runs of
+    // the sorted flock, each task stays within a few cells.
+    constexpr int boidsPerSteeringTask = 128;
+
+    // The threads' shares of the steering pass move a window of ticks at a time, by at most a quarter of an even share
+    // per window, and never shrink below a quarter of one.
+    constexpr int steerBalanceWindow = 16;
+    constexpr double steerShareMinWidth = 0.25;
+    constexpr double steerShareMaxShift = 0.25;
+
+    int GetNumTasks(const int numBoids, const int boidsPerTask)
+    {
+        return (numBoids + boidsPerTask - 1) / boidsPerTask;
+    }
+
+    // The boids [first, last) of task `taskIndex`.
+    void GetTaskBoids(const int taskIndex, const int boidsPerTask, const int numBoids, int* first, int* last)
+    {
+        *first = taskIndex * boidsPerTask;
+        *last = (numBoids - *first < boidsPerTask) ? numBoids : *first + boidsPerTask;
+    }
+
+    // Zeroes one steering task's share of every per-boid array, and the same fraction of the cell table.
+    void RunFirstTouchTask(void* data, const int taskIndex, const int)
+    {
+        const GameState* gameState = (const GameState*)data;
+        const SpatialGrid* grid = &gameState->grid;
+        const int maxBoids = gameState->maxBoids;
+
+        int first = 0;
+        int last = 0;
+        GetTaskBoids(taskIndex, boidsPerSteeringTask, maxBoids, &first, &last);
+        const int count = last - first;
+
+        std::fill_n(gameState->boids + first, count, Boid{});
+        std::fill_n(gameState->nextBoids + first, count, Boid{});
+        std::fill_n(grid->sortedBoids + first, count, Boid{});
+        std::fill_n(grid->boundaryForces + first, count, Vector3{});
+        std::fill_n(grid->sortedIndices + first, count, 0);
+        std::fill_n(grid->previousSortedIndices + first, count, 0);
+        std::fill_n(grid->boidCells + first, count, 0);
+
+        if (gameState->renderVertices)
+        {
+            std::fill_n(gameState->renderVertices + (size_t)first * boidVertexCount * 3,
+                (size_t)count * boidVertexCount * 3, 0.0f);
+        }
+
+        const int numTasks = GetNumTasks(maxBoids, boidsPerSteeringTask);
+        const int64_t cellTableSize = (int64_t)grid->maxCells + 1;
+        const int64_t firstCell = cellTableSize * taskIndex / numTasks;
+        const int64_t lastCell = cellTableSize * (taskIndex + 1) / numTasks;
+        std::fill_n(grid->cellStart + firstCell, lastCell - firstCell, 0);
+        std::fill_n(grid->previousCellStart + firstCell, lastCell - firstCell, 0);
+
+        const int64_t firstMover = (int64_t)grid->maxMovers * taskIndex / numTasks;
+        const int64_t lastMover = (int64_t)grid->maxMovers * (taskIndex + 1) / numTasks;
+        std::fill_n(grid->moverKeys + firstMover, lastMover - firstMover, 0);
+        std::fill_n(grid->moverFromKeys + firstMover, lastMover - firstMover, 0);
+    }
+
+    void RunRenderPrepTask(void* data, const int taskIndex, const int)
+    {
+        const GameState* gameState = (const GameState*)data;
+
+        int first = 0;
+        int last = 0;
+        GetTaskBoids(taskIndex, boidsPerRenderPrepTask, gameState->numRenderBoids, &first, &last);
+
+        BuildBoidVertices(gameState->boids + first, last - first, boidScale,
+            gameState->renderVertices + (size_t)first * boidVertexCount * 3);
+    }
+
+    void RunGridCellsTask(void* data, const int taskIndex, const int)
+    {
+        BoidsTick* tick = (BoidsTick*)data;
+        GameState* gameState = tick->gameState;
+
+        int first = 0;
+        int last = 0;
+        GetTaskBoids(taskIndex, boidsPerTask, gameState->numBoids, &first, &last);
+
+        FindSpatialGridCells(&gameState->grid, gameState->boids, first, last);
+    }
+
+    void RunGridSortTask(void* data, const int, const int)
+    {
+        BoidsTick* tick = (BoidsTick*)data;
+        SpatialGrid* grid = &tick->gameState->grid;
+        SortSpatialGrid(grid, tick->gameState->boids);
+
+        // Cells are numbered z-major, so the cells of a range of z are one run of sorted slots.
+        if (tick->inSlab)
+        {
+            const int cellsPerLayer = grid->cellsPerAxis * grid->cellsPerAxis;
+            tick->firstSteerSlot = grid->cellStart[GetGridCellCoordinate(grid, tick->slabMinZ) * cellsPerLayer];
+            tick->lastSteerSlot = grid->cellStart[(GetGridCellCoordinate(grid, tick->slabMaxZ) + 1) * cellsPerLayer];
+        }
+    }
+
+    void RunGridMergeTask(void* data, const int taskIndex, const int)
+    {
+        BoidsTick* tick = (BoidsTick*)data;
+        GameState* gameState = tick->gameState;
+
+        int firstSlot = 0;
+        int lastSlot = 0;
+        GetTaskBoids(taskIndex, boidsPerTask, gameState->numBoids, &firstSlot, &lastSlot);
+
+        MergeSpatialGridCells(&gameState->grid, gameState->boids, firstSlot, lastSlot);
+    }
+
+    void RunBoundaryForcesTask(void* data, const int taskIndex, const int)
+    {
+        BoidsTick* tick = (BoidsTick*)data;
+        const GameState* gameState = tick->gameState;
+        const SpatialGrid* grid = &gameState->grid;
+
+        int first = 0;
+        int last = 0;
+        GetTaskBoids(taskIndex, boidsPerTask, grid->numBoids, &first, &last);
+
+        ComputeBoundaryForces(grid->sortedBoids + first, last - first, gameState->worldSize, &gameState->params,
+            grid->boundaryForces + first);
+    }
+
+    void RunSteeringTask(void* data, const int taskIndex, const int threadIndex)
+    {
+        BoidsTick* tick = (BoidsTick*)data;
+        const SpatialGrid* grid = &tick->gameState->grid;
+
+        int firstSlot = 0;
+        int lastSlot = 0;
+        GetTaskBoids(taskIndex, boidsPerSteeringTask, tick->lastSteerSlot - tick->firstSteerSlot, &firstSlot,
+            &lastSlot);
+        firstSlot += tick->firstSteerSlot;
+        lastSlot += tick->firstSteerSlot;
+
+        if (firstSlot >= lastSlot)
+        {
+            return;
+        }
+
+        tick->kernel(tick->gameState, grid, firstSlot, lastSlot, tick->destination,
+            &tick->threadStats[threadIndex].stats);
+    }
+
+    void RunHashTask(void* data, const int, const int)
+    {
+        BoidsTick* tick = (BoidsTick*)data;
+        tick->stateHash = HashBoids(tick->destination, tick->gameState->numBoids);
+    }
+
+    bool AddUpdateBoidsNodesWithKernel(TaskGraph* graph, GameState* gameState, StepBoidsKernel* kernel,
+        BoidsTick* tick)
+    {
+        const int numBoids = gameState->numBoids;
+        const float cellSize = GetGridCellSize(&gameState->params, gameState->worldSize);
+
+        if (!BeginSpatialGrid(&gameState->grid, numBoids, gameState->worldSize, cellSize))
+        {
+            std::puts("ERROR: The spatial grid has no room for the flock.");
+            return false;
+        }
+
+        tick->gameState = gameState;
+        tick->kernel = kernel;
+        // The grid holds a snapshot of the flock, so the boids can be written in place. Deterministic mode writes to
+        // the second buffer only to keep the previous tick around for the hash and the swap.
+        tick->destination = gameState->deterministic ? gameState->nextBoids : gameState->boids;
+        tick->stateHash = 0;
+        tick->inSlab = false;
+        tick->firstSteerSlot = 0;
+        tick->lastSteerSlot = numBoids;
+
+        for (ThreadNeighborStats& threadStats : tick->threadStats)
+        {
+            threadStats.stats = {};
+        }
+
+        const int gridCells = AddTaskGraphNode(graph, "GridCells", RunGridCellsTask, tick,
+            GetNumTasks(numBoids, boidsPerTask), METRIC_GRID_CYCLES);
+        const int gridSort = AddTaskGraphNode(graph, "GridSort", RunGridSortTask, tick, 1, METRIC_GRID_CYCLES);
+        AddTaskGraphDependency(graph, gridSort, gridCells);
+        // Whether there is anything to merge is only known once the grid is sorted; after a rebuild the tasks return
+        // straight away.
+        const int gridMerge = AddTaskGraphNode(graph, "GridMerge", RunGridMergeTask, tick,
+            GetNumTasks(numBoids, boidsPerTask), METRIC_GRID_CYCLES);
+        AddTaskGraphDependency(graph, gridMerge, gridSort);
+
+        int boundaryForces = -1;
+        if (gameState->params.boundaryMode == BOUNDARY_MODE_STEER)
+        {
+            boundaryForces = AddTaskGraphNode(graph, "BoundaryForces", RunBoundaryForcesTask, tick,
+                GetNumTasks(numBoids, boidsPerTask));
+            AddTaskGraphDependency(graph, boundaryForces, gridMerge);
+        }
+
+        // Integration is part of the steering kernel, since each boid moves as soon as its steering is known.
+        const int steer = AddTaskGraphNode(graph, "Steer", RunSteeringTask, tick,
+            GetNumTasks(numBoids, boidsPerSteeringTask), METRIC_STEER_CYCLES);
+        AddTaskGraphDependency(graph, steer, gridMerge);
+        AddTaskGraphDependency(graph, steer, boundaryForces);
+
+        // Where the boids bunch up, steering a slot costs more, so each thread starts with an equally expensive run of
+        // slots rather than an equally long one, and has less to steal from the others.
+        tick->steerShares = {};
+        if (gameState->jobs)
+        {
+            const int numThreads = GetJobThreadCount(gameState->jobs);
+            LoadBalancer* balancer = &gameState->steerBalancer;
+
+            if (balancer->numParts != numThreads)
+            {
+                ResetLoadBalancer(balancer, numThreads, 0.0, 1.0, steerShareMinWidth / numThreads,
+                    steerShareMaxShift / numThreads, steerBalanceWindow);
+            }
+
+            tick->steerShares.numThreads = numThreads;
+            tick->steerShares.cuts = balancer->cuts;
+            SetTaskGraphNodeShares(graph, steer, &tick->steerShares);
+        }
+
+        int last = steer;
+        if (gameState->deterministic)
+        {
+            last = AddTaskGraphNode(graph, "Hash", RunHashTask, tick, 1, METRIC_HASH_CYCLES);
+            AddTaskGraphDependency(graph, last, steer);
+        }
+
+        tick->firstNode = gridCells;
+        tick->gridMergeNode = gridMerge;
+        tick->steerNode = steer;
+        tick->lastNode = last;
+
+        return true;
+    }
+
+    void UpdateBoidsWithKernel(GameState* gameState, StepBoidsKernel* kernel, const bool inSlab = false,
+        const float slabMinZ = 0.0f, const float slabMaxZ = 0.0f)
+    {
+        PROFILE_ZONE("UpdateBoids");
+
+        TaskGraph graph;
+        ResetTaskGraph(&graph);
+
+        BoidsTick tick;
+        if (AddUpdateBoidsNodesWithKernel(&graph, gameState, kernel, &tick))
+        {
+            tick.inSlab = inSlab;
+            tick.slabMinZ = slabMinZ;
+            tick.slabMaxZ = slabMaxZ;
+
+            RunTaskGraph(&graph, gameState->jobs);
+            FinishUpdateBoids(&graph, &tick);
+        }
+    }
+}
+
+void FirstTouchBoids(GameState* gameState)
+{
+    PROFILE_ZONE("FirstTouchBoids");
+
+    if (gameState->jobs)
+    {
+        RunJobs(gameState->jobs, RunFirstTouchTask, gameState, GetNumTasks(gameState->maxBoids, boidsPerSteeringTask));
+    }
+}
+
+int AddRenderPrepNode(TaskGraph* graph, GameState* gameState)
+{
+    gameState->numRenderBoids = gameState->renderVertices ? gameState->numBoids : 0;
+
+    return AddTaskGraphNode(graph, "RenderPrep", RunRenderPrepTask, gameState,
+        GetNumTasks(gameState->numRenderBoids, boidsPerRenderPrepTask));
+}
+
+void DrawBoids(const GameState* gameState)
+{
+    PROFILE_ZONE("DrawBoids");
+
+    // rlgl's vertex buffer takes a limited number of vertices between flushes, so they go in batches.
+    constexpr int boidsPerBatch = 256;
+    constexpr Color color = DARKBLUE;
+
+    const float* vertices = gameState->renderVertices;
+    const int numBoids = gameState->numRenderBoids;
+
+    rlColor4ub(color.r, color.g, color.b, color.a);
+
+    for (int first = 0; first < numBoids; first += boidsPerBatch)
+    {
+        const int count = (numBoids - first < boidsPerBatch) ? numBoids - first : boidsPerBatch;
+        const float* batch = vertices + (size_t)first * boidVertexCount * 3;
+
+        rlBegin(RL_TRIANGLES);
+        for (int v = 0; v < count * boidVertexCount; v++)
+        {
+            rlVertex3f(batch[v * 3], batch[v * 3 + 1], batch[v * 3 + 2]);
+        }
+        rlEnd();
+    }
+}
+
+float GetGridCellSize(const SimParams* params, const float worldLimit)
+{
+    // Cells as wide as the largest radius of the enabled rules, so a boid's neighbours are all in the cells around it.
+    // Topological neighbours can be anywhere, so that mode uses one cell for the whole world.
+    const float worldSize = 2.0f * worldLimit;
+    const bool metric = params->neighborMode == NEIGHBOR_MODE_METRIC;
+    const float radii[3] =
+    {
+        (params->rules & SIM_RULE_ALIGN) ? (metric ? params->alignRadius : worldSize) : 0.0f,
+        (params->rules & SIM_RULE_COHERE) ? (metric ? params->cohereRadius : worldSize) : 0.0f,
+        (params->rules & SIM_RULE_SEPARATE) ? params->separationDistance : 0.0f,
+    };
+
+    float cellSize = 0.0f;
+    for (const float radius : radii)
+    {
+        cellSize = (radius > cellSize) ? radius : cellSize;
+    }
+
+    return (cellSize > 0.0f) ? cellSize : worldSize;
+}
+
 void UpdateBoids(GameState* gameState)
 {
-    constexpr float maxSpeed = 5.0f;
+    UpdateBoidsWithKernel(gameState, SelectKernel(gameState->params));
+}
+
+void UpdateBoidsInSlab(GameState* gameState, const float minZ, const float maxZ)
+{
+    UpdateBoidsWithKernel(gameState, SelectKernel(gameState->params), true, minZ, maxZ);
+}
+
+void UpdateBoidsGeneric(GameState* gameState)
+{
+    UpdateBoidsWithKernel(gameState, StepBoidsGeneric);
+}
 
-    Boid* boids = gameState->boids;
+bool AddUpdateBoidsNodes(TaskGraph* graph, GameState* gameState, BoidsTick* tick)
+{
+    return AddUpdateBoidsNodesWithKernel(graph, gameState, SelectKernel(gameState->params), tick);
+}
+
+void FinishUpdateBoids(const TaskGraph* graph, BoidsTick* tick)
+{
+    GameState* gameState = tick->gameState;
     const int numBoids = gameState->numBoids;
-    const float worldSize = gameState->worldSize;
 
-    for (int i = 0; i < numBoids; i++)
+    if (gameState->deterministic)
     {
-        Boid& boid = boids[i];
+        gameState->nextBoids = gameState->boids;
+        gameState->boids = tick->destination;
+        gameState->stateHash = tick->stateHash;
+    }
+
+    NeighborStats stats = {};
+    for (const ThreadNeighborStats& threadStats : tick->threadStats)
+    {
+        stats.total += threadStats.stats.total;
+        stats.max = (threadStats.stats.max > stats.max) ? threadStats.stats.max : stats.max;
+    }
 
-        // Apply alignment, cohesion and separation.
-        Vector3 acceleration = boid.Align(gameState) + boid.Cohere(gameState) + boid.Separate(gameState);
+    // A tick where some thread never got to its share says nothing about what that share costs.
+    const JobShares* shares = &tick->steerShares;
+    bool measured = shares->used;
+    for (int t = 0; measured && t < shares->numThreads; t++)
+    {
+        measured = shares->costs[t] >= 0.0;
+    }
 
-        acceleration += TurnBoidIfCloseToBoundary(boid, worldSize);
+    if (measured && AddLoadSample(&gameState->steerBalancer, shares->costs))
+    {
+        RecordMetric(METRIC_LOAD_IMBALANCE, gameState->steerBalancer.imbalance);
+    }
 
-        // Update position
-        boid.velocity += acceleration;
-        boid.velocity = Vector3ClampValue(boid.velocity, 0, maxSpeed);
-        boid.position += boid.velocity;
+    RecordMetric(METRIC_SIM_TIME, GetTaskGraphSpanMilliseconds(graph, tick->firstNode, tick->lastNode));
+    RecordMetric(METRIC_GRID_TIME, GetTaskGraphSpanMilliseconds(graph, tick->firstNode, tick->gridMergeNode));
+    RecordMetric(METRIC_GRID_CELL_MAX, (double)gameState->grid.maxCellBoids);
+    if (gameState->grid.merging)
+    {
+        RecordMetric(METRIC_GRID_MOVERS, (double)gameState->grid.numMovers);
     }
+    RecordMetric(METRIC_NEIGHBORS_MEAN, (numBoids > 0) ? (double)stats.total / numBoids : 0.0);
+    RecordMetric(METRIC_NEIGHBORS_MAX, (double)stats.max);
+
+    gameState->tick++;
+}
+
+uint64_t HashBoids(const Boid* boids, const int numBoids)
+{
+    // 64-bit FNV-1a over the raw bytes of the flock. Any bit difference in any position or velocity changes the hash.
+    constexpr uint64_t fnvOffsetBasis = 14695981039346656037ull;
+    constexpr uint64_t fnvPrime = 1099511628211ull;
+
+    const uint8_t* bytes = (const uint8_t*)boids;
+    const size_t numBytes = sizeof(Boid) * numBoids;
+
+    uint64_t hash = fnvOffsetBasis;
+    for (size_t i = 0; i < numBytes; i++)
+    {
+        hash ^= bytes[i];
+        hash *= fnvPrime;
+    }
+
+    return hash;
 }
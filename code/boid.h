@@ -4,6 +4,8 @@
 #include "raymath.h"
 
 #include "game.h"
+#include "jobs.h"
+#include "taskgraph.h"
 
 class Boid
 {
@@ -11,10 +13,101 @@ public:
     Vector3 position;
     Vector3 velocity;
 
-    Vector3 Align(const GameState* gameState) const;
+    // Reference versions of the rules, brute force over the whole flock. The boid must be one of gameState->boids,
+    // since it recognises itself by address; any other boid, even one in the same spot, counts as a neighbour.
+    // Align also reports how many neighbours it found, which feeds the neighbour count metrics.
+    Vector3 Align(const GameState* gameState, int* numNeighbors = nullptr) const;
     Vector3 Cohere(const GameState* gameState) const;
     Vector3 Separate(const GameState* gameState) const;
+    // Turns the boid back when it is within boundaryThreshold of a wall, harder the closer it gets.
+    Vector3 SteerFromBoundary(const GameState* gameState) const;
 };
 
+// Boid::SteerFromBoundary for a whole array of boids at once, without branches. Gives bit-identical forces.
+void ComputeBoundaryForces(const Boid* boids, const int numBoids, const float worldLimit, const SimParams* params,
+    Vector3* forces);
+
+// Every boid is drawn as this many vertices, three per triangle.
+constexpr int boidVertexCount = 18;
+
+// The CPU side of drawing: writes the world-space triangle vertices (x, y, z) of each boid into `vertices`, which
+// must hold numBoids * boidVertexCount * 3 floats.
+void BuildBoidVertices(const Boid* boids, const int numBoids, const float scale, float* vertices);
+// Render prep as a task graph node: fills gameState->renderVertices from the flock as it is when the node runs. Any
+// node that writes to gameState->boids in the same graph has to depend on it.
+int AddRenderPrepNode(TaskGraph* graph, GameState* gameState);
+// Draws the vertices the last render prep built.
 void DrawBoids(const GameState* gameState);
+// The smallest grid cell UpdateBoids can use with these parameters: the reach of the widest enabled rule.
+float GetGridCellSize(const SimParams* params, const float worldLimit);
+
+struct NeighborStats
+{
+    int64_t total;
+    int max;
+};
+
+// Updates the boids in a range of the grid's sorted slots (see boid.cpp).
+typedef void StepBoidsKernel(const GameState* gameState, const SpatialGrid* grid, const int firstSlot,
+    const int lastSlot, Boid* destination, NeighborStats* stats);
+
+// Each thread adds its neighbour counts up separately, on its own cache line.
+struct alignas(64) ThreadNeighborStats
+{
+    NeighborStats stats;
+};
+
+// One tick as nodes of a task graph (see taskgraph.h), so that other work can share the threads with it. The stages are
+// finding each boid's grid cell, sorting the flock into the grid, filling the cells when the grid is updated rather
+// than rebuilt, wall avoidance, steering, which also moves the boids, and in deterministic mode hashing the new state.
+// AddUpdateBoidsNodes adds them, and once the graph has run, FinishUpdateBoids puts the new state in place and records
+// the tick's metrics. UpdateBoids does all of that.
+struct BoidsTick
+{
+    GameState* gameState;
+    StepBoidsKernel* kernel;
+    Boid* destination;
+    uint64_t stateHash;
+
+    // The tick's nodes are firstNode to lastNode, and the grid is ready once gridMergeNode has run. The steering node
+    // is the one that writes to gameState->boids, when not in deterministic mode.
+    int firstNode;
+    int gridMergeNode;
+    int steerNode;
+    int lastNode;
+
+    // The sorted slots the steering node updates, all of them unless the tick is limited to a slab (see
+    // UpdateBoidsInSlab). Worked out once the grid is sorted.
+    bool inSlab;
+    float slabMinZ;
+    float slabMaxZ;
+    int firstSteerSlot;
+    int lastSteerSlot;
+
+    // The threads' shares of the steering node, from gameState->steerBalancer.
+    JobShares steerShares;
+
+    ThreadNeighborStats threadStats[maxJobWorkers + 1];
+};
+
+// Returns false, and adds nothing, if the grid has no room for the flock.
+bool AddUpdateBoidsNodes(TaskGraph* graph, GameState* gameState, BoidsTick* tick);
+void FinishUpdateBoids(const TaskGraph* graph, BoidsTick* tick);
+
+// Zeroes the flock, the grid and the render vertices from gameState->jobs, split between the threads the same way the
+// steering pass is. Pages are placed on the NUMA node of the thread that touches them first, so run before anything
+// else writes to GameMemory, this gives each node the slab of the sorted flock, and of the cell table, that its own
+// threads steer. Cross-node reads are then limited to neighbours across the slab faces. Does nothing without jobs.
+void FirstTouchBoids(GameState* gameState);
+
+// Advances the flock one tick, using a steering kernel compiled for the enabled rules and the neighbour and boundary
+// modes in gameState->params. The stages run on gameState->jobs when it is set.
 void UpdateBoids(GameState* gameState);
+// UpdateBoids for only part of the flock: the boids in the grid cells that overlap [minZ, maxZ] along z, which includes
+// every boid with a z in that range. The rest of the flock is still seen by them as neighbours, but isn't moved, and
+// where it ends up in gameState->boids is unspecified.
+void UpdateBoidsInSlab(GameState* gameState, const float minZ, const float maxZ);
+// The same tick through a single kernel that checks the rules and modes as it runs. Only kept as the baseline the
+// specialized kernels are benchmarked against.
+void UpdateBoidsGeneric(GameState* gameState);
+uint64_t HashBoids(const Boid* boids, const int numBoids);
@@ -0,0 +1,1372 @@
+#include "domain.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+#include "gamememory.h"
+#include "metrics.h"
+#include "platform.h"
+#include "profiler.h"
+
+namespace
+{
+    constexpr size_t ringSize = 1 << 20;
+    constexpr int connectTimeoutMilliseconds = 30000;
+    constexpr uint32_t helloMagic = 0x4d4f4442; // "BDOM"
+
+    // Halos reach a little past the rules' radius, so that rounding in where a boid is measured from can't leave out
+    // a neighbour.
+    constexpr float haloMargin = 1.0e-3f;
+
+    // The faces between the slabs move once per window of this many ticks, by at most this much of the halo's reach.
+    constexpr int balanceWindow = 20;
+    constexpr float balanceShift = 0.5f;
+
+    enum DomainMessageKind : int32_t
+    {
+        DOMAIN_MESSAGE_MIGRANTS,
+        DOMAIN_MESSAGE_HALO,
+        DOMAIN_MESSAGE_GATHER, // Followed by the sender's DomainStats, then its boids.
+        DOMAIN_MESSAGE_CUTS // From domain 0, with the faces between the slabs as doubles instead of boids.
+    };
+
+    struct DomainMessage
+    {
+        uint64_t tick;
+        DomainMessageKind kind;
+        int32_t count;
+    };
+
+    enum DomainHelloKind : int32_t
+    {
+        DOMAIN_HELLO_LINK, // From the domain below, to be its up link and our down link.
+        DOMAIN_HELLO_GATHER
+    };
+
+    // The first thing sent on every socket, so that the one accepting it knows who is on the other end.
+    struct DomainHello
+    {
+        uint32_t magic;
+        int32_t numDomains;
+        int32_t rank;
+        DomainHelloKind kind;
+    };
+
+    // The start of the shared memory. The rings' bytes follow it, then the two copies of the flock that the domains
+    // publish into on alternate ticks.
+    struct alignas(64) DomainShared
+    {
+        std::atomic<int> failed;
+        std::atomic<int> barrierCount;
+        std::atomic<int> barrierGeneration;
+
+        DomainRing rings[maxDomains * DOMAIN_LINK_COUNT];
+        DomainStats stats[2][maxDomains]; // Written on alternate ticks, like the flock.
+    };
+
+    // One message on its way in or out of a channel.
+    struct DomainTransfer
+    {
+        DomainChannel* channel;
+        bool receiving;
+        uint8_t* bytes;
+        size_t size;
+        size_t done;
+        bool headerRead;
+        int count; // Records in the message, once known.
+    };
+
+    size_t AlignUp(const size_t value, const size_t alignment)
+    {
+        return (value + alignment - 1) & ~(alignment - 1);
+    }
+
+    size_t GetMessageHeaderSize(const DomainMessageKind kind)
+    {
+        return sizeof(DomainMessage) + ((kind == DOMAIN_MESSAGE_GATHER) ? sizeof(DomainStats) : 0);
+    }
+
+    size_t GetMessageSize(const DomainMessageKind kind, const int numRecords)
+    {
+        const size_t recordSize = (kind == DOMAIN_MESSAGE_CUTS) ? sizeof(double) : sizeof(DomainRecord);
+        return GetMessageHeaderSize(kind) + recordSize * numRecords;
+    }
+
+    DomainRecord* GetMessageRecords(uint8_t* bytes, const DomainMessageKind kind)
+    {
+        return (DomainRecord*)(bytes + GetMessageHeaderSize(kind));
+    }
+
+    DomainShared* GetShared(const DomainRun* run)
+    {
+        return (DomainShared*)run->shared;
+    }
+
+    uint8_t* GetRingBytes(const DomainRun* run, const int ring)
+    {
+        return (uint8_t*)run->shared + sizeof(DomainShared) + ring * ringSize;
+    }
+
+    Boid* GetPublishedBoids(const DomainRun* run, const uint64_t tick)
+    {
+        Boid* published = (Boid*)GetRingBytes(run, run->numDomains * DOMAIN_LINK_COUNT);
+        return published + (tick & 1) * run->interior->maxBoids;
+    }
+
+    int GetDomainOfPosition(const DomainRun* run, const float z)
+    {
+        return FindLoadPart(&run->balancer, z);
+    }
+
+    // How wide a slab has to stay, and how far a face can move in one window, so that a boid never crosses a whole
+    // slab in a tick, not even one whose faces have just moved, and a halo never reaches past the neighbour.
+    void GetSlabLimits(const GameState* gameState, float* minWidth, float* maxShift)
+    {
+        const float reach = GetGridCellSize(&gameState->params, gameState->worldSize) * (1.0f + haloMargin);
+        const float maxSpeed = gameState->params.maxSpeed;
+
+        *maxShift = balanceShift * reach;
+        *minWidth = (reach > maxSpeed + *maxShift) ? reach : maxSpeed + *maxShift;
+    }
+
+    bool HasFailed(const DomainRun* run)
+    {
+        return run->failed.load(std::memory_order_relaxed) ||
+            (run->shared && GetShared(run)->failed.load(std::memory_order_relaxed) != 0);
+    }
+
+    // Over sockets the others find out when this process closes its end.
+    void Fail(DomainRun* run)
+    {
+        run->failed.store(true, std::memory_order_relaxed);
+        if (run->shared)
+        {
+            GetShared(run)->failed.store(1, std::memory_order_relaxed);
+        }
+    }
+
+    bool WaitForDomains(const DomainRun* run)
+    {
+        DomainShared* shared = GetShared(run);
+        const int generation = shared->barrierGeneration.load(std::memory_order_acquire);
+
+        if (shared->barrierCount.fetch_add(1, std::memory_order_acq_rel) == run->numDomains - 1)
+        {
+            shared->barrierCount.store(0, std::memory_order_relaxed);
+            shared->barrierGeneration.store(generation + 1, std::memory_order_release);
+            return true;
+        }
+
+        while (shared->barrierGeneration.load(std::memory_order_acquire) == generation)
+        {
+            if (HasFailed(run))
+            {
+                return false;
+            }
+
+            std::this_thread::yield();
+        }
+
+        return true;
+    }
+
+    // Where domain `rank` listens, from the list of addresses.
+    bool GetDomainAddress(const char* addresses, const int rank, char* address, const size_t addressSize)
+    {
+        int numEntries = 1;
+        for (const char* c = addresses; *c; c++)
+        {
+            numEntries += (*c == ',') ? 1 : 0;
+        }
+
+        // One address per domain.
+        if (numEntries > 1)
+        {
+            const char* entry = addresses;
+            for (int i = 0; i < rank && entry; i++)
+            {
+                entry = std::strchr(entry, ',');
+                entry = entry ? entry + 1 : nullptr;
+            }
+
+            const char* end = entry ? std::strchr(entry, ',') : nullptr;
+            const size_t length = entry ? (end ? (size_t)(end - entry) : std::strlen(entry)) : 0;
+            if (length == 0 || length >= addressSize)
+            {
+                return false;
+            }
+
+            std::memcpy(address, entry, length);
+            address[length] = '\0';
+            return true;
+        }
+
+        // One address for all of them: Unix domain sockets get the domain after the path, TCP ports count up.
+        if (std::strncmp(addresses, "unix:", 5) == 0)
+        {
+            return std::snprintf(address, addressSize, "%s.%d", addresses, rank) < (int)addressSize;
+        }
+
+        const char* colon = std::strrchr(addresses, ':');
+        if (!colon)
+        {
+            return false;
+        }
+
+        const int port = std::atoi(colon + 1);
+        return std::snprintf(address, addressSize, "%.*s:%d", (int)(colon - addresses), addresses, port + rank) <
+            (int)addressSize;
+    }
+
+    // Moves as much of the transfer as the channel takes or has, without waiting. Returns false if the channel is
+    // broken.
+    bool MoveSome(DomainTransfer* transfer, size_t* moved)
+    {
+        DomainChannel* channel = transfer->channel;
+        uint8_t* bytes = transfer->bytes + transfer->done;
+        const size_t left = transfer->size - transfer->done;
+        *moved = 0;
+
+        if (channel->socket >= 0)
+        {
+            const int64_t count = transfer->receiving ?
+                PlatformReceiveSocket(channel->socket, bytes, left, false) :
+                PlatformSendSocket(channel->socket, bytes, left, false);
+            if (count < 0)
+            {
+                return false;
+            }
+
+            *moved = (size_t)count;
+        }
+        else if (transfer->receiving)
+        {
+            DomainRing* ring = channel->receiveRing;
+            const uint64_t written = ring->written.load(std::memory_order_acquire);
+            const uint64_t read = ring->read.load(std::memory_order_relaxed);
+
+            const size_t waiting = (size_t)(written - read);
+            const size_t size = (waiting < left) ? waiting : left;
+            const size_t offset = (size_t)(read % ringSize);
+            const size_t first = (size < ringSize - offset) ? size : ringSize - offset;
+            std::memcpy(bytes, channel->receiveRingBytes + offset, first);
+            std::memcpy(bytes + first, channel->receiveRingBytes, size - first);
+
+            ring->read.store(read + size, std::memory_order_release);
+            *moved = size;
+        }
+        else
+        {
+            DomainRing* ring = channel->sendRing;
+            const uint64_t written = ring->written.load(std::memory_order_relaxed);
+            const uint64_t read = ring->read.load(std::memory_order_acquire);
+
+            const size_t space = ringSize - (size_t)(written - read);
+            const size_t size = (space < left) ? space : left;
+            const size_t offset = (size_t)(written % ringSize);
+            const size_t first = (size < ringSize - offset) ? size : ringSize - offset;
+            std::memcpy(channel->sendRingBytes + offset, bytes, first);
+            std::memcpy(channel->sendRingBytes, bytes + first, size - first);
+
+            ring->written.store(written + size, std::memory_order_release);
+            *moved = size;
+        }
+
+        transfer->done += *moved;
+        return true;
+    }
+
+    // Runs the transfers until all of them are done. They all make progress together, so a message bigger than what
+    // its channel holds can't deadlock two domains that are sending to each other.
+    bool RunTransfers(DomainRun* run, DomainTransfer* transfers, const int numTransfers, const DomainMessageKind kind)
+    {
+        for (;;)
+        {
+            bool finished = true;
+            size_t moved = 0;
+
+            for (int i = 0; i < numTransfers; i++)
+            {
+                DomainTransfer* transfer = &transfers[i];
+                if (transfer->done == transfer->size)
+                {
+                    continue;
+                }
+
+                size_t count = 0;
+                if (!MoveSome(transfer, &count))
+                {
+                    std::printf("ERROR: Domain %d lost its connection to another domain.\n", run->rank);
+                    Fail(run);
+                    return false;
+                }
+
+                moved += count;
+                run->stats.bytesSent += transfer->receiving ? 0 : (int64_t)count;
+
+                if (transfer->receiving && !transfer->headerRead && transfer->done == sizeof(DomainMessage))
+                {
+                    DomainMessage message = {};
+                    std::memcpy(&message, transfer->bytes, sizeof(message));
+
+                    if (message.tick != run->tick || message.kind != kind || message.count < 0 ||
+                        message.count > run->interior->maxBoids)
+                    {
+                        std::printf("ERROR: Domain %d got a message out of step.\n", run->rank);
+                        Fail(run);
+                        return false;
+                    }
+
+                    transfer->size = GetMessageSize(kind, message.count);
+                    transfer->headerRead = true;
+                    transfer->count = message.count;
+                }
+
+                finished = finished && transfer->done == transfer->size;
+            }
+
+            if (finished)
+            {
+                return true;
+            }
+
+            if (moved == 0)
+            {
+                if (HasFailed(run))
+                {
+                    return false;
+                }
+
+                std::this_thread::yield();
+            }
+        }
+    }
+
+    DomainTransfer StartSend(DomainChannel* channel, uint8_t* bytes, const uint64_t tick,
+        const DomainMessageKind kind, const int count)
+    {
+        const DomainMessage message = { .tick = tick, .kind = kind, .count = count };
+        std::memcpy(bytes, &message, sizeof(message));
+
+        DomainTransfer transfer = {};
+        transfer.channel = channel;
+        transfer.bytes = bytes;
+        transfer.size = GetMessageSize(kind, count);
+        return transfer;
+    }
+
+    DomainTransfer StartReceive(DomainChannel* channel, uint8_t* bytes)
+    {
+        DomainTransfer transfer = {};
+        transfer.channel = channel;
+        transfer.receiving = true;
+        transfer.bytes = bytes;
+        transfer.size = sizeof(DomainMessage);
+        return transfer;
+    }
+
+    // Sends each neighbour the records already in sendBytes and receives theirs into receiveBytes.
+    bool ExchangeWithNeighbors(DomainRun* run, const DomainMessageKind kind, const int* numSent, int* numReceived)
+    {
+        DomainTransfer transfers[2 * DOMAIN_LINK_COUNT] = {};
+        int numTransfers = 0;
+
+        for (int link = 0; link < DOMAIN_LINK_COUNT; link++)
+        {
+            if (run->neighbors[link] >= 0)
+            {
+                transfers[numTransfers++] = StartSend(&run->links[link], run->sendBytes[link], run->tick, kind,
+                    numSent[link]);
+                transfers[numTransfers++] = StartReceive(&run->links[link], run->receiveBytes[link]);
+            }
+        }
+
+        if (!RunTransfers(run, transfers, numTransfers, kind))
+        {
+            return false;
+        }
+
+        int receive = 1;
+        for (int link = 0; link < DOMAIN_LINK_COUNT; link++)
+        {
+            numReceived[link] = 0;
+            if (run->neighbors[link] >= 0)
+            {
+                numReceived[link] = transfers[receive].count;
+                receive += 2;
+            }
+        }
+
+        return true;
+    }
+
+    // Merges lists of records sorted by id into mergedBoids, keeping the first copy of any id that is in more than
+    // one of them. Returns the number of records merged.
+    int MergeRecords(DomainRun* run, const DomainRecord* const* lists, const int* counts, const int numLists)
+    {
+        int heads[DOMAIN_LINK_COUNT + 1] = {};
+        int numMerged = 0;
+
+        for (;;)
+        {
+            int source = -1;
+            for (int list = 0; list < numLists; list++)
+            {
+                if (heads[list] < counts[list] &&
+                    (source < 0 || lists[list][heads[list]].id < lists[source][heads[source]].id))
+                {
+                    source = list;
+                }
+            }
+
+            if (source < 0)
+            {
+                return numMerged;
+            }
+
+            const int32_t id = lists[source][heads[source]].id;
+            run->mergedBoids[numMerged] = lists[source][heads[source]];
+            run->mergedSources[numMerged] = (uint8_t)source;
+            numMerged++;
+
+            for (int list = 0; list < numLists; list++)
+            {
+                if (heads[list] < counts[list] && lists[list][heads[list]].id == id)
+                {
+                    heads[list]++;
+                }
+            }
+        }
+    }
+
+    // Hands the boids that have left the slab to the neighbour they moved into, and takes in the ones that moved in.
+    bool ExchangeMigrants(DomainRun* run)
+    {
+        DomainRecord* sent[DOMAIN_LINK_COUNT] =
+        {
+            GetMessageRecords(run->sendBytes[DOMAIN_LINK_DOWN], DOMAIN_MESSAGE_MIGRANTS),
+            GetMessageRecords(run->sendBytes[DOMAIN_LINK_UP], DOMAIN_MESSAGE_MIGRANTS)
+        };
+        int numSent[DOMAIN_LINK_COUNT] = {};
+        int numKept = 0;
+
+        for (int i = 0; i < run->numOwnBoids; i++)
+        {
+            const DomainRecord record = run->ownBoids[i];
+            const int domain = GetDomainOfPosition(run, record.boid.position.z);
+
+            if (domain == run->rank)
+            {
+                run->ownBoids[numKept++] = record;
+            }
+            else if (domain == run->neighbors[DOMAIN_LINK_UP])
+            {
+                sent[DOMAIN_LINK_UP][numSent[DOMAIN_LINK_UP]++] = record;
+            }
+            else if (domain == run->neighbors[DOMAIN_LINK_DOWN])
+            {
+                sent[DOMAIN_LINK_DOWN][numSent[DOMAIN_LINK_DOWN]++] = record;
+            }
+            else
+            {
+                std::printf("ERROR: Boid %d moved from domain %d past its neighbours to domain %d in one tick.\n",
+                    record.id, run->rank, domain);
+                Fail(run);
+                return false;
+            }
+        }
+
+        int numReceived[DOMAIN_LINK_COUNT] = {};
+        if (!ExchangeWithNeighbors(run, DOMAIN_MESSAGE_MIGRANTS, numSent, numReceived))
+        {
+            return false;
+        }
+
+        const DomainRecord* lists[DOMAIN_LINK_COUNT + 1] =
+        {
+            run->ownBoids,
+            GetMessageRecords(run->receiveBytes[DOMAIN_LINK_DOWN], DOMAIN_MESSAGE_MIGRANTS),
+            GetMessageRecords(run->receiveBytes[DOMAIN_LINK_UP], DOMAIN_MESSAGE_MIGRANTS)
+        };
+        const int counts[DOMAIN_LINK_COUNT + 1] =
+        {
+            numKept, numReceived[DOMAIN_LINK_DOWN], numReceived[DOMAIN_LINK_UP]
+        };
+
+        run->numOwnBoids = MergeRecords(run, lists, counts, DOMAIN_LINK_COUNT + 1);
+        std::memcpy(run->ownBoids, run->mergedBoids, sizeof(DomainRecord) * run->numOwnBoids);
+
+        run->stats.migrants += numSent[DOMAIN_LINK_DOWN] + numSent[DOMAIN_LINK_UP];
+        return true;
+    }
+
+    // How far a boid is from the nearest face with a neighbour on the other side.
+    float GetDistanceToLinkedFace(const DomainRun* run, const float z)
+    {
+        const float width = run->maxZ - run->minZ;
+        const float down = (run->neighbors[DOMAIN_LINK_DOWN] >= 0) ? z - run->minZ : width;
+        const float up = (run->neighbors[DOMAIN_LINK_UP] >= 0) ? run->maxZ - z : width;
+        return (down < up) ? down : up;
+    }
+
+    // Puts each neighbour's halo in sendBytes, and picks out the band of own boids the edge step needs: everything
+    // within reach of a boid that is within reach of a face.
+    void PrepareHalos(DomainRun* run)
+    {
+        DomainRecord* sent[DOMAIN_LINK_COUNT] =
+        {
+            GetMessageRecords(run->sendBytes[DOMAIN_LINK_DOWN], DOMAIN_MESSAGE_HALO),
+            GetMessageRecords(run->sendBytes[DOMAIN_LINK_UP], DOMAIN_MESSAGE_HALO)
+        };
+
+        run->numHaloSent[DOMAIN_LINK_DOWN] = 0;
+        run->numHaloSent[DOMAIN_LINK_UP] = 0;
+        run->numBandBoids = 0;
+
+        for (int i = 0; i < run->numOwnBoids; i++)
+        {
+            const DomainRecord record = run->ownBoids[i];
+            const float z = record.boid.position.z;
+
+            if (run->neighbors[DOMAIN_LINK_DOWN] >= 0 && z - run->minZ < run->reach)
+            {
+                sent[DOMAIN_LINK_DOWN][run->numHaloSent[DOMAIN_LINK_DOWN]++] = record;
+            }
+
+            if (run->neighbors[DOMAIN_LINK_UP] >= 0 && run->maxZ - z < run->reach)
+            {
+                sent[DOMAIN_LINK_UP][run->numHaloSent[DOMAIN_LINK_UP]++] = record;
+            }
+
+            if (GetDistanceToLinkedFace(run, z) < 2.0f * run->reach)
+            {
+                run->bandBoids[run->numBandBoids++] = record;
+            }
+        }
+
+        run->stats.haloBoids += run->numHaloSent[DOMAIN_LINK_DOWN] + run->numHaloSent[DOMAIN_LINK_UP];
+    }
+
+    void RunCommThread(DomainRun* run)
+    {
+        for (;;)
+        {
+            {
+                std::unique_lock<std::mutex> lock(run->mutex);
+                run->exchangeStarted.wait(lock, [run] { return run->exchangeRequested || run->stopping; });
+                if (run->stopping)
+                {
+                    return;
+                }
+            }
+
+            const bool succeeded = ExchangeWithNeighbors(run, DOMAIN_MESSAGE_HALO, run->numHaloSent,
+                run->numHaloReceived);
+
+            {
+                std::lock_guard<std::mutex> lock(run->mutex);
+                run->exchangeRequested = false;
+                run->exchangeSucceeded = succeeded;
+            }
+            run->exchangeFinished.notify_one();
+        }
+    }
+
+    void StartHaloExchange(DomainRun* run)
+    {
+        {
+            std::lock_guard<std::mutex> lock(run->mutex);
+            run->exchangeRequested = true;
+        }
+        run->exchangeStarted.notify_one();
+    }
+
+    bool FinishHaloExchange(DomainRun* run)
+    {
+        std::unique_lock<std::mutex> lock(run->mutex);
+        run->exchangeFinished.wait(lock, [run] { return !run->exchangeRequested; });
+        return run->exchangeSucceeded;
+    }
+
+    // Steers the boids that can't see past a linked face, in a flock of only this domain's boids. The boids near the
+    // faces are steered too where they share cells with the rest, but without their halo that result is thrown away.
+    void SteerInterior(DomainRun* run)
+    {
+        GameState* interior = run->interior;
+        interior->numBoids = run->numOwnBoids;
+        interior->tick = run->tick;
+
+        for (int i = 0; i < run->numOwnBoids; i++)
+        {
+            interior->boids[i] = run->ownBoids[i].boid;
+        }
+
+        const float worldLimit = interior->worldSize;
+        const float minZ = (run->neighbors[DOMAIN_LINK_DOWN] >= 0) ? run->minZ + run->reach : -2.0f * worldLimit;
+        const float maxZ = (run->neighbors[DOMAIN_LINK_UP] >= 0) ? run->maxZ - run->reach : 2.0f * worldLimit;
+
+        if (minZ <= maxZ)
+        {
+            UpdateBoidsInSlab(interior, minZ, maxZ);
+        }
+    }
+
+    // Steers the boids near the linked faces, in a flock of the band around them and the halos.
+    void SteerEdge(DomainRun* run)
+    {
+        const DomainRecord* lists[DOMAIN_LINK_COUNT + 1] =
+        {
+            run->bandBoids,
+            GetMessageRecords(run->receiveBytes[DOMAIN_LINK_DOWN], DOMAIN_MESSAGE_HALO),
+            GetMessageRecords(run->receiveBytes[DOMAIN_LINK_UP], DOMAIN_MESSAGE_HALO)
+        };
+        const int counts[DOMAIN_LINK_COUNT + 1] =
+        {
+            run->numBandBoids, run->numHaloReceived[DOMAIN_LINK_DOWN], run->numHaloReceived[DOMAIN_LINK_UP]
+        };
+
+        GameState* edge = run->edge;
+        edge->numBoids = MergeRecords(run, lists, counts, DOMAIN_LINK_COUNT + 1);
+        edge->tick = run->tick;
+
+        for (int i = 0; i < edge->numBoids; i++)
+        {
+            edge->boids[i] = run->mergedBoids[i].boid;
+        }
+
+        UpdateBoids(edge);
+    }
+
+    // Takes each own boid's new state from whichever step could see all of its neighbours.
+    void CollectOwnBoids(DomainRun* run)
+    {
+        const Boid* interiorBoids = run->interior->boids;
+        const Boid* edgeBoids = run->edge->boids;
+        int edgeIndex = 0;
+
+        for (int i = 0; i < run->numOwnBoids; i++)
+        {
+            DomainRecord* record = &run->ownBoids[i];
+
+            if (GetDistanceToLinkedFace(run, record->boid.position.z) >= run->reach)
+            {
+                record->boid = interiorBoids[i];
+                continue;
+            }
+
+            // The band is in id order, so the edge boids come up in the merged flock in the same order as here.
+            while (run->mergedSources[edgeIndex] != 0 || run->mergedBoids[edgeIndex].id != record->id)
+            {
+                edgeIndex++;
+            }
+
+            record->boid = edgeBoids[edgeIndex++];
+        }
+    }
+
+    // Makes the whole flock available to domain 0: through the shared copy, or by sending this domain's boids to it.
+    bool PublishBoids(DomainRun* run, GameState* gameState)
+    {
+        run->stats.numBoids = run->numOwnBoids;
+
+        if (run->shared)
+        {
+            Boid* published = GetPublishedBoids(run, run->tick);
+            for (int i = 0; i < run->numOwnBoids; i++)
+            {
+                published[run->ownBoids[i].id] = run->ownBoids[i].boid;
+            }
+
+            GetShared(run)->stats[run->tick & 1][run->rank] = run->stats;
+
+            if (!WaitForDomains(run))
+            {
+                return false;
+            }
+
+            // Every domain has published its boids for this tick, and none can write to this copy again until this
+            // process has reached the next barrier.
+            if (run->rank == 0)
+            {
+                std::memcpy(gameState->boids, published, sizeof(Boid) * gameState->numBoids);
+                std::memcpy(run->allStats, GetShared(run)->stats[run->tick & 1], sizeof(run->allStats));
+            }
+
+            return true;
+        }
+
+        if (run->rank != 0)
+        {
+            uint8_t* bytes = run->sendBytes[0];
+            std::memcpy(bytes + sizeof(DomainMessage), &run->stats, sizeof(DomainStats));
+            std::memcpy(GetMessageRecords(bytes, DOMAIN_MESSAGE_GATHER), run->ownBoids,
+                sizeof(DomainRecord) * run->numOwnBoids);
+
+            DomainTransfer transfer = StartSend(&run->gather[0], bytes, run->tick, DOMAIN_MESSAGE_GATHER,
+                run->numOwnBoids);
+            return RunTransfers(run, &transfer, 1, DOMAIN_MESSAGE_GATHER);
+        }
+
+        for (int i = 0; i < run->numOwnBoids; i++)
+        {
+            gameState->boids[run->ownBoids[i].id] = run->ownBoids[i].boid;
+        }
+        run->allStats[0] = run->stats;
+
+        // One domain at a time, so one buffer the size of the flock is enough.
+        for (int rank = 1; rank < run->numDomains; rank++)
+        {
+            uint8_t* bytes = run->receiveBytes[0];
+            DomainTransfer transfer = StartReceive(&run->gather[rank], bytes);
+            if (!RunTransfers(run, &transfer, 1, DOMAIN_MESSAGE_GATHER))
+            {
+                return false;
+            }
+
+            std::memcpy(&run->allStats[rank], bytes + sizeof(DomainMessage), sizeof(DomainStats));
+
+            const DomainRecord* records = GetMessageRecords(bytes, DOMAIN_MESSAGE_GATHER);
+            for (int i = 0; i < transfer.count; i++)
+            {
+                gameState->boids[records[i].id] = records[i].boid;
+            }
+        }
+
+        return true;
+    }
+
+    bool SendHello(const int socket, const DomainRun* run, const DomainHelloKind kind)
+    {
+        const DomainHello hello = { .magic = helloMagic, .numDomains = run->numDomains, .rank = run->rank,
+            .kind = kind };
+        const uint8_t* bytes = (const uint8_t*)&hello;
+
+        for (size_t done = 0; done < sizeof(hello);)
+        {
+            const int64_t sent = PlatformSendSocket(socket, bytes + done, sizeof(hello) - done, true);
+            if (sent < 0)
+            {
+                return false;
+            }
+
+            done += (size_t)sent;
+        }
+
+        return true;
+    }
+
+    bool ReceiveHello(const int socket, DomainHello* hello)
+    {
+        uint8_t* bytes = (uint8_t*)hello;
+
+        for (size_t done = 0; done < sizeof(*hello);)
+        {
+            const int64_t received = PlatformReceiveSocket(socket, bytes + done, sizeof(*hello) - done, true);
+            if (received < 0)
+            {
+                return false;
+            }
+
+            done += (size_t)received;
+        }
+
+        return hello->magic == helloMagic;
+    }
+
+    // The other domain may not be listening yet, so keep trying for a while.
+    int ConnectToDomain(const DomainRun* run, const int rank, const DomainHelloKind kind)
+    {
+        char address[256] = {};
+        if (!GetDomainAddress(run->addresses, rank, address, sizeof(address)))
+        {
+            std::printf("ERROR: No address for domain %d in '%s'.\n", rank, run->addresses);
+            return -1;
+        }
+
+        const auto start = std::chrono::steady_clock::now();
+        while (MillisecondsSince(start) < connectTimeoutMilliseconds)
+        {
+            const int socket = PlatformConnectSocket(address);
+            if (socket >= 0)
+            {
+                if (SendHello(socket, run, kind))
+                {
+                    return socket;
+                }
+
+                PlatformCloseSocket(socket);
+            }
+
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+
+        std::printf("ERROR: Domain %d could not reach domain %d at %s.\n", run->rank, rank, address);
+        return -1;
+    }
+
+    // Every domain connects to the one above it and, unless it is domain 0, to domain 0, then accepts the
+    // connections coming the other way. Connecting doesn't wait for the other side to accept, so every domain can
+    // make its own connections first.
+    bool ConnectDomains(DomainRun* run)
+    {
+        char address[256] = {};
+        if (!GetDomainAddress(run->addresses, run->rank, address, sizeof(address)))
+        {
+            std::printf("ERROR: No address for domain %d in '%s'.\n", run->rank, run->addresses);
+            return false;
+        }
+
+        const int listener = PlatformListenSocket(address);
+        if (listener < 0)
+        {
+            std::printf("ERROR: Domain %d could not listen at %s.\n", run->rank, address);
+            return false;
+        }
+
+        bool connected = true;
+        if (run->neighbors[DOMAIN_LINK_UP] >= 0)
+        {
+            run->links[DOMAIN_LINK_UP].socket = ConnectToDomain(run, run->neighbors[DOMAIN_LINK_UP],
+                DOMAIN_HELLO_LINK);
+            connected = run->links[DOMAIN_LINK_UP].socket >= 0;
+        }
+
+        if (connected && run->rank != 0)
+        {
+            run->gather[0].socket = ConnectToDomain(run, 0, DOMAIN_HELLO_GATHER);
+            connected = run->gather[0].socket >= 0;
+        }
+
+        int numExpected = (run->neighbors[DOMAIN_LINK_DOWN] >= 0) ? 1 : 0;
+        numExpected += (run->rank == 0) ? run->numDomains - 1 : 0;
+
+        for (int i = 0; connected && i < numExpected; i++)
+        {
+            const int socket = PlatformAcceptSocket(listener);
+            DomainHello hello = {};
+
+            if (socket < 0 || !ReceiveHello(socket, &hello) || hello.numDomains != run->numDomains)
+            {
+                std::printf("ERROR: Domain %d got a connection from something that isn't one of its domains.\n",
+                    run->rank);
+                PlatformCloseSocket(socket);
+                connected = false;
+            }
+            else if (hello.kind == DOMAIN_HELLO_LINK && hello.rank == run->neighbors[DOMAIN_LINK_DOWN] &&
+                run->links[DOMAIN_LINK_DOWN].socket < 0)
+            {
+                run->links[DOMAIN_LINK_DOWN].socket = socket;
+            }
+            else if (hello.kind == DOMAIN_HELLO_GATHER && run->rank == 0 && hello.rank > 0 &&
+                hello.rank < run->numDomains && run->gather[hello.rank].socket < 0)
+            {
+                run->gather[hello.rank].socket = socket;
+            }
+            else
+            {
+                std::printf("ERROR: Domain %d got an unexpected connection from domain %d.\n", run->rank, hello.rank);
+                PlatformCloseSocket(socket);
+                connected = false;
+            }
+        }
+
+        PlatformCloseSocket(listener);
+        if (std::strncmp(address, "unix:", 5) == 0)
+        {
+            std::remove(address + 5);
+        }
+
+        return connected;
+    }
+
+    void SetSlabFaces(DomainRun* run)
+    {
+        run->minZ = (float)run->balancer.cuts[run->rank];
+        run->maxZ = (float)run->balancer.cuts[run->rank + 1];
+    }
+
+    // Feeds this tick's costs to the balancer and, at the end of a window, puts the faces where it has moved them.
+    bool BalanceDomains(DomainRun* run)
+    {
+        LoadBalancer* balancer = &run->balancer;
+
+        if (run->shared || run->rank == 0)
+        {
+            // Each domain's cumulative stats as of this tick: the shared copy is the one every domain has just
+            // published, and the same for all of them.
+            const DomainStats* stats = run->shared ? GetShared(run)->stats[run->tick & 1] : run->allStats;
+
+            double costs[maxDomains] = {};
+            for (int rank = 0; rank < run->numDomains; rank++)
+            {
+                costs[rank] = stats[rank].stepMilliseconds - run->balancedMilliseconds[rank];
+                run->balancedMilliseconds[rank] = stats[rank].stepMilliseconds;
+            }
+
+            if (AddLoadSample(balancer, costs))
+            {
+                RecordMetric(METRIC_LOAD_IMBALANCE, balancer->imbalance);
+            }
+        }
+
+        if ((run->tick - run->firstTick) % balanceWindow != 0)
+        {
+            return true;
+        }
+
+        if (!run->shared && run->rank == 0)
+        {
+            uint8_t* bytes = run->sendBytes[0];
+            std::memcpy(GetMessageRecords(bytes, DOMAIN_MESSAGE_CUTS), balancer->cuts,
+                sizeof(double) * (run->numDomains + 1));
+
+            DomainTransfer transfers[maxDomains] = {};
+            for (int rank = 1; rank < run->numDomains; rank++)
+            {
+                transfers[rank - 1] = StartSend(&run->gather[rank], bytes, run->tick, DOMAIN_MESSAGE_CUTS,
+                    run->numDomains + 1);
+            }
+
+            if (!RunTransfers(run, transfers, run->numDomains - 1, DOMAIN_MESSAGE_CUTS))
+            {
+                return false;
+            }
+        }
+        else if (!run->shared)
+        {
+            uint8_t* bytes = run->receiveBytes[0];
+            DomainTransfer transfer = StartReceive(&run->gather[0], bytes);
+            if (!RunTransfers(run, &transfer, 1, DOMAIN_MESSAGE_CUTS))
+            {
+                return false;
+            }
+
+            if (transfer.count != run->numDomains + 1)
+            {
+                std::printf("ERROR: Domain %d got the faces of %d domains.\n", run->rank, transfer.count - 1);
+                Fail(run);
+                return false;
+            }
+
+            std::memcpy(balancer->cuts, GetMessageRecords(bytes, DOMAIN_MESSAGE_CUTS),
+                sizeof(double) * transfer.count);
+        }
+
+        SetSlabFaces(run);
+        return true;
+    }
+
+    // Sets up this process's flocks, scratch and connections, and picks its boids out of the whole flock.
+    bool BeginDomain(DomainRun* run, const GameState* gameState)
+    {
+        const int numBoids = gameState->numBoids;
+        const float worldLimit = gameState->worldSize;
+        const MemoryBudget budget = PlanGameMemory(numBoids, worldLimit, &gameState->params, false);
+
+        for (DomainChannel& channel : run->links)
+        {
+            channel = {};
+            channel.socket = -1;
+        }
+
+        for (DomainChannel& channel : run->gather)
+        {
+            channel = {};
+            channel.socket = -1;
+        }
+
+        run->interior = AllocateGameMemory(&budget, &run->interiorMemory);
+        run->edge = AllocateGameMemory(&budget, &run->edgeMemory);
+
+        const size_t recordsSize = AlignUp(sizeof(DomainRecord) * numBoids, 64);
+        const size_t sourcesSize = AlignUp(numBoids, 64);
+        const size_t messageSize = AlignUp(GetMessageSize(DOMAIN_MESSAGE_GATHER, numBoids), 64);
+        run->scratchSize = 3 * recordsSize + sourcesSize + 2 * DOMAIN_LINK_COUNT * messageSize;
+        run->scratch = PlatformAllocateMemory(run->scratchSize);
+
+        if (!run->interior || !run->edge || !run->scratch)
+        {
+            std::printf("ERROR: Domain %d could not reserve memory for its flock.\n", run->rank);
+            Fail(run);
+            return false;
+        }
+
+        for (GameState* local : { run->interior, run->edge })
+        {
+            local->worldSize = worldLimit;
+            local->params = gameState->params;
+            local->deterministic = gameState->deterministic;
+        }
+
+        uint8_t* scratch = (uint8_t*)run->scratch;
+        run->ownBoids = (DomainRecord*)scratch;
+        run->bandBoids = (DomainRecord*)(scratch + recordsSize);
+        run->mergedBoids = (DomainRecord*)(scratch + 2 * recordsSize);
+        run->mergedSources = scratch + 3 * recordsSize;
+
+        uint8_t* messages = scratch + 3 * recordsSize + sourcesSize;
+        for (int link = 0; link < DOMAIN_LINK_COUNT; link++)
+        {
+            run->sendBytes[link] = messages + link * messageSize;
+            run->receiveBytes[link] = messages + (DOMAIN_LINK_COUNT + link) * messageSize;
+        }
+
+        float minWidth = 0.0f;
+        float maxShift = 0.0f;
+        GetSlabLimits(gameState, &minWidth, &maxShift);
+
+        const bool movable = ResetLoadBalancer(&run->balancer, run->numDomains, -worldLimit, worldLimit, minWidth,
+            maxShift, balanceWindow);
+        if (!movable && run->rank == 0)
+        {
+            std::printf("WARNING: The domains are too narrow to move the faces between them, so they stay equal.\n");
+        }
+
+        SetSlabFaces(run);
+        run->firstTick = gameState->tick;
+        for (double& milliseconds : run->balancedMilliseconds)
+        {
+            milliseconds = 0.0;
+        }
+
+        run->reach = GetGridCellSize(&gameState->params, worldLimit) * (1.0f + haloMargin);
+        run->tick = gameState->tick;
+
+        const bool wrap = gameState->params.boundaryMode == BOUNDARY_MODE_WRAP;
+        const int down = run->rank - 1;
+        const int up = run->rank + 1;
+        run->neighbors[DOMAIN_LINK_DOWN] = (down >= 0) ? down : (wrap ? run->numDomains - 1 : -1);
+        run->neighbors[DOMAIN_LINK_UP] = (up < run->numDomains) ? up : (wrap ? 0 : -1);
+
+        if (run->shared)
+        {
+            // Each domain writes to the ring on its own side, and reads from the neighbour's ring that faces back.
+            for (int link = 0; link < DOMAIN_LINK_COUNT; link++)
+            {
+                const int neighbor = run->neighbors[link];
+                if (neighbor >= 0)
+                {
+                    const int outgoing = run->rank * DOMAIN_LINK_COUNT + link;
+                    const int incoming = neighbor * DOMAIN_LINK_COUNT + (DOMAIN_LINK_COUNT - 1 - link);
+                    run->links[link].sendRing = &GetShared(run)->rings[outgoing];
+                    run->links[link].sendRingBytes = GetRingBytes(run, outgoing);
+                    run->links[link].receiveRing = &GetShared(run)->rings[incoming];
+                    run->links[link].receiveRingBytes = GetRingBytes(run, incoming);
+                }
+            }
+        }
+        else if (!ConnectDomains(run))
+        {
+            Fail(run);
+            return false;
+        }
+
+        run->numOwnBoids = 0;
+        for (int i = 0; i < numBoids; i++)
+        {
+            if (GetDomainOfPosition(run, gameState->boids[i].position.z) == run->rank)
+            {
+                run->ownBoids[run->numOwnBoids++] = { .id = i, .boid = gameState->boids[i] };
+            }
+        }
+
+        run->stopping = false;
+        run->exchangeRequested = false;
+        run->commThread = std::thread(RunCommThread, run);
+        return true;
+    }
+
+    bool StepDomain(DomainRun* run, GameState* gameState)
+    {
+        PROFILE_ZONE("StepDomain");
+
+        const int64_t bytesSentBefore = run->stats.bytesSent;
+        const auto stepStart = std::chrono::steady_clock::now();
+        double waitMilliseconds = 0.0;
+
+        auto waitStart = stepStart;
+        if (!ExchangeMigrants(run))
+        {
+            return false;
+        }
+        waitMilliseconds += MillisecondsSince(waitStart);
+
+        // The halos travel while the interior is steered.
+        PrepareHalos(run);
+        StartHaloExchange(run);
+        SteerInterior(run);
+
+        waitStart = std::chrono::steady_clock::now();
+        if (!FinishHaloExchange(run))
+        {
+            return false;
+        }
+        waitMilliseconds += MillisecondsSince(waitStart);
+
+        SteerEdge(run);
+        CollectOwnBoids(run);
+        run->tick++;
+
+        // What goes out with the boids includes the work and the wait so far; the wait to publish them, and for the
+        // faces, counts towards the next.
+        run->stats.stepMilliseconds += MillisecondsSince(stepStart) - waitMilliseconds;
+        run->stats.waitMilliseconds += waitMilliseconds;
+
+        waitStart = std::chrono::steady_clock::now();
+        if (!PublishBoids(run, gameState))
+        {
+            return false;
+        }
+
+        if (!BalanceDomains(run))
+        {
+            return false;
+        }
+
+        const double publishMilliseconds = MillisecondsSince(waitStart);
+        run->stats.waitMilliseconds += publishMilliseconds;
+        waitMilliseconds += publishMilliseconds;
+
+        run->stats.maxWaitMilliseconds = (waitMilliseconds > run->stats.maxWaitMilliseconds) ?
+            waitMilliseconds : run->stats.maxWaitMilliseconds;
+
+        RecordMetric(METRIC_DOMAIN_SENT, (double)(run->stats.bytesSent - bytesSentBefore));
+        RecordMetric(METRIC_DOMAIN_WAIT_TIME, waitMilliseconds);
+        return true;
+    }
+
+    void EndDomain(DomainRun* run)
+    {
+        if (run->commThread.joinable())
+        {
+            {
+                std::lock_guard<std::mutex> lock(run->mutex);
+                run->stopping = true;
+            }
+            run->exchangeStarted.notify_one();
+            run->commThread.join();
+        }
+
+        for (DomainChannel& channel : run->links)
+        {
+            PlatformCloseSocket(channel.socket);
+            channel.socket = -1;
+        }
+
+        for (DomainChannel& channel : run->gather)
+        {
+            PlatformCloseSocket(channel.socket);
+            channel.socket = -1;
+        }
+
+        FreeGameMemory(&run->interiorMemory);
+        FreeGameMemory(&run->edgeMemory);
+        run->interior = nullptr;
+        run->edge = nullptr;
+
+        if (run->scratch)
+        {
+            PlatformFreeMemory(run->scratch, run->scratchSize);
+            run->scratch = nullptr;
+        }
+    }
+}
+
+bool StartDomains(DomainRun* run, const GameState* gameState, const DomainOptions* options)
+{
+    const int numDomains = options->numDomains;
+
+    if (numDomains < 2 || numDomains > maxDomains)
+    {
+        std::printf("ERROR: The world can be split into 2 to %d domains, not %d.\n", maxDomains, numDomains);
+        return false;
+    }
+
+    if (options->rank >= numDomains || (options->rank >= 0 && !options->addresses))
+    {
+        std::printf("ERROR: A domain started on its own needs a rank below %d and the others' addresses.\n",
+            numDomains);
+        return false;
+    }
+
+    if (gameState->params.neighborMode != NEIGHBOR_MODE_METRIC)
+    {
+        std::printf("ERROR: Domains need metric neighbours; topological ones can be anywhere in the world.\n");
+        return false;
+    }
+
+    // A domain only talks to its two neighbours, so it has to be at least as wide as the halo, and as the furthest a
+    // boid can move in one tick.
+    const float worldLimit = gameState->worldSize;
+    const float width = 2.0f * worldLimit / numDomains;
+    const float reach = GetGridCellSize(&gameState->params, worldLimit) * (1.0f + haloMargin);
+    const float minWidth = (reach > gameState->params.maxSpeed) ? reach : gameState->params.maxSpeed;
+
+    if (width < minWidth)
+    {
+        std::printf("ERROR: %d domains would be %.1f wide, narrower than the %.1f the rules reach. Use fewer.\n",
+            numDomains, width, minWidth);
+        return false;
+    }
+
+    run->numDomains = numDomains;
+    run->rank = 0;
+    run->numTicks = options->numTicks;
+    run->numTicksRun = 0;
+    run->addresses = options->addresses;
+    run->numProcesses = 0;
+    run->failed = false;
+    run->stats = {};
+
+    if (options->rank >= 0)
+    {
+        run->rank = options->rank;
+        if (!BeginDomain(run, gameState))
+        {
+            StopDomains(run);
+            return false;
+        }
+
+        return true;
+    }
+
+    if (!run->addresses)
+    {
+        run->sharedSize = sizeof(DomainShared) + ringSize * numDomains * DOMAIN_LINK_COUNT +
+            2 * sizeof(Boid) * gameState->numBoids;
+        run->shared = PlatformAllocateSharedMemory(run->sharedSize);
+
+        if (!run->shared)
+        {
+            std::printf("ERROR: Could not share memory between domain processes on this platform.\n");
+            run->numDomains = 0;
+            return false;
+        }
+
+        new (run->shared) DomainShared();
+    }
+
+    // Anything still buffered would be written again by every process that inherits it.
+    std::fflush(stdout);
+
+    for (int rank = 1; rank < numDomains; rank++)
+    {
+        const int process = PlatformForkProcess();
+
+        if (process == 0)
+        {
+            run->rank = rank;
+            run->numProcesses = 0;
+
+            bool ok = BeginDomain(run, gameState);
+            for (int tick = 0; ok && tick < run->numTicks; tick++)
+            {
+                ok = StepDomain(run, nullptr);
+            }
+
+            if (!ok)
+            {
+                Fail(run);
+            }
+
+            EndDomain(run);
+            std::fflush(stdout);
+            std::_Exit(ok ? 0 : 1);
+        }
+
+        if (process < 0)
+        {
+            std::printf("ERROR: Could not start the process for domain %d.\n", rank);
+            Fail(run);
+            StopDomains(run);
+            return false;
+        }
+
+        run->processes[run->numProcesses++] = process;
+    }
+
+    if (!BeginDomain(run, gameState))
+    {
+        StopDomains(run);
+        return false;
+    }
+
+    return true;
+}
+
+bool StepDomains(DomainRun* run, GameState* gameState)
+{
+    if (!StepDomain(run, gameState))
+    {
+        std::printf("ERROR: A domain failed at tick %llu.\n", (unsigned long long)run->tick);
+        Fail(run);
+        return false;
+    }
+
+    run->numTicksRun++;
+    gameState->tick = run->tick;
+
+    if (run->rank == 0)
+    {
+        gameState->stateHash = gameState->deterministic ? HashBoids(gameState->boids, gameState->numBoids) : 0;
+    }
+
+    return true;
+}
+
+void StopDomains(DomainRun* run)
+{
+    if (run->numDomains == 0)
+    {
+        return;
+    }
+
+    // The others can't finish the run without this domain, so if it stopped early they have to stop too.
+    if (run->numTicksRun < run->numTicks)
+    {
+        Fail(run);
+    }
+
+    // Closing the sockets is also how the others find out that this domain is gone.
+    EndDomain(run);
+
+    bool ok = !HasFailed(run);
+    for (int i = 0; i < run->numProcesses; i++)
+    {
+        ok = PlatformWaitForProcess(run->processes[i]) && ok;
+    }
+
+    // Domain 0 reports for all of them, a domain started on its own only for itself.
+    run->allStats[run->rank] = run->stats;
+
+    const int firstRank = run->rank;
+    const int lastRank = (run->rank == 0) ? run->numDomains - 1 : run->rank;
+    const double numTicks = (run->numTicksRun > 0) ? (double)run->numTicksRun : 1.0;
+
+    for (int rank = firstRank; ok && rank <= lastRank; rank++)
+    {
+        const DomainStats* stats = &run->allStats[rank];
+        std::printf("Domain %d: %d boids, z %.1f to %.1f; per tick %.3f ms working, %.1f halo boids, %.2f migrants, "
+            "%.1f KB sent, %.3f ms waiting (%.3f at most).\n", rank, stats->numBoids, run->balancer.cuts[rank],
+            run->balancer.cuts[rank + 1], stats->stepMilliseconds / numTicks, stats->haloBoids / numTicks,
+            stats->migrants / numTicks, stats->bytesSent / numTicks / 1024.0, stats->waitMilliseconds / numTicks,
+            stats->maxWaitMilliseconds);
+    }
+
+    if (ok && run->rank == 0)
+    {
+        std::printf("Faces moved in %d of %d windows; in the last, the busiest domain worked %.2f times the average.\n",
+            run->balancer.numMoves, run->numTicksRun / balanceWindow, run->balancer.imbalance);
+    }
+
+    if (run->shared)
+    {
+        PlatformFreeMemory(run->shared, run->sharedSize);
+        run->shared = nullptr;
+    }
+
+    run->numDomains = 0;
+}
@@ -0,0 +1,172 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+
+#include "balance.h"
+#include "boid.h"
+#include "game.h"
+
+// A headless run split between processes. The world is cut along z into equal slabs, the domains, and each is
+// simulated by its own process with its own GameState, holding the boids it owns and, around them, a halo: copies of
+// the boids in the neighbouring domains that are close enough to the shared face to be seen from this side of it.
+//
+// Every tick, each domain first hands the boids that crossed into a neighbour over to it, then sends each neighbour
+// its halo in one message. While the halos are on their way it steers its interior, the boids too far from a face to
+// see past it, and once they have arrived it steers the boids near the faces together with them. Both steps sort
+// their boids by their index in the whole flock, and the grid keeps boids in index order within each cell, so every
+// boid sees its neighbours in the same order it would in a single process, and in deterministic mode the result is
+// bit for bit the same.
+//
+// The domains talk either through memory shared between processes forked from the one that calls StartDomains, or
+// through TCP or Unix domain sockets, which also lets each domain be started on its own, on any machine that can reach
+// the others. With shared memory every domain also writes its boids into a shared copy of the whole flock after each
+// tick; over sockets the others send theirs to domain 0. Either way the first domain keeps the full GameState up to
+// date for the hash, recording and snapshots. Only on POSIX, and only with metric neighbours; topological neighbours
+// can be anywhere in the world.
+//
+// The slabs start out equal, but a flock moves, and the domain it crowds into ends up doing most of the work while
+// the others wait for it. So every domain measures how long its own work takes each tick, and the faces between the
+// slabs are moved towards equal cost a window of ticks at a time (see balance.h). With shared memory every domain reads
+// the others' costs and moves the faces the same way; over sockets domain 0, which has them all, sends the others the
+// new faces. A face never moves far enough in one window for a boid to end up more than one domain away, and no slab
+// gets narrower than the halo. Which boids a domain owns doesn't change how any boid is steered, so deterministic runs
+// still print the same hashes.
+
+constexpr int maxDomains = 16;
+
+// One side of a domain: towards -z or +z.
+enum DomainLink
+{
+    DOMAIN_LINK_DOWN,
+    DOMAIN_LINK_UP,
+
+    DOMAIN_LINK_COUNT
+};
+
+// A boid on its way to another domain, with its index in the whole flock.
+struct DomainRecord
+{
+    int32_t id;
+    Boid boid;
+};
+
+// Totals over the run so far.
+struct DomainStats
+{
+    int numBoids; // Owned after the last tick.
+    int64_t haloBoids; // Sent to the neighbours.
+    int64_t migrants;
+    int64_t bytesSent;
+    double waitMilliseconds; // Spent waiting for the other domains.
+    double maxWaitMilliseconds; // In any one tick.
+    double stepMilliseconds; // Spent on the domain's own work: what the faces are balanced by.
+};
+
+// A single producer, single consumer ring of bytes in shared memory. Both counters only ever grow; their difference
+// is how much is waiting to be read.
+struct DomainRing
+{
+    alignas(64) std::atomic<uint64_t> written;
+    alignas(64) std::atomic<uint64_t> read;
+};
+
+// How a domain talks to one other: a ring each way in shared memory, or a socket.
+struct DomainChannel
+{
+    DomainRing* sendRing;
+    uint8_t* sendRingBytes;
+    DomainRing* receiveRing;
+    uint8_t* receiveRingBytes;
+    int socket; // -1 with shared memory.
+};
+
+struct DomainOptions
+{
+    int numDomains;
+    int numTicks;
+    // Where the domains listen over sockets: one "host:port" or "unix:<path>" per domain separated by commas, or a
+    // single one that the others count up from, by port or with ".<domain>" after the path. Null to use shared
+    // memory instead.
+    const char* addresses;
+    // The one domain this process runs, when each is started on its own. -1 forks all of them from this process.
+    int rank;
+};
+
+struct DomainRun
+{
+    int numDomains;
+    int rank; // The domain this process simulates, 0 in the one that keeps the whole flock.
+    int numTicks;
+    int numTicksRun;
+    uint64_t tick;
+    int neighbors[DOMAIN_LINK_COUNT]; // -1 where the slab is against the wall of the world.
+    float minZ; // The slab's faces, from balancer.cuts.
+    float maxZ;
+    float reach; // How far from a face a boid is still seen from the other side of it.
+
+    const char* addresses; // Null with shared memory.
+    DomainChannel links[DOMAIN_LINK_COUNT];
+    // Over sockets, every other domain sends its boids to domain 0 after each tick. Indexed by domain in domain 0;
+    // the others only use gather[0].
+    DomainChannel gather[maxDomains];
+
+    int processes[maxDomains]; // The other domains' processes, in the one that forked them.
+    int numProcesses;
+
+    void* shared;
+    size_t sharedSize;
+    std::atomic<bool> failed;
+
+    // The interior step's flock is this domain's own boids, the edge step's the boids near its faces and the halos.
+    GameMemory interiorMemory;
+    GameState* interior;
+    GameMemory edgeMemory;
+    GameState* edge;
+
+    // Scratch, sized for the whole flock. Messages are a header followed by records.
+    void* scratch;
+    size_t scratchSize;
+    DomainRecord* ownBoids; // Sorted by id.
+    DomainRecord* bandBoids; // The own boids the edge step needs.
+    DomainRecord* mergedBoids;
+    uint8_t* mergedSources; // Which list each merged record came from, 0 for own boids.
+    uint8_t* sendBytes[DOMAIN_LINK_COUNT];
+    uint8_t* receiveBytes[DOMAIN_LINK_COUNT];
+    int numOwnBoids;
+    int numBandBoids;
+    int numHaloSent[DOMAIN_LINK_COUNT];
+    int numHaloReceived[DOMAIN_LINK_COUNT];
+
+    // The halo exchange runs on its own thread while this one steers the interior.
+    std::thread commThread;
+    std::mutex mutex;
+    std::condition_variable exchangeStarted;
+    std::condition_variable exchangeFinished;
+    bool exchangeRequested;
+    bool exchangeSucceeded;
+    bool stopping;
+
+    // The faces between the slabs along z. Every domain keeps the same cuts, but over sockets only domain 0 balances
+    // them; the others take its word for them.
+    LoadBalancer balancer;
+    uint64_t firstTick;
+    double balancedMilliseconds[maxDomains]; // Each domain's stepMilliseconds as of the last sample.
+
+    DomainStats stats; // This domain's.
+    DomainStats allStats[maxDomains]; // Every domain's as of the last tick, in domain 0.
+};
+
+// Checks that the world can be cut into options->numDomains slabs for these parameters, then starts the other
+// domains' processes, which run options->numTicks ticks and exit, or with options->rank connects to the others.
+// Returns false, with a message, if it can't.
+bool StartDomains(DomainRun* run, const GameState* gameState, const DomainOptions* options);
+// Runs one tick of this process's domain alongside the others. In domain 0 the whole flock is then copied back into
+// gameState. Returns false, with a message, if any domain failed.
+bool StepDomains(DomainRun* run, GameState* gameState);
+// Waits for the other processes to exit and prints what each domain did.
+void StopDomains(DomainRun* run);
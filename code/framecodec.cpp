@@ -0,0 +1,578 @@
+#include "framecodec.h"
+
+#include <cmath>
+#include <cstring>
+
+#include "boid.h"
+#include "platform.h"
+#include "profiler.h"
+
+namespace
+{
+    constexpr int boidsPerChunk = 8192;
+    constexpr int valuesPerBoid = 6;
+    constexpr float quantizedRange = 32767.0f;
+    constexpr uint32_t frameFlagKeyframe = 1 << 0;
+
+    // rANS with 32-bit state, byte-wise renormalization and 12-bit probabilities.
+    constexpr uint32_t probBits = 12;
+    constexpr uint32_t probScale = 1 << probBits;
+    constexpr uint32_t ransLow = 1 << 23;
+
+    constexpr size_t maxVarintSize = 5;
+    constexpr size_t chunkHeaderSize = sizeof(uint32_t) + sizeof(uint16_t) + 256 * 3 + sizeof(uint32_t);
+
+    struct SymbolTable
+    {
+        uint32_t freq[256];
+        uint32_t cum[257];
+    };
+
+    uint32_t Load32(const uint8_t* p)
+    {
+        return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+    }
+
+    void Store32(uint8_t* p, const uint32_t v)
+    {
+        p[0] = (uint8_t)v;
+        p[1] = (uint8_t)(v >> 8);
+        p[2] = (uint8_t)(v >> 16);
+        p[3] = (uint8_t)(v >> 24);
+    }
+
+    int32_t Quantize(const float value, const float invScale)
+    {
+        float q = value * invScale;
+        q = (q > quantizedRange) ? quantizedRange : ((q < -quantizedRange) ? -quantizedRange : q);
+        return (int32_t)std::lrintf(q);
+    }
+
+    uint32_t ZigZag(const int32_t v)
+    {
+        return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+    }
+
+    int32_t UnZigZag(const uint32_t v)
+    {
+        return (int32_t)(v >> 1) ^ -(int32_t)(v & 1);
+    }
+
+    uint8_t* WriteVarint(uint8_t* out, uint32_t v)
+    {
+        while (v >= 0x80)
+        {
+            *out++ = (uint8_t)(v | 0x80);
+            v >>= 7;
+        }
+        *out++ = (uint8_t)v;
+        return out;
+    }
+
+    const uint8_t* ReadVarint(const uint8_t* in, const uint8_t* end, uint32_t* v)
+    {
+        uint32_t result = 0;
+        for (int shift = 0; shift < 35 && in < end; shift += 7)
+        {
+            const uint8_t byte = *in++;
+            result |= (uint32_t)(byte & 0x7F) << shift;
+            if (!(byte & 0x80))
+            {
+                *v = result;
+                return in;
+            }
+        }
+        return nullptr;
+    }
+
+    // Scales raw byte counts so they sum to exactly probScale, keeping every present symbol at least 1.
+    void BuildSymbolTable(const uint32_t counts[256], const uint32_t total, SymbolTable* table)
+    {
+        uint32_t sum = 0;
+        int largest = 0;
+
+        for (int s = 0; s < 256; s++)
+        {
+            uint32_t f = 0;
+            if (counts[s] > 0)
+            {
+                f = (uint32_t)(((uint64_t)counts[s] * probScale) / total);
+                f = (f == 0) ? 1 : f;
+            }
+
+            table->freq[s] = f;
+            sum += f;
+            largest = (f > table->freq[largest]) ? s : largest;
+        }
+
+        while (sum > probScale)
+        {
+            int biggest = 0;
+            for (int s = 1; s < 256; s++)
+            {
+                biggest = (table->freq[s] > table->freq[biggest]) ? s : biggest;
+            }
+            table->freq[biggest]--;
+            sum--;
+        }
+
+        table->freq[largest] += probScale - sum;
+
+        table->cum[0] = 0;
+        for (int s = 0; s < 256; s++)
+        {
+            table->cum[s + 1] = table->cum[s] + table->freq[s];
+        }
+    }
+
+    // Encodes backwards from `end` and returns the start of the coded bytes.
+    uint8_t* RansEncode(const uint8_t* in, const size_t size, const SymbolTable* table, uint8_t* end)
+    {
+        uint8_t* ptr = end;
+        uint32_t x = ransLow;
+
+        for (size_t i = size; i > 0; i--)
+        {
+            const uint8_t s = in[i - 1];
+            const uint32_t f = table->freq[s];
+            const uint32_t xMax = ((ransLow >> probBits) << 8) * f;
+
+            while (x >= xMax)
+            {
+                *--ptr = (uint8_t)x;
+                x >>= 8;
+            }
+
+            x = ((x / f) << probBits) + (x % f) + table->cum[s];
+        }
+
+        ptr -= 4;
+        Store32(ptr, x);
+        return ptr;
+    }
+
+    bool RansDecode(const uint8_t* in, const uint8_t* end, const SymbolTable* table, uint8_t* out, const size_t size)
+    {
+        uint8_t slotToSymbol[probScale];
+        for (int s = 0; s < 256; s++)
+        {
+            std::memset(slotToSymbol + table->cum[s], s, table->freq[s]);
+        }
+
+        if (end - in < 4)
+        {
+            return false;
+        }
+
+        uint32_t x = Load32(in);
+        in += 4;
+
+        for (size_t i = 0; i < size; i++)
+        {
+            const uint32_t slot = x & (probScale - 1);
+            const uint8_t s = slotToSymbol[slot];
+            out[i] = s;
+
+            x = table->freq[s] * (x >> probBits) + slot - table->cum[s];
+            while (x < ransLow)
+            {
+                if (in == end)
+                {
+                    return false;
+                }
+                x = (x << 8) | *in++;
+            }
+        }
+
+        return true;
+    }
+
+    uint8_t* ChunkPacked(const FrameCodec* codec, const int chunk)
+    {
+        return codec->chunkScratch + chunk * (codec->chunkPackedCapacity + codec->chunkCodedCapacity);
+    }
+
+    uint8_t* ChunkCoded(const FrameCodec* codec, const int chunk)
+    {
+        return ChunkPacked(codec, chunk) + codec->chunkPackedCapacity;
+    }
+
+    size_t FrameHeaderSize(const int numChunks)
+    {
+        return sizeof(uint32_t) * (2 + numChunks);
+    }
+
+    struct EncodeJob
+    {
+        FrameCodec* codec;
+        const Boid* boids;
+        bool keyframe;
+    };
+
+    void EncodeChunk(void* data, const int chunk, const int)
+    {
+        PROFILE_ZONE("EncodeChunk");
+
+        const EncodeJob* job = (const EncodeJob*)data;
+        FrameCodec* codec = job->codec;
+
+        const int first = chunk * boidsPerChunk;
+        const int last = (first + boidsPerChunk < codec->numBoids) ? first + boidsPerChunk : codec->numBoids;
+
+        const float invPositionScale = 1.0f / codec->positionScale;
+        const float invVelocityScale = 1.0f / codec->velocityScale;
+        const float velocityToPosition = codec->velocityScale / codec->positionScale;
+
+        uint8_t* packed = ChunkPacked(codec, chunk);
+        uint8_t* packedEnd = packed;
+
+        for (int i = first; i < last; i++)
+        {
+            const Boid& boid = job->boids[i];
+            int32_t* q = codec->current + i * valuesPerBoid;
+            const int32_t* p = codec->previous + i * valuesPerBoid;
+
+            q[0] = Quantize(boid.velocity.x, invVelocityScale);
+            q[1] = Quantize(boid.velocity.y, invVelocityScale);
+            q[2] = Quantize(boid.velocity.z, invVelocityScale);
+            q[3] = Quantize(boid.position.x, invPositionScale);
+            q[4] = Quantize(boid.position.y, invPositionScale);
+            q[5] = Quantize(boid.position.z, invPositionScale);
+
+            for (int c = 0; c < 3; c++)
+            {
+                const int32_t prediction = job->keyframe ? 0 : p[c];
+                packedEnd = WriteVarint(packedEnd, ZigZag(q[c] - prediction));
+            }
+
+            for (int c = 0; c < 3; c++)
+            {
+                const int32_t prediction = job->keyframe ? 0 :
+                    p[3 + c] + (int32_t)std::lrintf((float)q[c] * velocityToPosition);
+                packedEnd = WriteVarint(packedEnd, ZigZag(q[3 + c] - prediction));
+            }
+        }
+
+        const uint32_t packedSize = (uint32_t)(packedEnd - packed);
+
+        uint32_t counts[256] = {};
+        for (uint32_t i = 0; i < packedSize; i++)
+        {
+            counts[packed[i]]++;
+        }
+
+        SymbolTable table = {};
+        if (packedSize > 0)
+        {
+            BuildSymbolTable(counts, packedSize, &table);
+        }
+
+        // Chunk layout: packed size, symbol count, (symbol, frequency) pairs, coded size, coded bytes.
+        uint8_t* coded = ChunkCoded(codec, chunk);
+        uint8_t* out = coded;
+
+        Store32(out, packedSize);
+        out += 4;
+
+        uint8_t* numSymbolsOut = out;
+        out += 2;
+
+        uint16_t numSymbols = 0;
+        for (int s = 0; s < 256; s++)
+        {
+            if (table.freq[s] > 0)
+            {
+                out[0] = (uint8_t)s;
+                out[1] = (uint8_t)table.freq[s];
+                out[2] = (uint8_t)(table.freq[s] >> 8);
+                out += 3;
+                numSymbols++;
+            }
+        }
+        numSymbolsOut[0] = (uint8_t)numSymbols;
+        numSymbolsOut[1] = (uint8_t)(numSymbols >> 8);
+
+        uint8_t* codedEnd = coded + codec->chunkCodedCapacity;
+        const uint8_t* payload = (packedSize > 0) ? RansEncode(packed, packedSize, &table, codedEnd) : codedEnd;
+        const uint32_t payloadSize = (uint32_t)(codedEnd - payload);
+
+        Store32(out, payloadSize);
+        out += 4;
+
+        std::memmove(out, payload, payloadSize);
+        out += payloadSize;
+
+        codec->chunkSizes[chunk] = (uint32_t)(out - coded);
+    }
+
+    struct DecodeJob
+    {
+        FrameCodec* codec;
+        const uint8_t* in;
+        Boid* boids;
+        bool keyframe;
+        std::atomic<bool> failed;
+    };
+
+    bool DecodeChunkInto(DecodeJob* job, const int chunk)
+    {
+        FrameCodec* codec = job->codec;
+
+        const uint8_t* in = job->in + codec->chunkOffsets[chunk];
+        const uint8_t* end = in + codec->chunkSizes[chunk];
+
+        if (end - in < 6)
+        {
+            return false;
+        }
+
+        const uint32_t packedSize = Load32(in);
+        const uint32_t numSymbols = (uint32_t)in[4] | ((uint32_t)in[5] << 8);
+        in += 6;
+
+        if (packedSize > codec->chunkPackedCapacity || numSymbols > 256 || (size_t)(end - in) < numSymbols * 3 + 4)
+        {
+            return false;
+        }
+
+        SymbolTable table = {};
+        uint32_t total = 0;
+        for (uint32_t i = 0; i < numSymbols; i++)
+        {
+            const uint32_t f = (uint32_t)in[1] | ((uint32_t)in[2] << 8);
+            table.freq[in[0]] = f;
+            total += f;
+            in += 3;
+        }
+
+        if (packedSize > 0 && total != probScale)
+        {
+            return false;
+        }
+
+        table.cum[0] = 0;
+        for (int s = 0; s < 256; s++)
+        {
+            table.cum[s + 1] = table.cum[s] + table.freq[s];
+        }
+
+        const uint32_t payloadSize = Load32(in);
+        in += 4;
+
+        if ((size_t)(end - in) < payloadSize)
+        {
+            return false;
+        }
+
+        uint8_t* packed = ChunkPacked(codec, chunk);
+        if (packedSize > 0 && !RansDecode(in, in + payloadSize, &table, packed, packedSize))
+        {
+            return false;
+        }
+
+        const int first = chunk * boidsPerChunk;
+        const int last = (first + boidsPerChunk < codec->numBoids) ? first + boidsPerChunk : codec->numBoids;
+        const float velocityToPosition = codec->velocityScale / codec->positionScale;
+
+        const uint8_t* packedIn = packed;
+        const uint8_t* packedEnd = packed + packedSize;
+
+        for (int i = first; i < last; i++)
+        {
+            int32_t* q = codec->current + i * valuesPerBoid;
+            const int32_t* p = codec->previous + i * valuesPerBoid;
+
+            for (int c = 0; c < valuesPerBoid; c++)
+            {
+                uint32_t v = 0;
+                packedIn = ReadVarint(packedIn, packedEnd, &v);
+                if (!packedIn)
+                {
+                    return false;
+                }
+
+                int32_t prediction = 0;
+                if (!job->keyframe)
+                {
+                    prediction = (c < 3) ? p[c] : p[c] + (int32_t)std::lrintf((float)q[c - 3] * velocityToPosition);
+                }
+
+                q[c] = prediction + UnZigZag(v);
+            }
+
+            Boid& boid = job->boids[i];
+            boid.velocity.x = q[0] * codec->velocityScale;
+            boid.velocity.y = q[1] * codec->velocityScale;
+            boid.velocity.z = q[2] * codec->velocityScale;
+            boid.position.x = q[3] * codec->positionScale;
+            boid.position.y = q[4] * codec->positionScale;
+            boid.position.z = q[5] * codec->positionScale;
+        }
+
+        return true;
+    }
+
+    void DecodeChunk(void* data, const int chunk, const int)
+    {
+        PROFILE_ZONE("DecodeChunk");
+
+        DecodeJob* job = (DecodeJob*)data;
+        if (!DecodeChunkInto(job, chunk))
+        {
+            job->failed.store(true, std::memory_order_relaxed);
+        }
+    }
+
+    void RunChunks(FrameCodec* codec, JobCallback* callback, void* job)
+    {
+        if (codec->jobs)
+        {
+            RunJobs(codec->jobs, callback, job, codec->numChunks);
+            return;
+        }
+
+        for (int chunk = 0; chunk < codec->numChunks; chunk++)
+        {
+            callback(job, chunk, 0);
+        }
+    }
+
+    void SwapFrames(FrameCodec* codec)
+    {
+        int32_t* temp = codec->previous;
+        codec->previous = codec->current;
+        codec->current = temp;
+        codec->hasPrevious = true;
+    }
+}
+
+bool InitFrameCodec(FrameCodec* codec, const int numBoids, const float worldSize, const float maxSpeed,
+    JobSystem* jobs)
+{
+    *codec = {};
+
+    codec->numBoids = numBoids;
+    codec->numChunks = (numBoids + boidsPerChunk - 1) / boidsPerChunk;
+    // Leave headroom for boids that drift past the walls before they are turned around.
+    codec->positionScale = (2.0f * worldSize) / quantizedRange;
+    codec->velocityScale = maxSpeed / quantizedRange;
+    codec->jobs = jobs;
+
+    codec->chunkPackedCapacity = (size_t)boidsPerChunk * valuesPerBoid * maxVarintSize;
+    // An order-0 coder never spends more than probBits bits on a symbol.
+    codec->chunkCodedCapacity = chunkHeaderSize + (codec->chunkPackedCapacity * probBits) / 8 + 16;
+
+    const size_t framesSize = sizeof(int32_t) * valuesPerBoid * numBoids;
+    const size_t scratchSize = (codec->chunkPackedCapacity + codec->chunkCodedCapacity) * codec->numChunks;
+    const size_t chunkOffsetsSize = sizeof(size_t) * codec->numChunks;
+    const size_t chunkSizesSize = sizeof(uint32_t) * codec->numChunks;
+
+    codec->memorySize = framesSize * 2 + scratchSize + chunkOffsetsSize + chunkSizesSize + 1;
+    codec->memory = PlatformAllocateMemory(codec->memorySize);
+
+    if (!codec->memory)
+    {
+        return false;
+    }
+
+    uint8_t* memory = (uint8_t*)codec->memory;
+    codec->previous = (int32_t*)memory;
+    codec->current = (int32_t*)(memory + framesSize);
+    codec->chunkScratch = memory + framesSize * 2;
+    codec->chunkOffsets = (size_t*)(codec->chunkScratch + scratchSize);
+    codec->chunkSizes = (uint32_t*)(codec->chunkScratch + scratchSize + chunkOffsetsSize);
+
+    return true;
+}
+
+void FreeFrameCodec(FrameCodec* codec)
+{
+    if (codec->memory)
+    {
+        PlatformFreeMemory(codec->memory, codec->memorySize);
+    }
+
+    *codec = {};
+}
+
+size_t MaxEncodedFrameSize(const FrameCodec* codec)
+{
+    return FrameHeaderSize(codec->numChunks) + codec->chunkCodedCapacity * codec->numChunks;
+}
+
+size_t EncodeFrame(FrameCodec* codec, const Boid* boids, const bool keyframe, uint8_t* out)
+{
+    EncodeJob job = {};
+    job.codec = codec;
+    job.boids = boids;
+    job.keyframe = keyframe || !codec->hasPrevious;
+
+    RunChunks(codec, EncodeChunk, &job);
+
+    // Frame layout: flags, chunk count, chunk sizes, then the chunks back to back.
+    Store32(out, job.keyframe ? frameFlagKeyframe : 0);
+    Store32(out + 4, (uint32_t)codec->numChunks);
+
+    uint8_t* chunkOut = out + FrameHeaderSize(codec->numChunks);
+    for (int chunk = 0; chunk < codec->numChunks; chunk++)
+    {
+        const uint32_t chunkSize = codec->chunkSizes[chunk];
+        Store32(out + 8 + chunk * 4, chunkSize);
+        std::memcpy(chunkOut, ChunkCoded(codec, chunk), chunkSize);
+        chunkOut += chunkSize;
+    }
+
+    SwapFrames(codec);
+
+    return (size_t)(chunkOut - out);
+}
+
+bool DecodeFrame(FrameCodec* codec, const uint8_t* in, const size_t size, Boid* boids)
+{
+    const size_t headerSize = FrameHeaderSize(codec->numChunks);
+    if (size < headerSize || Load32(in + 4) != (uint32_t)codec->numChunks)
+    {
+        return false;
+    }
+
+    const bool keyframe = (Load32(in) & frameFlagKeyframe) != 0;
+    if (!keyframe && !codec->hasPrevious)
+    {
+        return false;
+    }
+
+    size_t offset = headerSize;
+    for (int chunk = 0; chunk < codec->numChunks; chunk++)
+    {
+        codec->chunkSizes[chunk] = Load32(in + 8 + chunk * 4);
+        codec->chunkOffsets[chunk] = offset;
+        offset += codec->chunkSizes[chunk];
+    }
+
+    if (offset > size)
+    {
+        return false;
+    }
+
+    DecodeJob job = {};
+    job.codec = codec;
+    job.in = in;
+    job.boids = boids;
+    job.keyframe = keyframe;
+    job.failed = false;
+
+    RunChunks(codec, DecodeChunk, &job);
+
+    if (job.failed.load())
+    {
+        return false;
+    }
+
+    SwapFrames(codec);
+    return true;
+}
+
+bool IsKeyframe(const uint8_t* in, const size_t size)
+{
+    return size >= 4 && (Load32(in) & frameFlagKeyframe) != 0;
+}
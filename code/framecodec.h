@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "jobs.h"
+
+class Boid;
+
+// Lossy compression for whole-flock frames:
+//  1. Positions are quantized to 16 bits relative to the world size and velocities to 16 bits relative to the
+//     maximum speed.
+//  2. Each value is predicted from the previous frame: velocities from the previous velocity, positions from the
+//     previous position moved by the new velocity (which is exactly how the simulation integrates), and only the
+//     residual is kept. Keyframes predict from zero so they can be decoded on their own.
+//  3. Residuals are zigzag/varint packed into bytes and those bytes are entropy coded with an order-0 rANS coder.
+// The flock is split into fixed-size chunks that are coded independently, so encoding and decoding both run in
+// parallel on a job system, or one chunk after another on the calling thread when there is none.
+struct FrameCodec
+{
+    int numBoids;
+    int numChunks;
+    float positionScale;
+    float velocityScale;
+
+    // Quantized previous and current frames, six values per boid (velocity xyz, position xyz).
+    int32_t* previous;
+    int32_t* current;
+    bool hasPrevious;
+
+    // Per-chunk working memory: the packed residual bytes and the entropy coded output.
+    uint8_t* chunkScratch;
+    size_t chunkPackedCapacity;
+    size_t chunkCodedCapacity;
+    size_t* chunkOffsets;
+    uint32_t* chunkSizes;
+
+    size_t memorySize;
+    void* memory;
+
+    JobSystem* jobs; // May be null.
+};
+
+bool InitFrameCodec(FrameCodec* codec, const int numBoids, const float worldSize, const float maxSpeed,
+    JobSystem* jobs);
+void FreeFrameCodec(FrameCodec* codec);
+// Upper bound on the size of one encoded frame.
+size_t MaxEncodedFrameSize(const FrameCodec* codec);
+// Encodes a frame into `out`, which must hold MaxEncodedFrameSize() bytes, and returns the number of bytes written.
+// Frames have to be encoded in order; the first one is always a keyframe.
+size_t EncodeFrame(FrameCodec* codec, const Boid* boids, const bool keyframe, uint8_t* out);
+// Decodes a frame. A delta frame can only be decoded directly after the frame it was encoded against.
+bool DecodeFrame(FrameCodec* codec, const uint8_t* in, const size_t size, Boid* boids);
+bool IsKeyframe(const uint8_t* in, const size_t size);
@@ -1,16 +1,114 @@
 #pragma once
 
+#include <cstdint>
+
+#include "balance.h"
+#include "grid.h"
+
 class Boid;
+struct JobSystem;
+
+// Bits of SimParams::rules.
+enum SimRule : uint32_t
+{
+    SIM_RULE_ALIGN = 1 << 0,
+    SIM_RULE_COHERE = 1 << 1,
+    SIM_RULE_SEPARATE = 1 << 2,
+
+    SIM_RULE_ALL = SIM_RULE_ALIGN | SIM_RULE_COHERE | SIM_RULE_SEPARATE
+};
+
+// Which boids count as neighbours for alignment and cohesion: every boid within alignRadius and cohereRadius, or the
+// topologicalNeighbors nearest ones however far away they are. Separation always uses separationDistance.
+enum NeighborMode : uint32_t
+{
+    NEIGHBOR_MODE_METRIC,
+    NEIGHBOR_MODE_TOPOLOGICAL,
+
+    NEIGHBOR_MODE_COUNT
+};
+
+// What happens at the walls of the world: boids steer away from them, come back in at the opposite side, or are
+// stopped at the wall and bounce off it.
+enum BoundaryMode : uint32_t
+{
+    BOUNDARY_MODE_STEER,
+    BOUNDARY_MODE_WRAP,
+    BOUNDARY_MODE_CLAMP,
+
+    BOUNDARY_MODE_COUNT
+};
+
+constexpr int maxTopologicalNeighbors = 32;
+
+// The tunable rules of the flock. They can be set from a config file or the command line and edited while running
+// (see params.h). The derived values are what the hot loops read, so a parameter costs nothing per pair of boids;
+// call UpdateDerivedSimParams() after changing any of the tunables.
+struct SimParams
+{
+    // Each rule looks at the boids within its own radius, and its steering force is scaled by its weight before the
+    // three are added up. Weights of 1 give the classic equal mix.
+    float alignRadius; // Boids match the velocity of others within this distance.
+    float cohereRadius; // Boids move towards the centre of others within this distance.
+    float separationDistance; // Boids steer away from others within this distance.
+    float alignWeight;
+    float cohereWeight;
+    float separateWeight;
+    float maxForce; // Largest steering change per rule per tick.
+    float maxSpeed; // In world units per tick.
+    float boundaryThreshold; // Distance from the walls at which boids start turning back.
+
+    uint32_t rules; // SimRule bits of the rules that are applied.
+    NeighborMode neighborMode;
+    int topologicalNeighbors; // 1 to maxTopologicalNeighbors.
+    BoundaryMode boundaryMode;
+
+    float alignRadiusSquared;
+    float cohereRadiusSquared;
+    float separationDistanceSquared;
+    float inverseBoundaryThreshold;
+};
 
 struct GameState
 {
     int numBoids;
+    int maxBoids; // Capacity of the boids arrays in GameMemory.
     float worldSize;
     Boid* boids;
+    SimParams params;
+
+    // Brought up to date at the start of every tick by moving only the boids that changed cell, and rebuilt from
+    // scratch when more than gridRebuildFraction of them did or the flock size or cells changed (see grid.h). Lives
+    // in GameMemory's transient storage.
+    SpatialGrid grid;
+    // The threads each tick's task graph is spread over (see UpdateBoids). Null runs the whole tick on the calling
+    // thread.
+    JobSystem* jobs;
+    // Where each thread's share of the steering pass starts, moved towards equal cost as the flock moves (see
+    // balance.h). Reset whenever the number of threads changes.
+    LoadBalancer steerBalancer;
+
+    // The flock's triangles, built by the render prep node for DrawBoids, in transient storage. Null when nothing is
+    // drawn.
+    float* renderVertices;
+    int numRenderBoids;
+
+    // Deterministic mode. Every tick writes the new state into `nextBoids`, then the two buffers are swapped.
+    // Neighbours are always visited in the same order, cell by cell and by index within a cell, so each boid's sums
+    // are reduced in the same order no matter how the boids are split across threads or lanes. `stateHash` is
+    // recomputed every tick so two runs (or two builds) can be compared tick by tick.
+    bool deterministic;
+    Boid* nextBoids;
+    uint64_t tick;
+    uint64_t stateHash;
 };
 
+// Everything the simulation needs, reserved once at startup (see gamememory.h). Permanent storage holds the
+// GameState and the flock; transient storage holds what is rebuilt from them every tick.
 struct GameMemory
 {
     size_t permanentStorageSize;
     void* permanentStorage;
+    size_t transientStorageSize;
+    void* transientStorage;
 };
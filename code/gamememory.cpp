@@ -0,0 +1,128 @@
+#include "gamememory.h"
+
+#include <cstdint>
+#include <cstdio>
+
+#include "boid.h"
+#include "grid.h"
+#include "platform.h"
+
+namespace
+{
+    constexpr size_t storageAlignment = 64;
+
+    size_t AlignUp(const size_t size, const size_t alignment)
+    {
+        return (size + alignment - 1) & ~(alignment - 1);
+    }
+
+    double Megabytes(const size_t size)
+    {
+        return size / (1024.0 * 1024.0);
+    }
+}
+
+MemoryBudget PlanGameMemory(const int numBoids, const float worldLimit, const SimParams* params, const bool render)
+{
+    MemoryBudget budget = {};
+    budget.numBoids = numBoids;
+
+    // Room for the cells metric neighbours need with every rule enabled, whatever the starting mode, so switching
+    // rules or modes while running never leaves the grid too coarse. Shrinking the radii below their starting values
+    // asks for more cells than this, and then the cells just stay wider.
+    SimParams gridParams = *params;
+    gridParams.rules = SIM_RULE_ALL;
+    gridParams.neighborMode = NEIGHBOR_MODE_METRIC;
+
+    const int maxCells = maxGridCellsPerAxis * maxGridCellsPerAxis * maxGridCellsPerAxis;
+    const int cellsPerAxis = GetGridCellsPerAxis(worldLimit, GetGridCellSize(&gridParams, worldLimit), maxCells);
+    budget.gridCellsPerAxis = cellsPerAxis;
+    budget.maxGridCells = cellsPerAxis * cellsPerAxis * cellsPerAxis;
+
+    budget.gameState = sizeof(GameState);
+    budget.boids = sizeof(Boid) * (size_t)numBoids * 2;
+
+    // The same pieces GetSpatialGridMemorySize adds up.
+    budget.gridCells = sizeof(int) * ((size_t)budget.maxGridCells + 1) * 2;
+    budget.gridSortedBoids = sizeof(Boid) * (size_t)numBoids;
+    budget.gridIndices = sizeof(int) * (size_t)numBoids * 3;
+    budget.gridMovers = sizeof(uint64_t) * 2 * (size_t)GetMaxGridMovers(numBoids);
+    budget.steeringScratch = sizeof(Vector3) * (size_t)numBoids;
+    budget.renderVertices = render ? sizeof(float) * 3 * boidVertexCount * (size_t)numBoids : 0;
+
+    budget.permanentStorageSize = AlignUp(budget.gameState + budget.boids, storageAlignment);
+    budget.transientStorageSize = AlignUp(GetSpatialGridMemorySize(numBoids, budget.maxGridCells), storageAlignment) +
+        AlignUp(budget.renderVertices, storageAlignment);
+
+    return budget;
+}
+
+void PrintMemoryBudget(const MemoryBudget* budget)
+{
+    std::printf("Memory budget for %d boids:\n", budget->numBoids);
+    std::printf("  game state        %10.2f MB\n", Megabytes(budget->gameState));
+    std::printf("  boids (x2)        %10.2f MB\n", Megabytes(budget->boids));
+    std::printf("  grid cells        %10.2f MB  (%d^3 cells)\n", Megabytes(budget->gridCells),
+        budget->gridCellsPerAxis);
+    std::printf("  grid sorted boids %10.2f MB\n", Megabytes(budget->gridSortedBoids));
+    std::printf("  grid indices      %10.2f MB\n", Megabytes(budget->gridIndices));
+    std::printf("  grid movers       %10.2f MB\n", Megabytes(budget->gridMovers));
+    std::printf("  steering scratch  %10.2f MB\n", Megabytes(budget->steeringScratch));
+    if (budget->renderVertices > 0)
+    {
+        std::printf("  render vertices   %10.2f MB\n", Megabytes(budget->renderVertices));
+    }
+    std::printf("  total             %10.2f MB\n",
+        Megabytes(budget->permanentStorageSize + budget->transientStorageSize));
+}
+
+GameState* AllocateGameMemory(const MemoryBudget* budget, GameMemory* gameMemory)
+{
+    const size_t totalSize = budget->permanentStorageSize + budget->transientStorageSize;
+
+    void* memory = PlatformAllocateMemory(totalSize);
+    if (!memory)
+    {
+        return nullptr;
+    }
+
+    gameMemory->permanentStorageSize = budget->permanentStorageSize;
+    gameMemory->permanentStorage = memory;
+    gameMemory->transientStorageSize = budget->transientStorageSize;
+    gameMemory->transientStorage = (uint8_t*)memory + budget->permanentStorageSize;
+
+    // We assign the boids array pointer to point to just after the gameState object, followed by the second buffer
+    // that deterministic mode writes each new tick into. The grid gets the transient storage, followed by the render
+    // vertices. So after this our memory layout will basically be:
+    // -------------------------------------------------------------------------------------------------------------
+    // | gameState object | gameState->boids | gameState->nextBoids | gameState->grid arrays | renderVertices |
+    // -------------------------------------------------------------------------------------------------------------
+    const int numBoids = budget->numBoids;
+
+    GameState* gameState = (GameState*)gameMemory->permanentStorage;
+    gameState->numBoids = numBoids;
+    gameState->maxBoids = numBoids;
+    gameState->boids = (Boid*)((uint8_t*)gameMemory->permanentStorage + sizeof(GameState));
+    gameState->nextBoids = gameState->boids + numBoids;
+
+    InitSpatialGrid(&gameState->grid, gameMemory->transientStorage, numBoids, budget->maxGridCells);
+
+    if (budget->renderVertices > 0)
+    {
+        const size_t gridSize = AlignUp(GetSpatialGridMemorySize(numBoids, budget->maxGridCells), storageAlignment);
+        gameState->renderVertices = (float*)((uint8_t*)gameMemory->transientStorage + gridSize);
+    }
+
+    return gameState;
+}
+
+void FreeGameMemory(GameMemory* gameMemory)
+{
+    if (gameMemory->permanentStorage)
+    {
+        PlatformFreeMemory(gameMemory->permanentStorage,
+            gameMemory->permanentStorageSize + gameMemory->transientStorageSize);
+    }
+
+    *gameMemory = {};
+}
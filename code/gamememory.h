@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstddef>
+
+#include "game.h"
+
+// How much memory a flock needs, worked out from the boid count and the index structures before anything is
+// allocated, so a flock that doesn't fit is refused at startup instead of failing partway through a run.
+//
+// Permanent storage holds the GameState and the two boid buffers. Transient storage holds everything that is
+// rebuilt or updated from them every tick: the spatial grid's cell tables, its sorted copy of the flock, its indices
+// and its list of movers, and the steering kernel's scratch, and the flock's triangles when it is drawn.
+struct MemoryBudget
+{
+    int numBoids;
+    int gridCellsPerAxis;
+    int maxGridCells;
+
+    size_t gameState;
+    size_t boids; // Both buffers.
+    size_t gridCells;
+    size_t gridSortedBoids;
+    size_t gridIndices;
+    size_t gridMovers;
+    size_t steeringScratch;
+    size_t renderVertices; // Zero when nothing is drawn.
+
+    size_t permanentStorageSize;
+    size_t transientStorageSize;
+};
+
+MemoryBudget PlanGameMemory(const int numBoids, const float worldLimit, const SimParams* params, const bool render);
+void PrintMemoryBudget(const MemoryBudget* budget);
+
+// Reserves the whole budget in one allocation and sets up an empty GameState in it: the boid buffers and the grid
+// are in place, everything else is zero. Returns null if the memory can't be reserved.
+GameState* AllocateGameMemory(const MemoryBudget* budget, GameMemory* gameMemory);
+void FreeGameMemory(GameMemory* gameMemory);
@@ -0,0 +1,401 @@
+#include "grid.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <utility>
+
+#include "boid.h"
+#include "profiler.h"
+
+namespace
+{
+    struct GridLayout
+    {
+        size_t boidsSize;
+        size_t moverKeysSize;
+        size_t forcesSize;
+        size_t cellStartSize;
+        size_t indicesSize;
+    };
+
+    GridLayout GetGridLayout(const int maxBoids, const int maxCells)
+    {
+        const size_t maxMovers = (size_t)GetMaxGridMovers(maxBoids);
+
+        GridLayout layout = {};
+        layout.boidsSize = sizeof(Boid) * (size_t)maxBoids;
+        layout.moverKeysSize = sizeof(uint64_t) * maxMovers;
+        layout.forcesSize = sizeof(Vector3) * (size_t)maxBoids;
+        layout.cellStartSize = sizeof(int) * ((size_t)maxCells + 1);
+        layout.indicesSize = sizeof(int) * (size_t)maxBoids;
+
+        return layout;
+    }
+}
+
+int GetMaxGridMovers(const int maxBoids)
+{
+    return (int)((double)maxBoids * gridRebuildFraction);
+}
+
+size_t GetSpatialGridMemorySize(const int maxBoids, const int maxCells)
+{
+    const GridLayout layout = GetGridLayout(maxBoids, maxCells);
+    return layout.boidsSize + layout.moverKeysSize * 2 + layout.forcesSize + layout.cellStartSize * 2 +
+        layout.indicesSize * 3;
+}
+
+int GetGridCellsPerAxis(const float worldLimit, const float minCellSize, const int maxCells)
+{
+    const float worldSize = 2.0f * worldLimit;
+    int cellsPerAxis = (minCellSize > 0.0f) ? (int)std::floor(worldSize / minCellSize) : 1;
+    cellsPerAxis = (cellsPerAxis > maxGridCellsPerAxis) ? maxGridCellsPerAxis : cellsPerAxis;
+
+    while (cellsPerAxis > 1 && cellsPerAxis * cellsPerAxis * cellsPerAxis > maxCells)
+    {
+        cellsPerAxis--;
+    }
+
+    return (cellsPerAxis < 1) ? 1 : cellsPerAxis;
+}
+
+void InitSpatialGrid(SpatialGrid* grid, void* memory, const int maxBoids, const int maxCells)
+{
+    const GridLayout layout = GetGridLayout(maxBoids, maxCells);
+
+    *grid = {};
+
+    // Boids, then the mover keys, then forces, so each keeps the alignment it needs.
+    uint8_t* bytes = (uint8_t*)memory;
+    grid->sortedBoids = (Boid*)bytes;
+    bytes += layout.boidsSize;
+    grid->moverKeys = (uint64_t*)bytes;
+    grid->moverFromKeys = (uint64_t*)(bytes + layout.moverKeysSize);
+    bytes += layout.moverKeysSize * 2;
+    grid->boundaryForces = (Vector3*)bytes;
+    bytes += layout.forcesSize;
+    grid->cellStart = (int*)bytes;
+    grid->previousCellStart = (int*)(bytes + layout.cellStartSize);
+    bytes += layout.cellStartSize * 2;
+    grid->sortedIndices = (int*)bytes;
+    grid->previousSortedIndices = (int*)(bytes + layout.indicesSize);
+    grid->boidCells = (int*)(bytes + layout.indicesSize * 2);
+
+    grid->rebuildFraction = gridRebuildFraction;
+    grid->maxMovers = GetMaxGridMovers(maxBoids);
+    grid->maxBoids = maxBoids;
+    grid->maxCells = maxCells;
+}
+
+bool BeginSpatialGrid(SpatialGrid* grid, const int numBoids, const float worldLimit, const float minCellSize)
+{
+    if (numBoids > grid->maxBoids || grid->maxCells < 1)
+    {
+        grid->built = false;
+        return false;
+    }
+
+    const float worldSize = 2.0f * worldLimit;
+    const int cellsPerAxis = GetGridCellsPerAxis(worldLimit, minCellSize, grid->maxCells);
+
+    grid->worldLimit = worldLimit;
+    grid->cellSize = worldSize / cellsPerAxis;
+    grid->inverseCellSize = cellsPerAxis / worldSize;
+    grid->cellsPerAxis = cellsPerAxis;
+    grid->numCells = cellsPerAxis * cellsPerAxis * cellsPerAxis;
+    grid->numBoids = numBoids;
+
+    // The same cells over the same world, so every cell index still stands for the same place.
+    grid->incremental = grid->built && grid->rebuildFraction > 0.0f && grid->builtBoids == numBoids &&
+        grid->builtCellSize == grid->cellSize && grid->builtWorldLimit == worldLimit;
+    grid->merging = false;
+    grid->numMovers = 0;
+    grid->maxCellBoids = 0;
+
+    return true;
+}
+
+void FindSpatialGridCells(SpatialGrid* grid, const Boid* boids, const int first, const int last)
+{
+    int* boidCells = grid->boidCells;
+
+    if (!grid->incremental)
+    {
+        for (int i = first; i < last; i++)
+        {
+            const Vector3 position = boids[i].position;
+            boidCells[i] = GetGridCellIndex(grid,
+                GetGridCellCoordinate(grid, position.x),
+                GetGridCellCoordinate(grid, position.y),
+                GetGridCellCoordinate(grid, position.z));
+        }
+
+        return;
+    }
+
+    // The movers are gathered a chunk at a time, then given room in the shared list with one atomic add per chunk, so
+    // any number of ranges can be worked on at once. Where each chunk lands depends on timing, but SortSpatialGrid
+    // sorts them.
+    constexpr int chunkSize = 256;
+    uint64_t keys[chunkSize];
+    uint64_t fromKeys[chunkSize];
+
+    for (int chunk = first; chunk < last; chunk += chunkSize)
+    {
+        const int chunkEnd = (last - chunk < chunkSize) ? last : chunk + chunkSize;
+        int numMovers = 0;
+
+        for (int i = chunk; i < chunkEnd; i++)
+        {
+            const Vector3 position = boids[i].position;
+            const int cell = GetGridCellIndex(grid,
+                GetGridCellCoordinate(grid, position.x),
+                GetGridCellCoordinate(grid, position.y),
+                GetGridCellCoordinate(grid, position.z));
+
+            if (cell != boidCells[i])
+            {
+                keys[numMovers] = ((uint64_t)cell << 32) | (uint32_t)i;
+                fromKeys[numMovers] = ((uint64_t)boidCells[i] << 32) | (uint32_t)i;
+                numMovers++;
+                boidCells[i] = cell;
+            }
+        }
+
+        if (numMovers == 0)
+        {
+            continue;
+        }
+
+        // Past the room for them the movers are only counted, since the grid will be rebuilt anyway.
+        const int at = std::atomic_ref<int>(grid->numMovers).fetch_add(numMovers, std::memory_order_relaxed);
+        const int room = grid->maxMovers - at;
+        const int numStored = (numMovers < room) ? numMovers : room;
+        if (numStored <= 0)
+        {
+            continue;
+        }
+
+        std::memcpy(grid->moverKeys + at, keys, sizeof(uint64_t) * numStored);
+        std::memcpy(grid->moverFromKeys + at, fromKeys, sizeof(uint64_t) * numStored);
+    }
+}
+
+namespace
+{
+    void RebuildSpatialGrid(SpatialGrid* grid, const Boid* boids)
+    {
+        const int numBoids = grid->numBoids;
+        const int numCells = grid->numCells;
+        int* cellStart = grid->cellStart;
+        const int* boidCells = grid->boidCells;
+
+        for (int c = 0; c <= numCells; c++)
+        {
+            cellStart[c] = 0;
+        }
+
+        // Count the boids in each cell, shifted up by one so the prefix sum below turns the counts into start offsets.
+        for (int i = 0; i < numBoids; i++)
+        {
+            cellStart[boidCells[i] + 1]++;
+        }
+
+        int maxCellBoids = 0;
+        for (int c = 0; c < numCells; c++)
+        {
+            maxCellBoids = (cellStart[c + 1] > maxCellBoids) ? cellStart[c + 1] : maxCellBoids;
+            cellStart[c + 1] += cellStart[c];
+        }
+        grid->maxCellBoids = maxCellBoids;
+
+        // Scatter in index order, using the start of each cell as its write cursor and moving it along. This leaves
+        // every cellStart[c] at the start of cell c + 1, which is then shifted back down.
+        int* sortedIndices = grid->sortedIndices;
+        Boid* sortedBoids = grid->sortedBoids;
+
+        for (int i = 0; i < numBoids; i++)
+        {
+            const int slot = cellStart[boidCells[i]]++;
+            sortedIndices[slot] = i;
+            sortedBoids[slot] = boids[i];
+        }
+
+        for (int c = numCells; c > 0; c--)
+        {
+            cellStart[c] = cellStart[c - 1];
+        }
+        cellStart[0] = 0;
+    }
+
+    // Works out where each cell starts from where it started last time: every cell starts later by the movers that
+    // entered the cells before it, and earlier by the ones that left them.
+    void ShiftSpatialGridCells(SpatialGrid* grid)
+    {
+        std::swap(grid->cellStart, grid->previousCellStart);
+        std::swap(grid->sortedIndices, grid->previousSortedIndices);
+
+        const int numMovers = grid->numMovers;
+        uint64_t* moverKeys = grid->moverKeys;
+        uint64_t* moverFromKeys = grid->moverFromKeys;
+        std::sort(moverKeys, moverKeys + numMovers);
+        std::sort(moverFromKeys, moverFromKeys + numMovers);
+
+        const int numCells = grid->numCells;
+        const int* previousCellStart = grid->previousCellStart;
+        int* cellStart = grid->cellStart;
+
+        int shift = 0;
+        int left = 0;
+        int entered = 0;
+        int maxCellBoids = 0;
+
+        // Most cells have no movers, and between two that do every cell moves by the same shift and keeps its count.
+        int c = 0;
+        for (;;)
+        {
+            const int nextLeft = (left < numMovers) ? (int)(moverFromKeys[left] >> 32) : numCells;
+            const int nextEntered = (entered < numMovers) ? (int)(moverKeys[entered] >> 32) : numCells;
+            const int nextCell = (nextLeft < nextEntered) ? nextLeft : nextEntered;
+
+            for (; c < nextCell; c++)
+            {
+                cellStart[c] = previousCellStart[c] + shift;
+                const int count = previousCellStart[c + 1] - previousCellStart[c];
+                maxCellBoids = (count > maxCellBoids) ? count : maxCellBoids;
+            }
+
+            if (c == numCells)
+            {
+                break;
+            }
+
+            cellStart[c] = previousCellStart[c] + shift;
+
+            while (left < numMovers && (int)(moverFromKeys[left] >> 32) == c)
+            {
+                shift--;
+                left++;
+            }
+
+            while (entered < numMovers && (int)(moverKeys[entered] >> 32) == c)
+            {
+                shift++;
+                entered++;
+            }
+
+            const int count = previousCellStart[c + 1] + shift - cellStart[c];
+            maxCellBoids = (count > maxCellBoids) ? count : maxCellBoids;
+            c++;
+        }
+        cellStart[numCells] = grid->numBoids;
+
+        grid->maxCellBoids = maxCellBoids;
+        grid->merging = true;
+    }
+}
+
+void SortSpatialGrid(SpatialGrid* grid, const Boid* boids)
+{
+    PROFILE_ZONE("SortBoids");
+
+    const int maxMovers = (int)(grid->rebuildFraction * grid->numBoids);
+    if (grid->incremental && grid->numMovers <= maxMovers && grid->numMovers <= grid->maxMovers)
+    {
+        ShiftSpatialGridCells(grid);
+    }
+    else
+    {
+        RebuildSpatialGrid(grid, boids);
+    }
+
+    grid->built = true;
+    grid->builtBoids = grid->numBoids;
+    grid->builtCellSize = grid->cellSize;
+    grid->builtWorldLimit = grid->worldLimit;
+}
+
+void MergeSpatialGridCells(SpatialGrid* grid, const Boid* boids, const int firstSlot, const int lastSlot)
+{
+    if (!grid->merging || firstSlot >= lastSlot)
+    {
+        return;
+    }
+
+    const int numCells = grid->numCells;
+    const int* cellStart = grid->cellStart;
+    const int* previousSortedIndices = grid->previousSortedIndices;
+    const int* boidCells = grid->boidCells;
+    const uint64_t* moverKeys = grid->moverKeys;
+    const uint64_t* moverFromKeys = grid->moverFromKeys;
+    const int numMovers = grid->numMovers;
+    int* sortedIndices = grid->sortedIndices;
+    Boid* sortedBoids = grid->sortedBoids;
+
+    // The cells that start in the range. Empty cells start at the same slot as the next one, so every cell with boids
+    // in it is in exactly one range.
+    const int firstCell = (int)(std::lower_bound(cellStart, cellStart + numCells, firstSlot) - cellStart);
+    const int lastCell = (int)(std::lower_bound(cellStart, cellStart + numCells, lastSlot) - cellStart);
+    const uint64_t firstKey = (uint64_t)firstCell << 32;
+
+    // Both the old slots and the arrivals are in cell, then index order, so the new slots are the two merged, less the
+    // departures. Those are in the same order as the old slots, so each is the next old slot of its boid to come up.
+    int slot = cellStart[firstCell];
+    const int endSlot = cellStart[lastCell];
+    int stayer = grid->previousCellStart[firstCell];
+    const int stayersEnd = grid->previousCellStart[lastCell];
+    int arrival = (int)(std::lower_bound(moverKeys, moverKeys + numMovers, firstKey) - moverKeys);
+    int departure = (int)(std::lower_bound(moverFromKeys, moverFromKeys + numMovers, firstKey) - moverFromKeys);
+
+    for (; slot < endSlot; slot++)
+    {
+        while (stayer < stayersEnd && departure < numMovers &&
+            (uint32_t)previousSortedIndices[stayer] == (uint32_t)moverFromKeys[departure])
+        {
+            stayer++;
+            departure++;
+        }
+
+        int index = 0;
+        if (stayer < stayersEnd)
+        {
+            index = previousSortedIndices[stayer];
+            const uint64_t stayerKey = ((uint64_t)boidCells[index] << 32) | (uint32_t)index;
+
+            if (arrival < numMovers && moverKeys[arrival] < stayerKey)
+            {
+                index = (int)(uint32_t)moverKeys[arrival++];
+            }
+            else
+            {
+                stayer++;
+            }
+        }
+        else
+        {
+            index = (int)(uint32_t)moverKeys[arrival++];
+        }
+
+        sortedIndices[slot] = index;
+        sortedBoids[slot] = boids[index];
+    }
+}
+
+bool BuildSpatialGrid(SpatialGrid* grid, const Boid* boids, const int numBoids, const float worldLimit,
+    const float minCellSize)
+{
+    PROFILE_ZONE("BuildSpatialGrid");
+
+    if (!BeginSpatialGrid(grid, numBoids, worldLimit, minCellSize))
+    {
+        return false;
+    }
+
+    FindSpatialGridCells(grid, boids, 0, numBoids);
+    SortSpatialGrid(grid, boids);
+    MergeSpatialGridCells(grid, boids, 0, numBoids);
+
+    return true;
+}
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "raylib.h"
+
+class Boid;
+
+// Uniform grid over the world cube for the neighbour search. Cells are at least as wide as the largest rule radius,
+// so every neighbour of a boid is in its own cell or one of the 26 around it.
+//
+// The grid is built with a counting sort: each boid's cell is computed, boids are counted per cell, a prefix sum gives
+// each cell's first slot, and the boids are then copied into `sortedBoids` cell by cell. The sort is stable, so within
+// a cell boids stay in index order and the layout depends only on the flock. Reading neighbours from the sorted copy
+// keeps each cell's boids next to each other in memory, and gives every boid in a tick the same view of the flock no
+// matter what order they are updated in.
+//
+// A boid moves a small part of a cell per tick, so from one tick to the next few change cell. When the flock size and
+// the cells are the same as last time, the grid is instead updated from the last build: finding the cells also collects
+// the movers, each cell's first slot is shifted by the movers that left and entered the cells before it, and each
+// cell's slots are then filled by merging the boids that stayed, still in index order, with the ones that arrived,
+// sorted by index. That gives exactly the layout the counting sort would, without its scattered writes, and the merge
+// can start at any cell, so it is split over threads. Once more than rebuildFraction of the flock has changed cell,
+// sorting the movers would cost more than it saves, and the grid is rebuilt from scratch.
+struct SpatialGrid
+{
+    float worldLimit; // Half the world size.
+    float cellSize;
+    float inverseCellSize;
+    int cellsPerAxis;
+    int numCells;
+    int numBoids;
+    int maxCellBoids; // The most boids in any one cell.
+
+    int* cellStart; // numCells + 1 entries; cell c holds sorted slots [cellStart[c], cellStart[c + 1]).
+    int* sortedIndices; // For each sorted slot, the boid's index in the flock.
+    Boid* sortedBoids;
+    int* boidCells; // The cell of each boid, in flock order, as of the last build.
+    Vector3* boundaryForces; // Scratch for the steering kernel: the wall avoidance force of each sorted slot.
+
+    // The incremental update. The previous build's cell starts and slots are kept in a second pair of arrays, which
+    // trade places with the current ones on every update.
+    float rebuildFraction; // 0 always rebuilds.
+    bool built; // The arrays hold a complete build, of builtBoids boids in cells of builtCellSize.
+    int builtBoids;
+    float builtCellSize;
+    float builtWorldLimit;
+    bool incremental; // This build updates the last one.
+    bool merging; // The slots are still to be filled by MergeSpatialGridCells.
+    int numMovers; // Boids whose cell changed, counted even past maxMovers.
+    int maxMovers;
+    // Cell << 32 | index of each mover, for the cell it entered and the one it left. SortSpatialGrid sorts both, which
+    // puts each cell's arrivals and departures together and in index order.
+    uint64_t* moverKeys;
+    uint64_t* moverFromKeys;
+    int* previousCellStart;
+    int* previousSortedIndices;
+
+    int maxBoids;
+    int maxCells;
+};
+
+// The fraction of the flock that can change cell before the grid is rebuilt from scratch rather than updated, and what
+// the room for the movers is sized for.
+constexpr float gridRebuildFraction = 0.1f;
+
+// Upper bound on cellsPerAxis, to keep the cell table a sensible size when the radii are tiny compared to the world.
+constexpr int maxGridCellsPerAxis = 256;
+
+// The grid doesn't allocate anything itself. Its arrays live in GameMemory's transient storage, sized up front for
+// the largest flock and cell count it will be built with.
+size_t GetSpatialGridMemorySize(const int maxBoids, const int maxCells);
+// How many movers there is room for, which is also the most an update can handle.
+int GetMaxGridMovers(const int maxBoids);
+// The number of cells along each axis for the given cell size: as many as fit without any being narrower than
+// minCellSize, but no more than maxCells in total. Fewer, wider cells are always correct, just slower.
+int GetGridCellsPerAxis(const float worldLimit, const float minCellSize, const int maxCells);
+// Points the grid's arrays into `memory`, which must hold GetSpatialGridMemorySize(maxBoids, maxCells) bytes.
+void InitSpatialGrid(SpatialGrid* grid, void* memory, const int maxBoids, const int maxCells);
+// Builds the grid for the given flock, updating the last build when it can. Returns false if the flock is larger than
+// the grid was made for.
+bool BuildSpatialGrid(SpatialGrid* grid, const Boid* boids, const int numBoids, const float worldLimit,
+    const float minCellSize);
+
+// The same build in steps, so finding the cells and filling the slots can be split over threads. BeginSpatialGrid
+// sizes the cells for the flock, fails like BuildSpatialGrid, and decides whether the last build can be updated;
+// FindSpatialGridCells then works out the cell of each boid in [first, last), and collects the movers, for any number
+// of ranges at once; once every boid has its cell, SortSpatialGrid either sorts the flock into them from scratch or
+// works out where each cell starts now; and MergeSpatialGridCells fills the slots of the cells that start in
+// [firstSlot, lastSlot) after an update, again for any number of ranges at once, and does nothing after a rebuild.
+bool BeginSpatialGrid(SpatialGrid* grid, const int numBoids, const float worldLimit, const float minCellSize);
+void FindSpatialGridCells(SpatialGrid* grid, const Boid* boids, const int first, const int last);
+void SortSpatialGrid(SpatialGrid* grid, const Boid* boids);
+void MergeSpatialGridCells(SpatialGrid* grid, const Boid* boids, const int firstSlot, const int lastSlot);
+
+// The cell coordinate along one axis. Positions outside the world (boids drift past the walls before turning back)
+// land in the edge cells.
+inline int GetGridCellCoordinate(const SpatialGrid* grid, const float position)
+{
+    const int cell = (int)((position + grid->worldLimit) * grid->inverseCellSize);
+    return (cell < 0) ? 0 : ((cell >= grid->cellsPerAxis) ? grid->cellsPerAxis - 1 : cell);
+}
+
+inline int GetGridCellIndex(const SpatialGrid* grid, const int x, const int y, const int z)
+{
+    return (z * grid->cellsPerAxis + y) * grid->cellsPerAxis + x;
+}
@@ -0,0 +1,147 @@
+#include "hud.h"
+
+#include "raylib.h"
+
+#include "metrics.h"
+#include "params.h"
+#include "perfcounters.h"
+
+namespace
+{
+    constexpr int fontSize = 10;
+    constexpr int lineHeight = 14;
+    constexpr int histogramWidth = metricWindowSize;
+    constexpr int histogramHeight = 24;
+
+    // A bar per sample in the rolling window, scaled to the largest one.
+    void DrawHistory(const MetricId id, const int x, const int y, const Color color)
+    {
+        double samples[metricWindowSize];
+        const int count = GetMetricHistory(id, samples);
+
+        double maxSample = 0.0;
+        for (int i = 0; i < count; i++)
+        {
+            maxSample = (samples[i] > maxSample) ? samples[i] : maxSample;
+        }
+
+        DrawRectangle(x, y, histogramWidth, histogramHeight, Fade(LIGHTGRAY, 0.5f));
+
+        if (maxSample <= 0.0)
+        {
+            return;
+        }
+
+        for (int i = 0; i < count; i++)
+        {
+            const int height = (int)(samples[i] / maxSample * histogramHeight);
+            DrawRectangle(x + (histogramWidth - count) + i, y + histogramHeight - height, 1, height, color);
+        }
+    }
+}
+
+void DrawPerformanceHud(const GameMemory* gameMemory, const int x, const int y)
+{
+    constexpr MetricId timings[] = { METRIC_SIM_TIME, METRIC_RENDER_PREP_TIME, METRIC_DRAW_TIME };
+    constexpr Color timingColors[] = { DARKBLUE, DARKGREEN, MAROON };
+    constexpr int numTimings = sizeof(timings) / sizeof(timings[0]);
+
+    const int width = histogramWidth + 20;
+    const bool showCounters = PerfCountersEnabled();
+    const int height = numTimings * (lineHeight + histogramHeight + 6) + (showCounters ? 5 : 4) * lineHeight + 16;
+
+    DrawRectangle(x, y, width, height, Fade(RAYWHITE, 0.85f));
+    DrawRectangleLines(x, y, width, height, GRAY);
+
+    int lineY = y + 8;
+
+    for (int i = 0; i < numTimings; i++)
+    {
+        const MetricSummary summary = SummarizeMetric(timings[i]);
+
+        DrawText(TextFormat("%-12s avg %6.2f  p50 %6.2f  p99 %6.2f ms",
+            GetMetricName(timings[i]), summary.average, summary.p50, summary.p99),
+            x + 10, lineY, fontSize, BLACK);
+        lineY += lineHeight;
+
+        DrawHistory(timings[i], x + 10, lineY, timingColors[i]);
+        lineY += histogramHeight + 6;
+    }
+
+    const MetricSummary neighborsMean = SummarizeMetric(METRIC_NEIGHBORS_MEAN);
+    const MetricSummary neighborsMax = SummarizeMetric(METRIC_NEIGHBORS_MAX);
+
+    DrawText(TextFormat("neighbors per boid  mean %.1f  max %.0f", neighborsMean.last, neighborsMax.last),
+        x + 10, lineY, fontSize, BLACK);
+    lineY += lineHeight;
+
+    const GameState* gameState = (const GameState*)gameMemory->permanentStorage;
+    const int cellsPerAxis = gameState->grid.cellsPerAxis;
+
+    DrawText(TextFormat("grid  %d^3 cells  max %.0f per cell  update %.2f ms",
+        cellsPerAxis, SummarizeMetric(METRIC_GRID_CELL_MAX).last, SummarizeMetric(METRIC_GRID_TIME).average),
+        x + 10, lineY, fontSize, BLACK);
+    lineY += lineHeight;
+
+    // Hardware counters of the steering stage, per boid so they compare across flock sizes.
+    if (showCounters)
+    {
+        const double numBoids = (gameState->numBoids > 0) ? gameState->numBoids : 1.0;
+
+        const double cycles = SummarizeMetric(METRIC_STEER_CYCLES).average;
+        const double instructions = SummarizeMetric(METRIC_STEER_INSTRUCTIONS).average;
+
+        DrawText(TextFormat("steer  IPC %.2f  per boid: L1D miss %.1f  LLC miss %.2f  br miss %.1f",
+            (cycles > 0.0) ? instructions / cycles : 0.0,
+            SummarizeMetric(METRIC_STEER_L1D_MISSES).average / numBoids,
+            SummarizeMetric(METRIC_STEER_LLC_MISSES).average / numBoids,
+            SummarizeMetric(METRIC_STEER_BRANCH_MISSES).average / numBoids),
+            x + 10, lineY, fontSize, BLACK);
+        lineY += lineHeight;
+    }
+
+    const MetricSummary memoryUsed = SummarizeMetric(METRIC_MEMORY_USED);
+
+    DrawText(TextFormat("GameMemory  %.2f MB used of %.2f MB",
+        memoryUsed.last / (1024.0 * 1024.0),
+        (gameMemory->permanentStorageSize + gameMemory->transientStorageSize) / (1024.0 * 1024.0)),
+        x + 10, lineY, fontSize, BLACK);
+}
+
+void DrawSimParamsPanel(const SimParams* params, const int selected, const int x, const int y)
+{
+    const int width = 260;
+    const int height = (SIM_PARAM_COUNT + 4) * lineHeight + 16;
+
+    DrawRectangle(x, y, width, height, Fade(RAYWHITE, 0.85f));
+    DrawRectangleLines(x, y, width, height, GRAY);
+
+    int lineY = y + 8;
+
+    for (int i = 0; i < SIM_PARAM_COUNT; i++)
+    {
+        const SimParamId id = (SimParamId)i;
+        const Color color = (i == selected) ? MAROON : BLACK;
+
+        DrawText(TextFormat("%s %-20s %10.4g", (i == selected) ? ">" : " ", GetSimParamName(id), GetSimParam(params, id)),
+            x + 10, lineY, fontSize, color);
+        lineY += lineHeight;
+    }
+
+    DrawText(TextFormat("  rules  %s %s %s",
+        (params->rules & SIM_RULE_ALIGN) ? "align" : "-",
+        (params->rules & SIM_RULE_COHERE) ? "cohere" : "-",
+        (params->rules & SIM_RULE_SEPARATE) ? "separate" : "-"),
+        x + 10, lineY, fontSize, BLACK);
+    lineY += lineHeight;
+
+    DrawText(TextFormat("  neighbors  %s (%d)  boundary  %s",
+        GetNeighborModeName(params->neighborMode), params->topologicalNeighbors,
+        GetBoundaryModeName(params->boundaryMode)),
+        x + 10, lineY, fontSize, BLACK);
+    lineY += lineHeight;
+
+    DrawText("Tab select   +/- change   F6 reload config", x + 10, lineY, fontSize, DARKGRAY);
+    lineY += lineHeight;
+    DrawText("1/2/3 rules   N [ ] neighbors   B boundary", x + 10, lineY, fontSize, DARKGRAY);
+}
@@ -0,0 +1,9 @@
+#pragma once
+
+#include "game.h"
+
+// Toggleable overlay with the per-stage timings, neighbour counts and memory use from the metrics registry.
+void DrawPerformanceHud(const GameMemory* gameMemory, const int x, const int y);
+
+// Panel listing the tunable SimParams with the selected one highlighted, for editing them while running.
+void DrawSimParamsPanel(const SimParams* params, const int selected, const int x, const int y);
@@ -0,0 +1,368 @@
+#include "jobs.h"
+
+#include <chrono>
+
+#include "perfcounters.h"
+#include "platform.h"
+#include "profiler.h"
+
+namespace
+{
+    uint64_t PackTaskRange(const uint32_t begin, const uint32_t end)
+    {
+        return ((uint64_t)begin << 32) | end;
+    }
+
+    // Takes the first task of the thread's own queue.
+    bool PopTask(JobQueue* queue, int* taskIndex)
+    {
+        uint64_t range = queue->range.load(std::memory_order_relaxed);
+
+        for (;;)
+        {
+            const uint32_t begin = (uint32_t)(range >> 32);
+            const uint32_t end = (uint32_t)range;
+            if (begin >= end)
+            {
+                return false;
+            }
+
+            if (queue->range.compare_exchange_weak(range, PackTaskRange(begin + 1, end), std::memory_order_acq_rel))
+            {
+                *taskIndex = (int)begin;
+                return true;
+            }
+        }
+    }
+
+    // Moves the back half of the victim's tasks into the thief's queue, which is empty.
+    bool StealFrom(JobSystem* jobs, JobQueue* victim, const int thiefIndex)
+    {
+        uint64_t range = victim->range.load(std::memory_order_relaxed);
+
+        for (;;)
+        {
+            const uint32_t begin = (uint32_t)(range >> 32);
+            const uint32_t end = (uint32_t)range;
+            if (begin >= end)
+            {
+                return false;
+            }
+
+            const uint32_t middle = begin + (end - begin) / 2;
+            if (victim->range.compare_exchange_weak(range, PackTaskRange(begin, middle), std::memory_order_acq_rel))
+            {
+                jobs->queues[thiefIndex].range.store(PackTaskRange(middle, end), std::memory_order_release);
+                return true;
+            }
+        }
+    }
+
+    // Steals from the first non-empty queue after the thief's own, trying the queues on the thief's node first so the
+    // tasks, and the memory they work on, stay on the node that drew them while it has threads free. Nothing else
+    // ever adds to a queue, so once every queue has been found empty the batch has no work left to hand out. Tasks
+    // that are between queues mid-steal are run by the thief.
+    bool StealTasks(JobSystem* jobs, const int thiefIndex)
+    {
+        const int numThreads = GetJobThreadCount(jobs);
+        const int thiefNode = jobs->queues[thiefIndex].node;
+
+        for (int pass = 0; pass < 2; pass++)
+        {
+            const bool sameNode = pass == 0;
+
+            for (int offset = 1; offset < numThreads; offset++)
+            {
+                JobQueue* victim = &jobs->queues[(thiefIndex + offset) % numThreads];
+                if ((victim->node == thiefNode) == sameNode && StealFrom(jobs, victim, thiefIndex))
+                {
+                    return true;
+                }
+            }
+        }
+
+        return false;
+    }
+
+    // Runs tasks from the thread's own queue, stealing more when it runs dry, until there are none left anywhere.
+    void WorkOnBatch(JobSystem* jobs, const int threadIndex)
+    {
+        const auto start = std::chrono::steady_clock::now();
+
+        JobQueue* queue = &jobs->queues[threadIndex];
+        int tasksRun = 0;
+        int steals = 0;
+        double shareMilliseconds = 0.0;
+        int shareTasksRun = -1;
+
+        for (;;)
+        {
+            int taskIndex = 0;
+            if (PopTask(queue, &taskIndex))
+            {
+                jobs->callback(jobs->data, taskIndex, threadIndex);
+                tasksRun++;
+                continue;
+            }
+
+            // Everything run so far came from the thread's own share.
+            if (shareTasksRun < 0)
+            {
+                shareTasksRun = tasksRun;
+                shareMilliseconds = std::chrono::duration<double, std::milli>(
+                    std::chrono::steady_clock::now() - start).count();
+            }
+
+            if (!StealTasks(jobs, threadIndex))
+            {
+                break;
+            }
+
+            steals++;
+        }
+
+        // A thread that joins after the batch is done finds nothing to run, and leaves the results of the batch
+        // alone since the submitting thread may already be reading them.
+        if (tasksRun == 0)
+        {
+            return;
+        }
+
+        queue->busyMilliseconds =
+            std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        queue->tasksRun = tasksRun;
+        queue->steals = steals;
+        queue->shareMilliseconds = shareMilliseconds;
+        queue->shareTasksRun = shareTasksRun;
+
+        // Counting finished tasks once per thread rather than once per task keeps the threads from all hammering the
+        // same cache line when the tasks are small.
+        if (jobs->numTasksDone.fetch_add(tasksRun, std::memory_order_acq_rel) + tasksRun == jobs->numTasks)
+        {
+            std::lock_guard<std::mutex> lock(jobs->mutex);
+            jobs->batchFinished.notify_all();
+        }
+    }
+
+    bool IsBatchDone(JobSystem* jobs)
+    {
+        return jobs->numBusyWorkers == 0 && jobs->numTasksDone.load(std::memory_order_acquire) == jobs->numTasks;
+    }
+
+    void WorkerThread(JobSystem* jobs, const int threadIndex)
+    {
+        SetProfileThreadName("Job worker");
+
+        // A pinned worker is already on a single core of its node.
+        if (jobs->numNodes > 1 && jobs->queues[threadIndex].core < 0)
+        {
+            PlatformBindThreadToNumaNode(jobs->queues[threadIndex].node);
+        }
+
+        if (jobs->perfCounters)
+        {
+            EnablePerfCounters();
+        }
+
+        uint64_t seenGeneration = 0;
+
+        for (;;)
+        {
+            {
+                std::unique_lock<std::mutex> lock(jobs->mutex);
+                jobs->batchStarted.wait(lock, [jobs, seenGeneration]
+                {
+                    return jobs->stopping || jobs->batchGeneration != seenGeneration;
+                });
+
+                if (jobs->stopping)
+                {
+                    DisablePerfCounters();
+                    return;
+                }
+
+                seenGeneration = jobs->batchGeneration;
+                jobs->numBusyWorkers++;
+            }
+
+            WorkOnBatch(jobs, threadIndex);
+
+            {
+                std::lock_guard<std::mutex> lock(jobs->mutex);
+                jobs->numBusyWorkers--;
+            }
+            jobs->batchFinished.notify_all();
+        }
+    }
+}
+
+void StartJobSystem(JobSystem* jobs, int numWorkers, const JobAffinity* affinity)
+{
+    const bool pinned = affinity && affinity->numCores > 0;
+
+    if (numWorkers <= 0)
+    {
+        numWorkers = pinned ? affinity->numCores : (int)std::thread::hardware_concurrency() - 1;
+    }
+
+    numWorkers = (numWorkers < 0) ? 0 : ((numWorkers > maxJobWorkers) ? maxJobWorkers : numWorkers);
+
+    jobs->numWorkers = numWorkers;
+    jobs->numPinnedWorkers = 0;
+    jobs->numRealtimeWorkers = 0;
+    jobs->perfCounters = PerfCountersEnabled();
+    jobs->batchGeneration = 0;
+    jobs->numBusyWorkers = 0;
+    jobs->stopping = false;
+    jobs->callback = nullptr;
+    jobs->data = nullptr;
+    jobs->numTasks = 0;
+    jobs->numTasksDone = 0;
+
+    // Pinned workers are on the node of their core, and the calling thread counts as node 0. Otherwise the threads
+    // are split between the nodes in order, and more nodes than threads would leave some nodes without any.
+    const int numThreads = GetJobThreadCount(jobs);
+    const int numNodes = PlatformGetNumaNodeCount();
+    jobs->numNodes = (numNodes < 1) ? 1 : ((numNodes > numThreads) ? numThreads : numNodes);
+
+    for (int t = 0; t < maxJobWorkers + 1; t++)
+    {
+        JobQueue* queue = &jobs->queues[t];
+        queue->range = 0;
+        queue->busyMilliseconds = 0.0;
+        queue->tasksRun = 0;
+        queue->steals = 0;
+        queue->node = (t < numThreads) ? t * jobs->numNodes / numThreads : 0;
+        queue->core = -1;
+    }
+
+    if (pinned)
+    {
+        jobs->numNodes = 1;
+        jobs->queues[0].node = 0;
+
+        for (int t = 1; t < numThreads; t++)
+        {
+            JobQueue* queue = &jobs->queues[t];
+            queue->core = affinity->cores[(t - 1) % affinity->numCores];
+            queue->node = PlatformGetCpuNumaNode(queue->core);
+            jobs->numNodes = (queue->node + 1 > jobs->numNodes) ? queue->node + 1 : jobs->numNodes;
+        }
+    }
+    else if (jobs->numNodes > 1)
+    {
+        PlatformBindThreadToNumaNode(0);
+    }
+
+    for (int i = 0; i < numWorkers; i++)
+    {
+        std::thread* worker = &jobs->workers[i];
+        *worker = std::thread(WorkerThread, jobs, i + 1);
+
+        if (pinned && PlatformPinThreadToCpu(worker, jobs->queues[i + 1].core))
+        {
+            jobs->numPinnedWorkers++;
+        }
+
+        if (affinity && affinity->realtime && PlatformSetThreadRealtimePriority(worker))
+        {
+            jobs->numRealtimeWorkers++;
+        }
+    }
+}
+
+void StopJobSystem(JobSystem* jobs)
+{
+    {
+        std::lock_guard<std::mutex> lock(jobs->mutex);
+        jobs->stopping = true;
+    }
+    jobs->batchStarted.notify_all();
+
+    for (int i = 0; i < jobs->numWorkers; i++)
+    {
+        jobs->workers[i].join();
+    }
+
+    jobs->numWorkers = 0;
+}
+
+void RunJobs(JobSystem* jobs, JobCallback* callback, void* data, const int numTasks, JobShares* shares)
+{
+    if (shares)
+    {
+        shares->used = false;
+    }
+
+    if (numTasks <= 0)
+    {
+        return;
+    }
+
+    // With a single task, or no workers, everything stays on the calling thread and the workers aren't woken.
+    const int numThreads = (numTasks > 1) ? GetJobThreadCount(jobs) : 1;
+    const double* cuts = (shares && shares->numThreads == numThreads) ? shares->cuts : nullptr;
+    uint32_t shareTasks[maxJobWorkers + 1] = {};
+
+    {
+        // A worker that woke up late for the previous batch may still be about to look at the queues, so wait for it
+        // to leave before they are refilled.
+        std::unique_lock<std::mutex> lock(jobs->mutex);
+        jobs->batchFinished.wait(lock, [jobs] { return jobs->numBusyWorkers == 0; });
+
+        jobs->callback = callback;
+        jobs->data = data;
+        jobs->numTasks = numTasks;
+        jobs->numTasksDone.store(0, std::memory_order_relaxed);
+
+        for (int t = 0; t < GetJobThreadCount(jobs); t++)
+        {
+            JobQueue* queue = &jobs->queues[t];
+            uint32_t begin = (t < numThreads) ? (uint32_t)((int64_t)numTasks * t / numThreads) : 0;
+            uint32_t end = (t < numThreads) ? (uint32_t)((int64_t)numTasks * (t + 1) / numThreads) : 0;
+
+            if (cuts && t < numThreads)
+            {
+                begin = (t == 0) ? 0 : (uint32_t)(numTasks * cuts[t] + 0.5);
+                end = (t == numThreads - 1) ? (uint32_t)numTasks : (uint32_t)(numTasks * cuts[t + 1] + 0.5);
+                end = (end < begin) ? begin : end;
+            }
+
+            shareTasks[t] = end - begin;
+            queue->range.store(PackTaskRange(begin, end), std::memory_order_relaxed);
+            queue->busyMilliseconds = 0.0;
+            queue->tasksRun = 0;
+            queue->steals = 0;
+            queue->shareMilliseconds = 0.0;
+            queue->shareTasksRun = 0;
+        }
+
+        if (numThreads > 1)
+        {
+            jobs->batchGeneration++;
+        }
+    }
+
+    if (numThreads > 1)
+    {
+        jobs->batchStarted.notify_all();
+    }
+
+    WorkOnBatch(jobs, 0);
+
+    std::unique_lock<std::mutex> lock(jobs->mutex);
+    jobs->batchFinished.wait(lock, [jobs] { return IsBatchDone(jobs); });
+
+    if (cuts)
+    {
+        // A thread that had part of its share stolen is assumed to have gone on at the same rate through the rest.
+        for (int t = 0; t < numThreads; t++)
+        {
+            const JobQueue* queue = &jobs->queues[t];
+            shares->costs[t] = (shareTasks[t] == 0) ? 0.0 : ((queue->shareTasksRun > 0) ?
+                queue->shareMilliseconds * shareTasks[t] / queue->shareTasksRun : -1.0);
+        }
+
+        shares->used = true;
+    }
+}
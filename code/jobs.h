@@ -0,0 +1,114 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+
+// A small pool of worker threads that runs batches of independent tasks. The thread that submits a batch works on it
+// too and only returns once every task in the batch has finished.
+//
+// Each thread starts a batch with an even share of the tasks as a contiguous run in its own queue, and takes them from
+// the front. A thread whose queue runs dry steals the back half of another's, so when some tasks cost far more than
+// others the threads that drew the cheap ones help out instead of sitting idle, while neighbouring tasks mostly stay on
+// the same thread.
+//
+// On a NUMA machine the threads are split between the nodes in order, thread 0 and the first workers on node 0 and
+// so on, and each is bound to its node. Since a batch is shared out in order too, each node starts every batch with a
+// contiguous part of it, the same part every time for the same number of tasks, and a thread that runs dry steals from
+// threads on its own node before going to another.
+//
+// For steadier batch times the workers can instead each be pinned to a core of their own, typically cores kept free
+// of everything else, and given real-time priority. The thread that submits batches, which in the game is also the
+// one drawing, is left unpinned, so with cores the OS keeps free the workers have theirs to themselves.
+
+constexpr int maxJobWorkers = 128;
+
+// `threadIndex` says which thread is running the task: 0 for the thread that called RunJobs, 1 to numWorkers for the
+// workers. Tasks can use it to pick per-thread scratch without locking.
+typedef void JobCallback(void* data, const int taskIndex, const int threadIndex);
+
+// One per thread that works on batches, on its own cache line since other threads steal from it.
+struct alignas(64) JobQueue
+{
+    // The tasks this thread has still to run, [begin, end) packed as begin << 32 | end so that taking from the front
+    // and stealing from the back are both a single compare-and-swap.
+    std::atomic<uint64_t> range;
+
+    // What the thread did in the most recent batch. Busy time runs from joining the batch to finding no task left to
+    // run or steal.
+    double busyMilliseconds;
+    int tasksRun;
+    int steals;
+    // The same up to the thread first finding its queue empty, which covers only tasks from its own starting share.
+    double shareMilliseconds;
+    int shareTasksRun;
+
+    int node; // The NUMA node the thread runs on.
+    int core; // The core a worker is pinned to, or -1.
+};
+
+// Where StartJobSystem puts the workers. Worker i is pinned to cores[i % numCores]; list the cores node by node on a
+// NUMA machine, since the batch is shared out in worker order.
+struct JobAffinity
+{
+    int numCores;
+    int cores[maxJobWorkers];
+    bool realtime; // Ask for real-time priority for the workers.
+};
+
+// Optionally, how RunJobs shares a batch out between the threads to start with: thread t starts with the tasks from
+// numTasks * cuts[t] to numTasks * cuts[t + 1]. For a batch whose tasks cost more in some parts than others, giving
+// each thread an equally expensive share (see balance.h) leaves less to steal, and so keeps more of the tasks on the
+// thread, and node, that ran them the tick before.
+struct JobShares
+{
+    int numThreads; // The cuts are only used for a batch spread over exactly this many threads.
+    const double* cuts; // numThreads + 1 of them, from 0 to 1.
+
+    // Filled in by RunJobs: whether the cuts were used, and if so, how long each thread's share took, from the part
+    // of it the thread ran itself. -1 for a thread that had all of its share stolen before it got to it.
+    bool used;
+    double costs[maxJobWorkers + 1];
+};
+
+struct JobSystem
+{
+    int numWorkers;
+    int numNodes;
+    int numPinnedWorkers;
+    int numRealtimeWorkers; // The workers that were granted real-time priority.
+    bool perfCounters; // The workers open hardware counters of their own, as the thread that started them had.
+    std::thread workers[maxJobWorkers];
+
+    std::mutex mutex;
+    std::condition_variable batchStarted;
+    std::condition_variable batchFinished;
+    uint64_t batchGeneration;
+    int numBusyWorkers; // Workers inside a batch. A new batch only starts once this is back to zero.
+    bool stopping;
+
+    // The batch currently being run.
+    JobCallback* callback;
+    void* data;
+    int numTasks;
+    std::atomic<int> numTasksDone;
+
+    JobQueue queues[maxJobWorkers + 1]; // Indexed by threadIndex.
+};
+
+// A worker count of zero or less picks one worker per hardware thread, minus the submitting thread, or one per core
+// when `affinity` lists cores. Without an affinity, when there is more than one NUMA node, the calling thread is bound
+// to node 0, as it will be when it submits batches.
+void StartJobSystem(JobSystem* jobs, int numWorkers, const JobAffinity* affinity = nullptr);
+void StopJobSystem(JobSystem* jobs);
+// Calls `callback(data, i, threadIndex)` for every i in [0, numTasks) spread over the workers and the calling thread.
+// The threads start with equal shares of the batch, or with `shares` when given.
+void RunJobs(JobSystem* jobs, JobCallback* callback, void* data, const int numTasks, JobShares* shares = nullptr);
+
+// The number of threads that run a batch, the calling thread included, and so the size per-thread scratch needs.
+inline int GetJobThreadCount(const JobSystem* jobs)
+{
+    return jobs->numWorkers + 1;
+}
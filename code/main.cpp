@@ -1,67 +1,348 @@
+#include <chrono>
 #include <cstdio>
 #include <cmath>
 #include <ctime>
 #include <cstdlib>
+#include <cstring>
 
 #include "raylib.h"
 #include "raymath.h"
+#include "rlgl.h"
 
 #include "raylibwindows.h"
 #include "game.h"
+#include "bench.h"
 #include "boid.h"
+#include "domain.h"
+#include "gamememory.h"
+#include "hud.h"
+#include "jobs.h"
 #include "mathutils.h"
+#include "metrics.h"
+#include "params.h"
+#include "perfcounters.h"
+#include "platform.h"
+#include "profiler.h"
+#include "snapshot.h"
+#include "taskgraph.h"
+#include "trajectory.h"
+
+namespace
+{
+    void ShowReplayFrame(TrajectoryReader* replay, const uint64_t frame, const uint64_t nextFrame,
+        GameState* gameState)
+    {
+        DecodeTrajectoryFrame(replay, frame, gameState->boids);
+        gameState->tick = GetTrajectoryFrame(replay, frame)->tick;
+
+        // The frame is now copied out, so let its pages go and start bringing in the one we expect to need next.
+        EvictTrajectoryFrame(replay, frame);
+        PrefetchTrajectoryFrame(replay, nextFrame);
+    }
+}
 
-int main()
+int main(int argc, char** argv)
 {
+    InitProfiler();
+
     constexpr int screenWidth = 1024;
     constexpr int screenHeight = 800;
 
-    std::srand((unsigned int)std::time(nullptr));
+    // Command line:
+    //   --config <file>     Read simulation settings from a config file (see params.h).
+    //   --set <name>=<value>  Override one simulation setting, e.g. --set viewRadius=12 or --set boids=2000.
+    //   --seed <n>          Seed the random number generator with a fixed value instead of the current time.
+    //   --deterministic     Double-buffered, order-independent update with a per-tick state hash.
+    //   --threads <n>       Simulate on n threads, 1 to stay on the main thread. One per hardware thread by default.
+    //   --sim-cores <list>  Pin the simulation workers to these cores, one each, e.g. 2-7 or 2,4,6.
+    //   --realtime          Ask for real-time priority for the simulation workers.
+    //   --headless <ticks>  Run the given number of ticks without opening a window and print the state hash of each.
+    //   --domains <n>       Split a headless run into n slabs of the world, each simulated by its own process.
+    //   --domain-address <addr>  Connect the domains over TCP ("host:port") or Unix domain sockets ("unix:<path>"),
+    //                       one address per domain separated by commas, or one that the others count up from.
+    //   --domain-rank <r>   Run only domain r of --domains, and find the others at --domain-address.
+    //   --load <file>       Resume from a snapshot instead of spawning a new flock.
+    //   --save <file>       Write a snapshot when the program exits.
+    //   --record <file>     Record every tick to a trajectory file.
+    //   --record-quantized  Store recorded positions as 16-bit values.
+    //   --record-compressed Store recorded frames quantized, delta and entropy coded.
+    //   --replay <file>     Play back a recorded trajectory instead of simulating.
+    //   --bench-replay <file>  Time decoding every frame of a recorded trajectory and exit.
+    //   --bench-codec <n>   Time compressing and decompressing frames of n boids and exit.
+    //   --bench [filter]    Run the microbenchmarks, or only those whose name contains the filter, and exit.
+    //   --bench-json <file> Also write the benchmark results as JSON.
+    //   --bench-baseline <file>  Compare against a saved JSON result and exit with 1 if anything regressed.
+    //   --bench-threshold <percent>  How much slower than the baseline counts as a regression, 5% by default.
+    //   --bench-large       Also run the 1M boid benchmarks.
+    //   --perf-counters     Read hardware performance counters around each simulation stage (Linux only).
+    //   --trace <file>      Write the most recent profiling zones as a Chrome trace when the program exits.
+    SimConfig config = DefaultSimConfig();
+    const char* configPath = nullptr;
+    uint64_t seed = (uint64_t)std::time(nullptr);
+    bool deterministic = false;
+    int numThreads = 0;
+    JobAffinity simAffinity = {};
+    int headlessTicks = 0;
+    int numDomains = 1;
+    const char* domainAddress = nullptr;
+    int domainRank = -1;
+    const char* loadPath = nullptr;
+    const char* savePath = nullptr;
+    const char* recordPath = nullptr;
+    TrajectoryFormat recordFormat = TRAJECTORY_FORMAT_FLOAT;
+    const char* replayPath = nullptr;
+    const char* tracePath = nullptr;
+    bool perfCounters = false;
+    bool runBenchmarks = false;
+    BenchmarkOptions benchmarkOptions = {};
+    benchmarkOptions.regressionThreshold = 5.0;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (std::strcmp(argv[i], "--config") == 0 && i + 1 < argc)
+        {
+            configPath = argv[++i];
+            if (!LoadSimConfig(configPath, &config))
+            {
+                return -1;
+            }
+        }
+        else if (std::strcmp(argv[i], "--set") == 0 && i + 1 < argc)
+        {
+            if (!ApplySimSetting(&config, argv[++i]))
+            {
+                std::printf("WARNING: Ignoring unknown or invalid setting '%s'.\n", argv[i]);
+            }
+        }
+        else if (std::strcmp(argv[i], "--seed") == 0 && i + 1 < argc)
+        {
+            seed = std::strtoull(argv[++i], nullptr, 10);
+        }
+        else if (std::strcmp(argv[i], "--deterministic") == 0)
+        {
+            deterministic = true;
+        }
+        else if (std::strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+        {
+            numThreads = std::atoi(argv[++i]);
+        }
+        else if (std::strcmp(argv[i], "--sim-cores") == 0 && i + 1 < argc)
+        {
+            simAffinity.numCores = PlatformParseCpuList(argv[++i], simAffinity.cores, maxJobWorkers);
+            if (simAffinity.numCores == 0)
+            {
+                std::printf("WARNING: Ignoring invalid core list '%s'.\n", argv[i]);
+            }
+        }
+        else if (std::strcmp(argv[i], "--realtime") == 0)
+        {
+            simAffinity.realtime = true;
+        }
+        else if (std::strcmp(argv[i], "--headless") == 0 && i + 1 < argc)
+        {
+            headlessTicks = std::atoi(argv[++i]);
+        }
+        else if (std::strcmp(argv[i], "--domains") == 0 && i + 1 < argc)
+        {
+            numDomains = std::atoi(argv[++i]);
+        }
+        else if (std::strcmp(argv[i], "--domain-address") == 0 && i + 1 < argc)
+        {
+            domainAddress = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "--domain-rank") == 0 && i + 1 < argc)
+        {
+            domainRank = std::atoi(argv[++i]);
+        }
+        else if (std::strcmp(argv[i], "--load") == 0 && i + 1 < argc)
+        {
+            loadPath = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "--save") == 0 && i + 1 < argc)
+        {
+            savePath = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "--record") == 0 && i + 1 < argc)
+        {
+            recordPath = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "--record-quantized") == 0)
+        {
+            recordFormat = TRAJECTORY_FORMAT_QUANTIZED;
+        }
+        else if (std::strcmp(argv[i], "--record-compressed") == 0)
+        {
+            recordFormat = TRAJECTORY_FORMAT_COMPRESSED;
+        }
+        else if (std::strcmp(argv[i], "--replay") == 0 && i + 1 < argc)
+        {
+            replayPath = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "--trace") == 0 && i + 1 < argc)
+        {
+            tracePath = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "--perf-counters") == 0)
+        {
+            perfCounters = true;
+        }
+        else if (std::strcmp(argv[i], "--bench-replay") == 0 && i + 1 < argc)
+        {
+            return RunTrajectoryDecodeBenchmark(argv[++i]);
+        }
+        else if (std::strcmp(argv[i], "--bench-codec") == 0 && i + 1 < argc)
+        {
+            return RunFrameCodecBenchmark(std::atoi(argv[++i]));
+        }
+        else if (std::strcmp(argv[i], "--bench") == 0)
+        {
+            runBenchmarks = true;
+            if (i + 1 < argc && std::strncmp(argv[i + 1], "--", 2) != 0)
+            {
+                benchmarkOptions.filter = argv[++i];
+            }
+        }
+        else if (std::strcmp(argv[i], "--bench-json") == 0 && i + 1 < argc)
+        {
+            runBenchmarks = true;
+            benchmarkOptions.jsonPath = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "--bench-baseline") == 0 && i + 1 < argc)
+        {
+            runBenchmarks = true;
+            benchmarkOptions.baselinePath = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "--bench-threshold") == 0 && i + 1 < argc)
+        {
+            benchmarkOptions.regressionThreshold = std::atof(argv[++i]);
+        }
+        else if (std::strcmp(argv[i], "--bench-large") == 0)
+        {
+            runBenchmarks = true;
+            benchmarkOptions.includeLarge = true;
+        }
+        else
+        {
+            std::printf("WARNING: Ignoring unknown argument '%s'.\n", argv[i]);
+        }
+    }
 
-    InitWindow(screenWidth, screenHeight, "Boids");
+    // Every domain is simulated on its own process's main thread. The processes are forked, which only copies the
+    // thread that forks, so there are no workers to start either.
+    if (numDomains > 1 && headlessTicks == 0)
+    {
+        std::printf("WARNING: Ignoring --domains, which only splits headless runs.\n");
+        numDomains = 1;
+    }
 
-    constexpr int fps = 60;
-    SetTargetFPS(fps);
+    if (numDomains <= 1 && (domainAddress || domainRank >= 0))
+    {
+        std::printf("WARNING: Ignoring --domain-address and --domain-rank without --domains.\n");
+    }
 
-    Camera camera =
+    if (numDomains > 1)
     {
-        .position = { .x = 0.0f, .y = 100.0f, .z = 300.0f },
-        .target = { .x = 0.0f, .y = 0.0f, .z = 0.0f },
-        .up = { .x = 0.0f, .y = 1.0f, .z = 0.0f },
-        .fovy = 45.0f,
-        .projection = CAMERA_PERSPECTIVE
-    };
+        numThreads = 1;
+    }
 
-    DisableCursor();
+    // Opened on this thread before any job system starts, so that every worker opens counters of its own as well.
+    if (perfCounters && !EnablePerfCounters())
+    {
+        std::printf("WARNING: Hardware performance counters are unavailable (%s).\n", GetPerfCounterError());
+    }
 
-    constexpr int numBoids = 300;
-    constexpr float worldSize = 200.0f;
-    constexpr float worldSizeHalf = worldSize / 2;
+    if (runBenchmarks)
+    {
+        return RunBenchmarks(&benchmarkOptions);
+    }
+
+    SeedRandom(seed);
+
+    constexpr const char* quickSavePath = "quicksave.boids";
+    constexpr const char* quickTracePath = "boids_trace.json";
+
+    int numBoids = config.numBoids;
+    float worldSizeHalf = config.worldSize / 2;
+
+    // When resuming, the snapshot decides how many boids we need room for.
+    if (loadPath)
+    {
+        SnapshotHeader header = {};
+        if (!ReadSnapshotHeader(loadPath, &header))
+        {
+            return -1;
+        }
+
+        numBoids = header.numBoids;
+    }
+
+    // When replaying, boids are streamed out of the recording instead of simulated.
+    TrajectoryReader replay = {};
+    if (replayPath)
+    {
+        if (!OpenTrajectory(replayPath, &replay))
+        {
+            return -1;
+        }
+
+        if (replay.header->frameCount == 0)
+        {
+            std::printf("ERROR: '%s' has no frames.\n", replayPath);
+            return -1;
+        }
+
+        numBoids = replay.header->numBoids;
+        worldSizeHalf = replay.header->worldSize;
+    }
+
+    // Everything is sized from the flock and reserved up front, so a flock too large for this machine is refused
+    // here rather than partway through a run.
+    const MemoryBudget memoryBudget = PlanGameMemory(numBoids, worldSizeHalf, &config.params, headlessTicks == 0);
+    PrintMemoryBudget(&memoryBudget);
 
     GameMemory gameMemory = {};
-    gameMemory.permanentStorageSize = sizeof(GameState) + (sizeof(Boid) * numBoids);
-    gameMemory.permanentStorage = VirtualAlloc(
-        nullptr,
-        gameMemory.permanentStorageSize,
-        MEM_RESERVE | MEM_COMMIT,
-        PAGE_READWRITE);
+    GameState* gameState = AllocateGameMemory(&memoryBudget, &gameMemory);
 
-    if (!gameMemory.permanentStorage)
+    if (!gameState)
     {
-        std::puts("ERROR: Failed to allocate memory for the game. Exiting.");
+        std::printf("ERROR: Could not reserve %.2f MB of memory for %d boids. Try a smaller flock. Exiting.\n",
+            (memoryBudget.permanentStorageSize + memoryBudget.transientStorageSize) / (1024.0 * 1024.0), numBoids);
         return -1;
     }
 
-    GameState* gameState = (GameState*)gameMemory.permanentStorage;
-    gameState->numBoids = numBoids;
+    // Each frame is a task graph spread over the workers: the tick's stages and, when there is a window, the render
+    // prep. Drawing itself stays on this thread. The workers start before the flock is spawned so that they are the
+    // first to touch its memory, which on a NUMA machine puts each node's share of it on that node.
+    JobSystem simJobs = {};
+    if (numThreads != 1)
+    {
+        StartJobSystem(&simJobs, numThreads - 1, &simAffinity);
+        gameState->jobs = (simJobs.numWorkers > 0) ? &simJobs : nullptr;
+    }
+    std::printf("Simulating on %d threads.\n", gameState->jobs ? GetJobThreadCount(&simJobs) : 1);
+
+    if (simAffinity.numCores > 0)
+    {
+        std::printf("Pinned %d of %d workers to their cores.\n", simJobs.numPinnedWorkers, simJobs.numWorkers);
+    }
+
+    if (simAffinity.realtime)
+    {
+        std::printf("%d of %d workers got real-time priority.\n", simJobs.numRealtimeWorkers, simJobs.numWorkers);
+    }
+
+    if (gameState->jobs && simJobs.numNodes > 1)
+    {
+        std::printf("Flock split between %d NUMA nodes.\n", simJobs.numNodes);
+    }
+
+    FirstTouchBoids(gameState);
+
     gameState->worldSize = worldSizeHalf;
+    gameState->params = config.params;
 
-    // We assign the boids array pointer to point to just after the gameState object. So after this our memory
-    // layout will basically be:
-    // --------------------------------------------------------------
-    // | gameState object | array that gameState->boids points to |
-    // --------------------------------------------------------------
-    gameState->boids = (Boid*)((uint8_t*)gameMemory.permanentStorage + sizeof(GameState));
+    gameState->deterministic = deterministic;
+    gameState->tick = 0;
 
     for (int i = 0; i < numBoids; i++)
     {
@@ -82,10 +363,187 @@ int main()
         gameState->boids[i] = boid;
     }
 
+    gameState->stateHash = HashBoids(gameState->boids, numBoids);
+
+    RecordMetric(METRIC_MEMORY_USED, (double)(gameMemory.permanentStorageSize + gameMemory.transientStorageSize));
+
+    if (loadPath)
+    {
+        if (!LoadSnapshot(loadPath, gameState))
+        {
+            StopJobSystem(&simJobs);
+            return -1;
+        }
+
+        std::printf("Resumed %d boids at tick %llu from '%s'.\n",
+            gameState->numBoids, (unsigned long long)gameState->tick, loadPath);
+    }
+
+    // A snapshot brings its own random state, so the seed was never used.
+    if (gameState->deterministic && loadPath)
+    {
+        std::printf("Deterministic mode, resumed random state from '%s'.\n", loadPath);
+    }
+    else if (gameState->deterministic)
+    {
+        std::printf("Deterministic mode, seed %llu.\n", (unsigned long long)seed);
+    }
+
+    // Forked before the recorder starts its writer thread. From here on this process runs domain 0 and keeps the
+    // whole flock in gameState up to date with the others.
+    DomainRun domains = {};
+    if (numDomains > 1)
+    {
+        DomainOptions domainOptions = {};
+        domainOptions.numDomains = numDomains;
+        domainOptions.numTicks = headlessTicks;
+        domainOptions.addresses = domainAddress;
+        domainOptions.rank = domainRank;
+
+        if (!StartDomains(&domains, gameState, &domainOptions))
+        {
+            return -1;
+        }
+
+        if (domainRank >= 0)
+        {
+            std::printf("Running domain %d of %d.\n", domainRank, numDomains);
+        }
+        else
+        {
+            std::printf("World split into %d domains, one process each.\n", numDomains);
+        }
+    }
+
+    // Only domain 0 has the whole flock to hash, record and save.
+    const bool wholeFlock = domains.rank == 0;
+
+    TrajectoryRecorder recorder = {};
+    if (recordPath && wholeFlock)
+    {
+        if (!BeginTrajectoryRecording(&recorder, recordPath, gameState, recordFormat))
+        {
+            StopDomains(&domains);
+            StopJobSystem(&simJobs);
+            return -1;
+        }
+
+        RecordTrajectoryFrame(&recorder, gameState);
+    }
+
+    static TaskGraph frameGraph;
+    static BoidsTick boidsTick;
+
+    if (headlessTicks > 0)
+    {
+        bool domainsFailed = false;
+
+        for (int i = 0; i < headlessTicks; i++)
+        {
+            if (domains.numDomains > 1)
+            {
+                if (!StepDomains(&domains, gameState))
+                {
+                    domainsFailed = true;
+                    break;
+                }
+            }
+            else
+            {
+                ResetTaskGraph(&frameGraph);
+                if (AddUpdateBoidsNodes(&frameGraph, gameState, &boidsTick))
+                {
+                    RunTaskGraph(&frameGraph, gameState->jobs);
+                    FinishUpdateBoids(&frameGraph, &boidsTick);
+                }
+            }
+
+            if (!wholeFlock)
+            {
+                continue;
+            }
+
+            // In deterministic mode the tick's Hash node, or the domains, have already hashed the new flock.
+            const uint64_t stateHash = gameState->deterministic ? gameState->stateHash :
+                HashBoids(gameState->boids, numBoids);
+            std::printf("tick %llu hash %016llx\n", (unsigned long long)gameState->tick, (unsigned long long)stateHash);
+
+            if (recordPath)
+            {
+                RecordTrajectoryFrame(&recorder, gameState);
+            }
+        }
+
+        if (recordPath && wholeFlock)
+        {
+            EndTrajectoryRecording(&recorder);
+        }
+
+        StopDomains(&domains);
+        StopJobSystem(&simJobs);
+
+        if (domainsFailed)
+        {
+            return -1;
+        }
+
+        if (numDomains == 1)
+        {
+            PrintTaskGraph(&frameGraph);
+        }
+
+        if (savePath && wholeFlock && !SaveSnapshot(savePath, gameState))
+        {
+            return -1;
+        }
+
+        PrintMetrics();
+
+        if (tracePath)
+        {
+            WriteProfileTrace(tracePath);
+        }
+
+        return 0;
+    }
+
+    InitWindow(screenWidth, screenHeight, "Boids");
+
+    constexpr int fps = 60;
+    SetTargetFPS(fps);
+
+    Camera camera =
+    {
+        .position = { .x = 0.0f, .y = 100.0f, .z = 300.0f },
+        .target = { .x = 0.0f, .y = 0.0f, .z = 0.0f },
+        .up = { .x = 0.0f, .y = 1.0f, .z = 0.0f },
+        .fovy = 45.0f,
+        .projection = CAMERA_PERSPECTIVE
+    };
+
+    DisableCursor();
+
     constexpr float moveSpeed = 2.0f;
     constexpr float mouseSensitivity = 0.05f;
 
     bool paused = false;
+    bool showHud = false;
+    bool showParams = false;
+    int selectedParam = 0;
+
+    constexpr float minPlaybackSpeed = 1.0f / 16.0f;
+    constexpr float maxPlaybackSpeed = 64.0f;
+    float playbackSpeed = 1.0f;
+    double playhead = 0.0;
+    uint64_t shownFrame = 0;
+
+    if (replayPath)
+    {
+        // Nothing is simulated during a replay, and frames are decoded before the frame's graph runs, so the decoder
+        // borrows the simulation's workers.
+        SetTrajectoryDecodeJobs(&replay, gameState->jobs);
+        ShowReplayFrame(&replay, 0, 1, gameState);
+    }
 
     while (!WindowShouldClose())
     {
@@ -108,15 +566,200 @@ int main()
             paused = !paused;
         }
 
+        if (IsKeyPressed(KEY_F5))
+        {
+            SaveSnapshot(quickSavePath, gameState);
+        }
+
+        if (IsKeyPressed(KEY_F1))
+        {
+            showHud = !showHud;
+        }
+
+        if (IsKeyPressed(KEY_F2))
+        {
+            showParams = !showParams;
+        }
+
+        // While the parameter panel is open, Tab/Shift+Tab pick a parameter and +/- change it by 10%. F6 reloads the
+        // config file, for editing it in another window.
+        if (showParams && !replayPath)
+        {
+            if (IsKeyPressed(KEY_TAB))
+            {
+                const int step = (IsKeyDown(KEY_LEFT_SHIFT) || IsKeyDown(KEY_RIGHT_SHIFT)) ? SIM_PARAM_COUNT - 1 : 1;
+                selectedParam = (selectedParam + step) % SIM_PARAM_COUNT;
+            }
+
+            const bool increase = IsKeyPressed(KEY_EQUAL) || IsKeyPressedRepeat(KEY_EQUAL) ||
+                IsKeyPressed(KEY_KP_ADD) || IsKeyPressedRepeat(KEY_KP_ADD);
+            const bool decrease = IsKeyPressed(KEY_MINUS) || IsKeyPressedRepeat(KEY_MINUS) ||
+                IsKeyPressed(KEY_KP_SUBTRACT) || IsKeyPressedRepeat(KEY_KP_SUBTRACT);
+
+            if (increase || decrease)
+            {
+                const SimParamId id = (SimParamId)selectedParam;
+                const float value = GetSimParam(&gameState->params, id);
+                SetSimParam(&gameState->params, id, increase ? value * 1.1f : value / 1.1f);
+            }
+
+            // 1/2/3 toggle alignment, cohesion and separation, N and B cycle the neighbour and boundary modes and
+            // [ and ] change how many neighbours the topological mode uses.
+            SimParams& params = gameState->params;
+
+            if (IsKeyPressed(KEY_ONE))
+            {
+                params.rules ^= SIM_RULE_ALIGN;
+            }
+
+            if (IsKeyPressed(KEY_TWO))
+            {
+                params.rules ^= SIM_RULE_COHERE;
+            }
+
+            if (IsKeyPressed(KEY_THREE))
+            {
+                params.rules ^= SIM_RULE_SEPARATE;
+            }
+
+            if (IsKeyPressed(KEY_N))
+            {
+                params.neighborMode = (NeighborMode)((params.neighborMode + 1) % NEIGHBOR_MODE_COUNT);
+            }
+
+            if (IsKeyPressed(KEY_B))
+            {
+                params.boundaryMode = (BoundaryMode)((params.boundaryMode + 1) % BOUNDARY_MODE_COUNT);
+            }
+
+            if (IsKeyPressed(KEY_LEFT_BRACKET) && params.topologicalNeighbors > 1)
+            {
+                params.topologicalNeighbors--;
+            }
+
+            if (IsKeyPressed(KEY_RIGHT_BRACKET) && params.topologicalNeighbors < maxTopologicalNeighbors)
+            {
+                params.topologicalNeighbors++;
+            }
+
+            if (IsKeyPressed(KEY_F6) && configPath)
+            {
+                SimConfig reloaded = config;
+                reloaded.params = gameState->params;
+                if (LoadSimConfig(configPath, &reloaded))
+                {
+                    gameState->params = reloaded.params;
+                }
+            }
+        }
+
+        if (IsKeyPressed(KEY_F11))
+        {
+            WriteProfileTrace(quickTracePath);
+        }
+
+        if (IsKeyPressed(KEY_F9) && !replayPath)
+        {
+            LoadSnapshot(quickSavePath, gameState);
+        }
+
         UpdateCameraPro(&camera, cameraMovement, cameraRotation, 0.0f);
 
-        if (!paused)
+        if (replayPath)
+        {
+            // Up/Down change the playback speed, Left/Right step a frame, Page Up/Down jump a tenth of the
+            // recording and Home/End go to either end.
+            const double lastFrame = (double)(replay.header->frameCount - 1);
+            const double jump = (lastFrame + 1.0) / 10.0;
+
+            if (IsKeyPressed(KEY_UP))
+            {
+                playbackSpeed = (playbackSpeed * 2.0f > maxPlaybackSpeed) ? maxPlaybackSpeed : playbackSpeed * 2.0f;
+            }
+
+            if (IsKeyPressed(KEY_DOWN))
+            {
+                playbackSpeed = (playbackSpeed / 2.0f < minPlaybackSpeed) ? minPlaybackSpeed : playbackSpeed / 2.0f;
+            }
+
+            if (IsKeyPressed(KEY_RIGHT) || IsKeyPressedRepeat(KEY_RIGHT))
+            {
+                playhead = std::floor(playhead) + 1.0;
+            }
+
+            if (IsKeyPressed(KEY_LEFT) || IsKeyPressedRepeat(KEY_LEFT))
+            {
+                playhead = std::floor(playhead) - 1.0;
+            }
+
+            if (IsKeyPressed(KEY_PAGE_DOWN))
+            {
+                playhead += jump;
+            }
+
+            if (IsKeyPressed(KEY_PAGE_UP))
+            {
+                playhead -= jump;
+            }
+
+            if (IsKeyPressed(KEY_HOME))
+            {
+                playhead = 0.0;
+            }
+
+            if (IsKeyPressed(KEY_END))
+            {
+                playhead = lastFrame;
+            }
+
+            if (!paused)
+            {
+                playhead += playbackSpeed;
+            }
+
+            playhead = (playhead < 0.0) ? 0.0 : ((playhead > lastFrame) ? lastFrame : playhead);
+
+            const uint64_t frame = (uint64_t)playhead;
+            if (frame != shownFrame)
+            {
+                const uint64_t step = (playbackSpeed > 1.0f) ? (uint64_t)playbackSpeed : 1;
+                const uint64_t nextFrame = (frame + step > (uint64_t)lastFrame) ? (uint64_t)lastFrame : frame + step;
+
+                ShowReplayFrame(&replay, frame, nextFrame, gameState);
+                shownFrame = frame;
+            }
+        }
+
+        // The render prep reads the flock as it was before this frame's tick, so it overlaps with the grid update, and
+        // only the steering, which writes to the flock in place outside deterministic mode, has to wait for it.
+        ResetTaskGraph(&frameGraph);
+        const int renderPrepNode = AddRenderPrepNode(&frameGraph, gameState);
+
+        const bool ticking = !replayPath && !paused && AddUpdateBoidsNodes(&frameGraph, gameState, &boidsTick);
+        if (ticking)
         {
-            UpdateBoids(gameState);
+            AddTaskGraphDependency(&frameGraph, boidsTick.steerNode, renderPrepNode);
+        }
+
+        RunTaskGraph(&frameGraph, gameState->jobs);
+        RecordMetric(METRIC_RENDER_PREP_TIME, GetTaskGraphNodeMilliseconds(&frameGraph, renderPrepNode));
+
+        if (ticking)
+        {
+            FinishUpdateBoids(&frameGraph, &boidsTick);
+
+            if (recordPath)
+            {
+                RecordTrajectoryFrame(&recorder, gameState);
+            }
         }
         /**** END UPDATE ****/
 
         /**** BEGIN DRAW ****/
+        const auto drawStart = std::chrono::steady_clock::now();
+
+        const float worldSize = gameState->worldSize * 2;
+
         BeginDrawing();
 
             ClearBackground(RAYWHITE);
@@ -144,6 +787,34 @@ int main()
 
             DrawFPS(5, 5);
 
+            if (replayPath)
+            {
+                DrawText(TextFormat("Replay frame %llu / %llu  tick %llu  speed x%g",
+                    (unsigned long long)shownFrame, (unsigned long long)replay.header->frameCount - 1,
+                    (unsigned long long)gameState->tick, playbackSpeed),
+                    5, 55, 20, DARKGRAY);
+            }
+
+            if (gameState->deterministic)
+            {
+                DrawText(TextFormat("Tick %llu  Hash %016llx",
+                    (unsigned long long)gameState->tick, (unsigned long long)gameState->stateHash),
+                    5, 30, 20, DARKGRAY);
+            }
+
+            if (showHud)
+            {
+                DrawPerformanceHud(&gameMemory, 5, 80);
+            }
+
+            if (showParams)
+            {
+                DrawSimParamsPanel(&gameState->params, selectedParam, screenWidth - 265, 45);
+            }
+
+            // Flush everything to the GPU here, so the draw time does not include waiting for the next frame.
+            rlDrawRenderBatchActive();
+            RecordMetric(METRIC_DRAW_TIME, MillisecondsSince(drawStart));
 
         EndDrawing();
         /**** END DRAW ****/
@@ -151,5 +822,27 @@ int main()
 
     CloseWindow();
 
+    StopJobSystem(&simJobs);
+
+    if (replayPath)
+    {
+        CloseTrajectory(&replay);
+    }
+
+    if (recordPath)
+    {
+        EndTrajectoryRecording(&recorder);
+    }
+
+    if (tracePath)
+    {
+        WriteProfileTrace(tracePath);
+    }
+
+    if (savePath && !SaveSnapshot(savePath, gameState))
+    {
+        return -1;
+    }
+
     return 0;
 }
@@ -1,10 +1,45 @@
 #include "mathutils.h"
 
-#include "raymath.h"
+namespace
+{
+    uint64_t randomState = 0x9E3779B97F4A7C15ull;
+
+    uint64_t NextRandom()
+    {
+        uint64_t x = randomState;
+        x ^= x >> 12;
+        x ^= x << 25;
+        x ^= x >> 27;
+        randomState = x;
+        return x * 0x2545F4914F6CDD1Dull;
+    }
+}
+
+void SeedRandom(const uint64_t seed)
+{
+    // Run the seed through splitmix64 so that small or zero seeds still give a well mixed, non-zero state.
+    uint64_t z = seed + 0x9E3779B97F4A7C15ull;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    z = z ^ (z >> 31);
+
+    randomState = (z != 0) ? z : 0x9E3779B97F4A7C15ull;
+}
+
+uint64_t GetRandomState()
+{
+    return randomState;
+}
+
+void SetRandomState(const uint64_t state)
+{
+    randomState = state;
+}
 
 float RandomFloat()
 {
-    return static_cast<float>(std::rand()) / static_cast<float>(RAND_MAX);
+    // Top 24 bits give every float in [0, 1) with an equal step.
+    return static_cast<float>(NextRandom() >> 40) / 16777216.0f;
 }
 
 float RandomFloat(const float min, const float max)
@@ -30,89 +65,3 @@ Vector3 CreateRandomVector3()
 
     return result;
 }
-
-Vector3 operator*(const Vector3 v, const float val)
-{
-    return Vector3Scale(v, val);
-}
-
-Vector3 operator+(const Vector3 v1, const Vector3 v2)
-{
-    return Vector3Add(v1, v2);
-}
-
-Vector3 operator+(const Vector3 v, const float val)
-{
-    return Vector3AddValue(v, val);
-}
-
-Vector3& operator+=(Vector3& v1, const Vector3 v2)
-{
-    v1 = v1 + v2;
-    return v1;
-}
-
-Vector3& operator+=(Vector3& v, const float val)
-{
-    v = v + val;
-    return v;
-}
-
-Vector3 operator-(const Vector3 v)
-{
-    return Vector3Negate(v);
-}
-
-Vector3 operator-(const Vector3 v1, const Vector3 v2)
-{
-    return Vector3Subtract(v1, v2);
-}
-
-Vector3 operator-(const Vector3 v, const float val)
-{
-    return Vector3SubtractValue(v, val);
-}
-
-Vector3& operator-=(Vector3& v1, const Vector3 v2)
-{
-    v1 = v1 - v2;
-    return v1;
-}
-
-Vector3& operator-=(Vector3& v, const float val)
-{
-    v = v - val;
-    return v;
-}
-
-Vector3 operator/(const Vector3 v1, const Vector3 v2)
-{
-    return Vector3Divide(v1, v2);
-}
-
-Vector3& operator/=(Vector3& v1, const Vector3 v2)
-{
-    v1 = v1 / v2;
-    return v1;
-}
-
-Vector3 operator/(const Vector3 v, const float value)
-{
-    return Vector3Scale(v, 1.0f / value);
-}
-
-Vector3& operator/=(Vector3& v, const float value)
-{
-    v = v / value;
-    return v;
-}
-
-bool operator==(const Vector3 v1, const Vector3 v2)
-{
-    return Vector3Equals(v1, v2);
-}
-
-bool operator>(const Vector3 v, const int n)
-{
-    return Vector3Length(v) > n;
-}
@@ -1,25 +1,108 @@
 #pragma once
 #include <cmath>
+#include <cstdint>
 
 #include "raylib.h"
+#include "raymath.h"
+
+// All random numbers come from a single xorshift64* sequence so a run can be reproduced from its seed, and the
+// sequence can be saved and restored along with the rest of the simulation.
+void SeedRandom(const uint64_t seed);
+uint64_t GetRandomState();
+void SetRandomState(const uint64_t state);
 
 float RandomFloat();
 float RandomFloat(const float min, const float max);
 Vector3 CreateRandomVector3();
 
-Vector3 operator*(const Vector3 v, const float val);
-Vector3 operator+(const Vector3 v1, const Vector3 v2);
-Vector3 operator+(const Vector3 v, const float val);
-Vector3& operator+=(Vector3& v1, const Vector3 v2);
-Vector3& operator+=(Vector3& v, const float val);
-Vector3 operator-(const Vector3 v);
-Vector3 operator-(const Vector3 v1, const Vector3 v2);
-Vector3 operator-(const Vector3 v, const float val);
-Vector3& operator-=(Vector3& v1, const Vector3 v2);
-Vector3& operator-=(Vector3& v, const float val);
-Vector3 operator/(const Vector3 v1, const Vector3 v2);
-Vector3& operator/=(Vector3& v1, const Vector3 v2);
-Vector3 operator/(const Vector3 v, const float value);
-Vector3& operator/=(Vector3& v, const float value);
-bool operator==(const Vector3 v1, const Vector3 v2);
-bool operator>(const Vector3 v, const int n);
+// The vector operators are defined here rather than in mathutils.cpp so they are inlined into the steering loops
+// instead of costing a call each. They do the same arithmetic as the raymath functions they replace, so results
+// are bit-identical, and are constexpr where the standard library allows it.
+
+constexpr Vector3 operator*(const Vector3 v, const float val)
+{
+    return { v.x * val, v.y * val, v.z * val };
+}
+
+constexpr Vector3 operator+(const Vector3 v1, const Vector3 v2)
+{
+    return { v1.x + v2.x, v1.y + v2.y, v1.z + v2.z };
+}
+
+constexpr Vector3 operator+(const Vector3 v, const float val)
+{
+    return { v.x + val, v.y + val, v.z + val };
+}
+
+constexpr Vector3& operator+=(Vector3& v1, const Vector3 v2)
+{
+    v1 = v1 + v2;
+    return v1;
+}
+
+constexpr Vector3& operator+=(Vector3& v, const float val)
+{
+    v = v + val;
+    return v;
+}
+
+constexpr Vector3 operator-(const Vector3 v)
+{
+    return { -v.x, -v.y, -v.z };
+}
+
+constexpr Vector3 operator-(const Vector3 v1, const Vector3 v2)
+{
+    return { v1.x - v2.x, v1.y - v2.y, v1.z - v2.z };
+}
+
+constexpr Vector3 operator-(const Vector3 v, const float val)
+{
+    return { v.x - val, v.y - val, v.z - val };
+}
+
+constexpr Vector3& operator-=(Vector3& v1, const Vector3 v2)
+{
+    v1 = v1 - v2;
+    return v1;
+}
+
+constexpr Vector3& operator-=(Vector3& v, const float val)
+{
+    v = v - val;
+    return v;
+}
+
+constexpr Vector3 operator/(const Vector3 v1, const Vector3 v2)
+{
+    return { v1.x / v2.x, v1.y / v2.y, v1.z / v2.z };
+}
+
+constexpr Vector3& operator/=(Vector3& v1, const Vector3 v2)
+{
+    v1 = v1 / v2;
+    return v1;
+}
+
+// Multiplies by the reciprocal, like Vector3Scale(v, 1.0f / value) did.
+constexpr Vector3 operator/(const Vector3 v, const float value)
+{
+    return v * (1.0f / value);
+}
+
+constexpr Vector3& operator/=(Vector3& v, const float value)
+{
+    v = v / value;
+    return v;
+}
+
+// Equal to within a relative epsilon, as Vector3Equals. Not constexpr because std::fabs isn't until C++23.
+inline bool operator==(const Vector3 v1, const Vector3 v2)
+{
+    return Vector3Equals(v1, v2) != 0;
+}
+
+inline bool operator>(const Vector3 v, const int n)
+{
+    return Vector3Length(v) > n;
+}
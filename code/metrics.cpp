@@ -0,0 +1,181 @@
+#include "metrics.h"
+
+#include <algorithm>
+#include <cstdio>
+
+namespace
+{
+    struct MetricInfo
+    {
+        const char* name;
+        MetricUnit unit;
+    };
+
+    constexpr MetricInfo metricInfos[METRIC_COUNT] =
+    {
+        { "sim", METRIC_UNIT_MILLISECONDS },
+        { "grid update", METRIC_UNIT_MILLISECONDS },
+        { "render prep", METRIC_UNIT_MILLISECONDS },
+        { "draw", METRIC_UNIT_MILLISECONDS },
+        { "neighbors mean", METRIC_UNIT_COUNT },
+        { "neighbors max", METRIC_UNIT_COUNT },
+        { "cell max", METRIC_UNIT_COUNT },
+        { "grid movers", METRIC_UNIT_COUNT },
+        { "memory used", METRIC_UNIT_BYTES },
+        { "load imbalance", METRIC_UNIT_COUNT },
+        { "domain sent", METRIC_UNIT_BYTES_PER_TICK },
+        { "domain wait", METRIC_UNIT_MILLISECONDS },
+        { "grid cycles", METRIC_UNIT_COUNT },
+        { "grid instrs", METRIC_UNIT_COUNT },
+        { "grid L1D miss", METRIC_UNIT_COUNT },
+        { "grid LLC miss", METRIC_UNIT_COUNT },
+        { "grid br miss", METRIC_UNIT_COUNT },
+        { "steer cycles", METRIC_UNIT_COUNT },
+        { "steer instrs", METRIC_UNIT_COUNT },
+        { "steer L1D miss", METRIC_UNIT_COUNT },
+        { "steer LLC miss", METRIC_UNIT_COUNT },
+        { "steer br miss", METRIC_UNIT_COUNT },
+        { "hash cycles", METRIC_UNIT_COUNT },
+        { "hash instrs", METRIC_UNIT_COUNT },
+        { "hash L1D miss", METRIC_UNIT_COUNT },
+        { "hash LLC miss", METRIC_UNIT_COUNT },
+        { "hash br miss", METRIC_UNIT_COUNT },
+    };
+
+    struct Metric
+    {
+        double samples[metricWindowSize];
+        int nextSample;
+        int numWindowSamples;
+
+        uint64_t numSamples;
+        double total;
+        double max;
+    };
+
+    Metric metrics[METRIC_COUNT];
+
+    double Percentile(const double* sorted, const int count, const double percentile)
+    {
+        const int index = (int)(percentile * (count - 1) + 0.5);
+        return sorted[index];
+    }
+}
+
+void RecordMetric(const MetricId id, const double value)
+{
+    Metric& metric = metrics[id];
+
+    metric.samples[metric.nextSample] = value;
+    metric.nextSample = (metric.nextSample + 1) % metricWindowSize;
+    metric.numWindowSamples = (metric.numWindowSamples < metricWindowSize) ? metric.numWindowSamples + 1 : metricWindowSize;
+
+    metric.max = (metric.numSamples == 0 || value > metric.max) ? value : metric.max;
+    metric.numSamples++;
+    metric.total += value;
+}
+
+const char* GetMetricName(const MetricId id)
+{
+    return metricInfos[id].name;
+}
+
+MetricUnit GetMetricUnit(const MetricId id)
+{
+    return metricInfos[id].unit;
+}
+
+MetricSummary SummarizeMetric(const MetricId id)
+{
+    const Metric& metric = metrics[id];
+
+    MetricSummary summary = {};
+    summary.numSamples = metric.numSamples;
+
+    const int count = metric.numWindowSamples;
+    if (count == 0)
+    {
+        return summary;
+    }
+
+    double sorted[metricWindowSize];
+    double sum = 0.0;
+    for (int i = 0; i < count; i++)
+    {
+        sorted[i] = metric.samples[i];
+        sum += sorted[i];
+    }
+    std::sort(sorted, sorted + count);
+
+    summary.last = metric.samples[(metric.nextSample + metricWindowSize - 1) % metricWindowSize];
+    summary.average = sum / count;
+    summary.p50 = Percentile(sorted, count, 0.50);
+    summary.p99 = Percentile(sorted, count, 0.99);
+    summary.max = sorted[count - 1];
+    summary.numWindowSamples = count;
+    summary.runAverage = metric.total / metric.numSamples;
+    summary.runMax = metric.max;
+
+    return summary;
+}
+
+int GetMetricHistory(const MetricId id, double* samples)
+{
+    const Metric& metric = metrics[id];
+    const int count = metric.numWindowSamples;
+    const int first = (metric.nextSample + metricWindowSize - count) % metricWindowSize;
+
+    for (int i = 0; i < count; i++)
+    {
+        samples[i] = metric.samples[(first + i) % metricWindowSize];
+    }
+
+    return count;
+}
+
+void ResetMetrics()
+{
+    for (int i = 0; i < METRIC_COUNT; i++)
+    {
+        metrics[i] = {};
+    }
+}
+
+void PrintMetrics()
+{
+    for (int i = 0; i < METRIC_COUNT; i++)
+    {
+        const MetricId id = (MetricId)i;
+        const MetricSummary summary = SummarizeMetric(id);
+        if (summary.numSamples == 0)
+        {
+            continue;
+        }
+
+        switch (GetMetricUnit(id))
+        {
+            case METRIC_UNIT_MILLISECONDS:
+                std::printf("%-16s avg %9.3f ms  max %9.3f ms  (%llu samples)  last %d: p50 %9.3f ms  p99 %9.3f ms\n",
+                    GetMetricName(id), summary.runAverage, summary.runMax, (unsigned long long)summary.numSamples,
+                    summary.numWindowSamples, summary.p50, summary.p99);
+                break;
+
+            case METRIC_UNIT_COUNT:
+                std::printf("%-16s avg %9.4g     max %9.4g     (%llu samples)  last %d: p50 %9.4g     p99 %9.4g\n",
+                    GetMetricName(id), summary.runAverage, summary.runMax, (unsigned long long)summary.numSamples,
+                    summary.numWindowSamples, summary.p50, summary.p99);
+                break;
+
+            case METRIC_UNIT_BYTES_PER_TICK:
+                std::printf("%-16s avg %9.3f KB  max %9.3f KB  (%llu samples)  last %d: p50 %9.3f KB  p99 %9.3f KB\n",
+                    GetMetricName(id), summary.runAverage / 1024.0, summary.runMax / 1024.0,
+                    (unsigned long long)summary.numSamples, summary.numWindowSamples, summary.p50 / 1024.0,
+                    summary.p99 / 1024.0);
+                break;
+
+            case METRIC_UNIT_BYTES:
+                std::printf("%-16s %.2f MB\n", GetMetricName(id), summary.last / (1024.0 * 1024.0));
+                break;
+        }
+    }
+}
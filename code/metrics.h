@@ -0,0 +1,99 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+
+// One registry of per-tick measurements shared by the on-screen HUD, headless runs and the benchmarks, so they all
+// report the same numbers. Every metric keeps a rolling window of its most recent samples for averages and
+// percentiles, plus running totals over the whole run.
+
+enum MetricId
+{
+    METRIC_SIM_TIME,
+    // From finding the boids' cells to filling the last of them, whether the grid was updated or rebuilt (see grid.h).
+    METRIC_GRID_TIME,
+    METRIC_RENDER_PREP_TIME,
+    METRIC_DRAW_TIME,
+    METRIC_NEIGHBORS_MEAN,
+    METRIC_NEIGHBORS_MAX,
+    METRIC_GRID_CELL_MAX,
+    // Boids that changed grid cell, on ticks where the grid was updated rather than rebuilt (see grid.h).
+    METRIC_GRID_MOVERS,
+    METRIC_MEMORY_USED,
+    // At the end of each load balancing window, the dearest part's cost over the average (see balance.h).
+    METRIC_LOAD_IMBALANCE,
+    // Per tick in a run split into domains (see domain.h), for this process's domain: the bytes it sent to the others,
+    // and how long it waited for them.
+    METRIC_DOMAIN_SENT,
+    METRIC_DOMAIN_WAIT_TIME,
+
+    // Hardware counters per simulation stage, recorded only when perf counters are enabled. Each stage has one
+    // metric per PerfCounter, in the same order.
+    METRIC_GRID_CYCLES,
+    METRIC_GRID_INSTRUCTIONS,
+    METRIC_GRID_L1D_MISSES,
+    METRIC_GRID_LLC_MISSES,
+    METRIC_GRID_BRANCH_MISSES,
+    METRIC_STEER_CYCLES,
+    METRIC_STEER_INSTRUCTIONS,
+    METRIC_STEER_L1D_MISSES,
+    METRIC_STEER_LLC_MISSES,
+    METRIC_STEER_BRANCH_MISSES,
+    METRIC_HASH_CYCLES,
+    METRIC_HASH_INSTRUCTIONS,
+    METRIC_HASH_L1D_MISSES,
+    METRIC_HASH_LLC_MISSES,
+    METRIC_HASH_BRANCH_MISSES,
+
+    METRIC_COUNT
+};
+
+enum MetricUnit
+{
+    METRIC_UNIT_MILLISECONDS,
+    METRIC_UNIT_COUNT,
+    METRIC_UNIT_BYTES, // A level, such as memory in use, of which only the latest sample is printed.
+    METRIC_UNIT_BYTES_PER_TICK, // An amount per sample, summarized like the others and printed in KB.
+};
+
+constexpr int metricWindowSize = 240;
+
+// `average` to `max` are over the rolling window of the last numWindowSamples samples.
+struct MetricSummary
+{
+    double last;
+    double average;
+    double p50;
+    double p99;
+    double max;
+    int numWindowSamples;
+    uint64_t numSamples; // Over the whole run.
+    double runAverage; // Over the whole run.
+    double runMax; // Over the whole run.
+};
+
+void RecordMetric(const MetricId id, const double value);
+const char* GetMetricName(const MetricId id);
+MetricUnit GetMetricUnit(const MetricId id);
+MetricSummary SummarizeMetric(const MetricId id);
+// Copies out the samples in the rolling window, oldest first, and returns how many there are.
+int GetMetricHistory(const MetricId id, double* samples);
+void ResetMetrics();
+// Prints a summary line for every metric that has samples: the average and maximum over the whole run, and the
+// percentiles of the rolling window.
+void PrintMetrics();
+
+inline double MillisecondsSince(const std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Times a scope in milliseconds into a metric.
+struct MetricTimer
+{
+    MetricId id;
+    std::chrono::steady_clock::time_point start;
+
+    explicit MetricTimer(const MetricId metricId) : id(metricId), start(std::chrono::steady_clock::now()) {}
+    ~MetricTimer() { RecordMetric(id, MillisecondsSince(start)); }
+};
@@ -0,0 +1,314 @@
+#include "params.h"
+
+#include <cctype>
+#include <cmath>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+namespace
+{
+    struct SimParamInfo
+    {
+        const char* name;
+        size_t offset;
+        float min;
+        float max;
+    };
+
+    constexpr SimParamInfo simParamInfos[SIM_PARAM_COUNT] =
+    {
+        { "alignRadius", offsetof(SimParams, alignRadius), 0.1f, 1000.0f },
+        { "cohereRadius", offsetof(SimParams, cohereRadius), 0.1f, 1000.0f },
+        { "separationDistance", offsetof(SimParams, separationDistance), 0.1f, 1000.0f },
+        { "alignWeight", offsetof(SimParams, alignWeight), 0.0f, 10.0f },
+        { "cohereWeight", offsetof(SimParams, cohereWeight), 0.0f, 10.0f },
+        { "separateWeight", offsetof(SimParams, separateWeight), 0.0f, 10.0f },
+        { "maxForce", offsetof(SimParams, maxForce), 0.0001f, 10.0f },
+        { "maxSpeed", offsetof(SimParams, maxSpeed), 0.01f, 100.0f },
+        { "boundaryThreshold", offsetof(SimParams, boundaryThreshold), 0.1f, 1000.0f },
+    };
+
+    constexpr const char* neighborModeNames[NEIGHBOR_MODE_COUNT] = { "metric", "topological" };
+    constexpr const char* boundaryModeNames[BOUNDARY_MODE_COUNT] = { "steer", "wrap", "clamp" };
+
+    constexpr int maxNumBoids = 1 << 28;
+    constexpr float minWorldSize = 1.0f;
+    constexpr float maxWorldSize = 1000000.0f;
+
+    float* GetSimParamField(SimParams* params, const SimParamId id)
+    {
+        return (float*)((char*)params + simParamInfos[id].offset);
+    }
+
+    bool ParseFloat(const char* text, float* value)
+    {
+        char* end = nullptr;
+        const float parsed = std::strtof(text, &end);
+        // strtof also reads "nan" and "inf", which would get past the clamps below, since every comparison with NaN is
+        // false, and out of range values come back as infinity.
+        if (end == text || *end != '\0' || !std::isfinite(parsed))
+        {
+            return false;
+        }
+
+        *value = parsed;
+        return true;
+    }
+
+    // A comma separated list of rule names, or "none".
+    bool ParseRules(const char* text, uint32_t* rules)
+    {
+        char buffer[128];
+        std::snprintf(buffer, sizeof(buffer), "%s", text);
+
+        uint32_t parsed = 0;
+        for (char* name = std::strtok(buffer, ", "); name; name = std::strtok(nullptr, ", "))
+        {
+            if (std::strcmp(name, "align") == 0)
+            {
+                parsed |= SIM_RULE_ALIGN;
+            }
+            else if (std::strcmp(name, "cohere") == 0)
+            {
+                parsed |= SIM_RULE_COHERE;
+            }
+            else if (std::strcmp(name, "separate") == 0)
+            {
+                parsed |= SIM_RULE_SEPARATE;
+            }
+            else if (std::strcmp(name, "none") != 0)
+            {
+                return false;
+            }
+        }
+
+        *rules = parsed;
+        return true;
+    }
+
+    // Returns the index of `text` in `names`, or -1.
+    int FindName(const char* text, const char* const* names, const int count)
+    {
+        for (int i = 0; i < count; i++)
+        {
+            if (std::strcmp(text, names[i]) == 0)
+            {
+                return i;
+            }
+        }
+
+        return -1;
+    }
+
+    // Trims whitespace from both ends in place.
+    char* Trim(char* text)
+    {
+        while (std::isspace((unsigned char)*text))
+        {
+            text++;
+        }
+
+        char* end = text + std::strlen(text);
+        while (end > text && std::isspace((unsigned char)end[-1]))
+        {
+            *--end = '\0';
+        }
+
+        return text;
+    }
+}
+
+SimParams DefaultSimParams()
+{
+    SimParams params = {};
+    params.alignRadius = 16.0f;
+    params.cohereRadius = 16.0f;
+    params.separationDistance = 20.0f;
+    params.alignWeight = 1.0f;
+    params.cohereWeight = 1.0f;
+    params.separateWeight = 1.0f;
+    params.maxForce = 0.05f;
+    params.maxSpeed = 5.0f;
+    params.boundaryThreshold = 5.0f;
+
+    params.rules = SIM_RULE_ALL;
+    params.neighborMode = NEIGHBOR_MODE_METRIC;
+    params.topologicalNeighbors = 7;
+    params.boundaryMode = BOUNDARY_MODE_STEER;
+
+    UpdateDerivedSimParams(&params);
+    return params;
+}
+
+SimConfig DefaultSimConfig()
+{
+    SimConfig config = {};
+    config.numBoids = 300;
+    config.worldSize = 200.0f;
+    config.params = DefaultSimParams();
+
+    return config;
+}
+
+void UpdateDerivedSimParams(SimParams* params)
+{
+    params->alignRadiusSquared = params->alignRadius * params->alignRadius;
+    params->cohereRadiusSquared = params->cohereRadius * params->cohereRadius;
+    params->separationDistanceSquared = params->separationDistance * params->separationDistance;
+    params->inverseBoundaryThreshold = 1.0f / params->boundaryThreshold;
+}
+
+const char* GetSimParamName(const SimParamId id)
+{
+    return simParamInfos[id].name;
+}
+
+float GetSimParam(const SimParams* params, const SimParamId id)
+{
+    return *GetSimParamField((SimParams*)params, id);
+}
+
+void SetSimParam(SimParams* params, const SimParamId id, const float value)
+{
+    // Snapshots hand over their stored values unparsed, so this checks too.
+    if (!std::isfinite(value))
+    {
+        return;
+    }
+
+    const SimParamInfo& info = simParamInfos[id];
+    *GetSimParamField(params, id) = (value < info.min) ? info.min : ((value > info.max) ? info.max : value);
+
+    UpdateDerivedSimParams(params);
+}
+
+const char* GetNeighborModeName(const NeighborMode mode)
+{
+    return neighborModeNames[mode];
+}
+
+const char* GetBoundaryModeName(const BoundaryMode mode)
+{
+    return boundaryModeNames[mode];
+}
+
+bool ApplySimSetting(SimConfig* config, const char* name, const char* value)
+{
+    SimParams& params = config->params;
+
+    if (std::strcmp(name, "rules") == 0)
+    {
+        return ParseRules(value, &params.rules);
+    }
+
+    if (std::strcmp(name, "neighborMode") == 0)
+    {
+        const int mode = FindName(value, neighborModeNames, NEIGHBOR_MODE_COUNT);
+        params.neighborMode = (mode >= 0) ? (NeighborMode)mode : params.neighborMode;
+        return mode >= 0;
+    }
+
+    if (std::strcmp(name, "boundaryMode") == 0)
+    {
+        const int mode = FindName(value, boundaryModeNames, BOUNDARY_MODE_COUNT);
+        params.boundaryMode = (mode >= 0) ? (BoundaryMode)mode : params.boundaryMode;
+        return mode >= 0;
+    }
+
+    float number = 0.0f;
+    if (!ParseFloat(value, &number))
+    {
+        return false;
+    }
+
+    if (std::strcmp(name, "boids") == 0)
+    {
+        config->numBoids = (number < 1.0f) ? 1 : ((number > (float)maxNumBoids) ? maxNumBoids : (int)number);
+        return true;
+    }
+
+    if (std::strcmp(name, "topologicalNeighbors") == 0)
+    {
+        params.topologicalNeighbors = (number < 1.0f) ? 1 :
+            ((number > (float)maxTopologicalNeighbors) ? maxTopologicalNeighbors : (int)number);
+        return true;
+    }
+
+    if (std::strcmp(name, "viewRadius") == 0)
+    {
+        SetSimParam(&params, SIM_PARAM_ALIGN_RADIUS, number);
+        SetSimParam(&params, SIM_PARAM_COHERE_RADIUS, number);
+        return true;
+    }
+
+    if (std::strcmp(name, "worldSize") == 0)
+    {
+        config->worldSize = (number < minWorldSize) ? minWorldSize : ((number > maxWorldSize) ? maxWorldSize : number);
+        return true;
+    }
+
+    for (int i = 0; i < SIM_PARAM_COUNT; i++)
+    {
+        if (std::strcmp(name, simParamInfos[i].name) == 0)
+        {
+            SetSimParam(&config->params, (SimParamId)i, number);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool ApplySimSetting(SimConfig* config, const char* assignment)
+{
+    char buffer[256];
+    std::snprintf(buffer, sizeof(buffer), "%s", assignment);
+
+    char* equals = std::strchr(buffer, '=');
+    if (!equals)
+    {
+        return false;
+    }
+
+    *equals = '\0';
+    return ApplySimSetting(config, Trim(buffer), Trim(equals + 1));
+}
+
+bool LoadSimConfig(const char* path, SimConfig* config)
+{
+    std::FILE* file = std::fopen(path, "r");
+    if (!file)
+    {
+        std::printf("ERROR: Could not open config '%s'.\n", path);
+        return false;
+    }
+
+    char line[256];
+    int lineNumber = 0;
+    while (std::fgets(line, sizeof(line), file))
+    {
+        lineNumber++;
+
+        char* comment = std::strchr(line, '#');
+        if (comment)
+        {
+            *comment = '\0';
+        }
+
+        const char* text = Trim(line);
+        if (*text == '\0')
+        {
+            continue;
+        }
+
+        if (!ApplySimSetting(config, text))
+        {
+            std::printf("WARNING: Ignoring line %d of '%s': '%s'.\n", lineNumber, path, text);
+        }
+    }
+
+    std::fclose(file);
+    return true;
+}
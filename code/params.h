@@ -0,0 +1,60 @@
+#pragma once
+
+#include "game.h"
+
+// Runtime configuration of the simulation. A config file is plain text with one `name = value` per line and `#`
+// starting a comment, for example:
+//
+//   boids = 2000
+//   worldSize = 400
+//   alignRadius = 12
+//   separateWeight = 1.5
+//   rules = align, separate
+//   neighborMode = topological
+//   topologicalNeighbors = 7
+//   boundaryMode = wrap
+//
+// `viewRadius` sets alignRadius and cohereRadius together. The same names can be given on the command line with
+// --set name=value. The flock size and world size only take effect at startup; the SimParams can also be changed
+// while running.
+
+struct SimConfig
+{
+    int numBoids;
+    float worldSize; // Edge length of the world cube. GameState::worldSize holds half of it.
+    SimParams params;
+};
+
+SimParams DefaultSimParams();
+SimConfig DefaultSimConfig();
+void UpdateDerivedSimParams(SimParams* params);
+
+enum SimParamId
+{
+    SIM_PARAM_ALIGN_RADIUS,
+    SIM_PARAM_COHERE_RADIUS,
+    SIM_PARAM_SEPARATION_DISTANCE,
+    SIM_PARAM_ALIGN_WEIGHT,
+    SIM_PARAM_COHERE_WEIGHT,
+    SIM_PARAM_SEPARATE_WEIGHT,
+    SIM_PARAM_MAX_FORCE,
+    SIM_PARAM_MAX_SPEED,
+    SIM_PARAM_BOUNDARY_THRESHOLD,
+
+    SIM_PARAM_COUNT
+};
+
+const char* GetSimParamName(const SimParamId id);
+float GetSimParam(const SimParams* params, const SimParamId id);
+// Clamps the value to the parameter's valid range and updates the derived values. NaN and infinity are ignored.
+void SetSimParam(SimParams* params, const SimParamId id, const float value);
+
+const char* GetNeighborModeName(const NeighborMode mode);
+const char* GetBoundaryModeName(const BoundaryMode mode);
+
+// Sets one setting by name. Returns false if the name is unknown or the value is invalid.
+bool ApplySimSetting(SimConfig* config, const char* name, const char* value);
+// Same, from a single "name=value" string.
+bool ApplySimSetting(SimConfig* config, const char* assignment);
+// Applies every setting in a config file on top of `config`. Bad lines are reported and skipped.
+bool LoadSimConfig(const char* path, SimConfig* config);
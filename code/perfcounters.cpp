@@ -0,0 +1,214 @@
+#include "perfcounters.h"
+
+#include <cstdio>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#endif
+
+namespace
+{
+    constexpr const char* perfCounterNames[PERF_COUNTER_COUNT] =
+    {
+        "cycles",
+        "instructions",
+        "l1d_misses",
+        "llc_misses",
+        "branch_misses",
+    };
+
+    char perfCounterError[160] = "hardware counters are only supported on Linux";
+
+#if defined(__linux__)
+    struct PerfEvent
+    {
+        uint32_t type;
+        uint64_t config;
+    };
+
+    constexpr uint64_t CacheReadMiss(const uint64_t cache)
+    {
+        return cache | ((uint64_t)PERF_COUNT_HW_CACHE_OP_READ << 8) | ((uint64_t)PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    }
+
+    constexpr PerfEvent perfEvents[PERF_COUNTER_COUNT] =
+    {
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+        { PERF_TYPE_HW_CACHE, CacheReadMiss(PERF_COUNT_HW_CACHE_L1D) },
+        { PERF_TYPE_HW_CACHE, CacheReadMiss(PERF_COUNT_HW_CACHE_LL) },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+    };
+
+    // All counters of a thread are opened as one group, so they are scheduled onto the PMU together and read with a
+    // single syscall.
+    struct PerfCounterGroup
+    {
+        int fds[PERF_COUNTER_COUNT] = { -1, -1, -1, -1, -1 };
+        uint64_t ids[PERF_COUNTER_COUNT];
+        int leader = -1;
+        int numOpen = 0;
+    };
+
+    thread_local PerfCounterGroup perfCounterGroup;
+
+    int OpenPerfEvent(const PerfEvent& event, const int groupFd)
+    {
+        perf_event_attr attr = {};
+        attr.size = sizeof(attr);
+        attr.type = event.type;
+        attr.config = event.config;
+        attr.disabled = (groupFd == -1) ? 1 : 0;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_ID | PERF_FORMAT_TOTAL_TIME_ENABLED |
+            PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+        return (int)syscall(SYS_perf_event_open, &attr, 0, -1, groupFd, 0);
+    }
+#endif
+}
+
+bool EnablePerfCounters()
+{
+#if defined(__linux__)
+    PerfCounterGroup& group = perfCounterGroup;
+    if (group.numOpen > 0)
+    {
+        return true;
+    }
+
+    int firstError = 0;
+    for (int i = 0; i < PERF_COUNTER_COUNT; i++)
+    {
+        const int fd = OpenPerfEvent(perfEvents[i], group.leader);
+        if (fd == -1)
+        {
+            // Counters the CPU doesn't have are left out; the rest still work.
+            firstError = (firstError == 0) ? errno : firstError;
+            continue;
+        }
+
+        if (ioctl(fd, PERF_EVENT_IOC_ID, &group.ids[i]) == -1)
+        {
+            close(fd);
+            continue;
+        }
+
+        group.fds[i] = fd;
+        group.leader = (group.leader == -1) ? fd : group.leader;
+        group.numOpen++;
+    }
+
+    if (group.numOpen == 0)
+    {
+        std::snprintf(perfCounterError, sizeof(perfCounterError), "perf_event_open failed: %s",
+            std::strerror(firstError));
+        return false;
+    }
+
+    ioctl(group.leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(group.leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    perfCounterError[0] = '\0';
+
+    return true;
+#else
+    return false;
+#endif
+}
+
+void DisablePerfCounters()
+{
+#if defined(__linux__)
+    PerfCounterGroup& group = perfCounterGroup;
+
+    // Members first, the leader last.
+    for (int i = PERF_COUNTER_COUNT - 1; i >= 0; i--)
+    {
+        if (group.fds[i] != -1 && group.fds[i] != group.leader)
+        {
+            close(group.fds[i]);
+        }
+    }
+
+    if (group.leader != -1)
+    {
+        close(group.leader);
+    }
+
+    group = PerfCounterGroup();
+#endif
+}
+
+bool PerfCountersEnabled()
+{
+#if defined(__linux__)
+    return perfCounterGroup.numOpen > 0;
+#else
+    return false;
+#endif
+}
+
+const char* GetPerfCounterError()
+{
+    return perfCounterError;
+}
+
+const char* GetPerfCounterName(const PerfCounter counter)
+{
+    return perfCounterNames[counter];
+}
+
+bool ReadPerfCounters(PerfCounterValues* values)
+{
+#if defined(__linux__)
+    const PerfCounterGroup& group = perfCounterGroup;
+    if (group.numOpen == 0)
+    {
+        return false;
+    }
+
+    // PERF_FORMAT_GROUP layout: count, time enabled, time running, then a (value, id) pair per counter.
+    uint64_t buffer[3 + 2 * PERF_COUNTER_COUNT];
+    const ssize_t size = read(group.leader, buffer, sizeof(buffer));
+    if (size < (ssize_t)(3 * sizeof(uint64_t)))
+    {
+        return false;
+    }
+
+    const uint64_t numValues = buffer[0];
+    const uint64_t timeEnabled = buffer[1];
+    const uint64_t timeRunning = buffer[2];
+
+    // When there are more counters than the PMU can hold at once the kernel time-slices them; scale up to an estimate
+    // of the full count.
+    const double scale = (timeRunning > 0 && timeRunning < timeEnabled) ? (double)timeEnabled / timeRunning : 1.0;
+
+    *values = {};
+    for (uint64_t v = 0; v < numValues && v < PERF_COUNTER_COUNT; v++)
+    {
+        const uint64_t value = buffer[3 + 2 * v];
+        const uint64_t id = buffer[3 + 2 * v + 1];
+
+        for (int i = 0; i < PERF_COUNTER_COUNT; i++)
+        {
+            if (group.fds[i] != -1 && group.ids[i] == id)
+            {
+                values->counts[i] = (scale == 1.0) ? value : (uint64_t)(value * scale);
+                values->availableMask |= 1u << i;
+            }
+        }
+    }
+
+    return values->availableMask != 0;
+#else
+    (void)values;
+    return false;
+#endif
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstdint>
+
+#include "metrics.h"
+
+// Optional hardware performance counters, read with perf_event_open on Linux. Counters are opened per thread and only
+// count that thread's user-space work; a job system's workers open their own when the thread that started it had them
+// open. Where they can't be opened (other platforms, no PMU in a virtual machine, or a restrictive perf_event_paranoid)
+// every call below does nothing and nothing is recorded.
+
+enum PerfCounter
+{
+    PERF_COUNTER_CYCLES,
+    PERF_COUNTER_INSTRUCTIONS,
+    PERF_COUNTER_L1D_MISSES,
+    PERF_COUNTER_LLC_MISSES,
+    PERF_COUNTER_BRANCH_MISSES,
+
+    PERF_COUNTER_COUNT
+};
+
+struct PerfCounterValues
+{
+    uint64_t counts[PERF_COUNTER_COUNT];
+    uint32_t availableMask; // Bit i is set if counts[i] was read.
+};
+
+// Opens the counters for the calling thread. Returns false, with the reason in GetPerfCounterError(), if none of
+// them could be opened.
+bool EnablePerfCounters();
+void DisablePerfCounters();
+bool PerfCountersEnabled();
+const char* GetPerfCounterError();
+const char* GetPerfCounterName(const PerfCounter counter);
+
+// Reads the running totals of the calling thread's counters. Returns false if it has none open.
+bool ReadPerfCounters(PerfCounterValues* values);
+
+// Counts a scope into PERF_COUNTER_COUNT consecutive metrics starting at `firstMetric`, in PerfCounter order.
+struct PerfCounterScope
+{
+    MetricId firstMetric;
+    bool started;
+    PerfCounterValues start;
+
+    explicit PerfCounterScope(const MetricId firstMetricId) : firstMetric(firstMetricId)
+    {
+        started = ReadPerfCounters(&start);
+    }
+
+    ~PerfCounterScope()
+    {
+        PerfCounterValues end;
+        if (!started || !ReadPerfCounters(&end))
+        {
+            return;
+        }
+
+        for (int i = 0; i < PERF_COUNTER_COUNT; i++)
+        {
+            // Multiplexed counts are scaled estimates and can step backwards slightly between two reads.
+            if ((end.availableMask & (1u << i)) && end.counts[i] >= start.counts[i])
+            {
+                RecordMetric((MetricId)(firstMetric + i), (double)(end.counts[i] - start.counts[i]));
+            }
+        }
+    }
+};
@@ -0,0 +1,718 @@
+#include "platform.h"
+
+#include <cstdio>
+#include <cstring>
+
+int PlatformParseCpuList(const char* text, int* cpus, const int maxCpus)
+{
+    int count = 0;
+    const char* cursor = text;
+
+    for (;;)
+    {
+        int first = 0;
+        int last = 0;
+        int length = 0;
+
+        if (std::sscanf(cursor, "%d-%d%n", &first, &last, &length) != 2)
+        {
+            if (std::sscanf(cursor, "%d%n", &first, &length) != 1)
+            {
+                break;
+            }
+            last = first;
+        }
+
+        for (int cpu = first; cpu <= last && count < maxCpus; cpu++)
+        {
+            cpus[count++] = cpu;
+        }
+
+        cursor += length;
+        if (*cursor != ',')
+        {
+            break;
+        }
+        cursor++;
+    }
+
+    return count;
+}
+
+#if defined(_WIN32)
+
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
+
+namespace
+{
+    bool MapView(PlatformMappedFile* file, const size_t size)
+    {
+        const DWORD protect = file->writable ? PAGE_READWRITE : PAGE_READONLY;
+        const DWORD access = file->writable ? FILE_MAP_WRITE : FILE_MAP_READ;
+
+        HANDLE mapping = CreateFileMappingA(
+            (HANDLE)file->fileHandle, nullptr, protect, (DWORD)((uint64_t)size >> 32), (DWORD)size, nullptr);
+        if (!mapping)
+        {
+            return false;
+        }
+
+        void* data = MapViewOfFile(mapping, access, 0, 0, size);
+        if (!data)
+        {
+            CloseHandle(mapping);
+            return false;
+        }
+
+        file->mappingHandle = (intptr_t)mapping;
+        file->data = data;
+        file->size = size;
+        return true;
+    }
+
+    void UnmapView(PlatformMappedFile* file)
+    {
+        if (file->data)
+        {
+            UnmapViewOfFile(file->data);
+            CloseHandle((HANDLE)file->mappingHandle);
+        }
+
+        file->data = nullptr;
+        file->mappingHandle = 0;
+    }
+}
+
+void* PlatformAllocateMemory(const size_t size)
+{
+    return VirtualAlloc(nullptr, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+}
+
+void PlatformFreeMemory(void* memory, const size_t)
+{
+    VirtualFree(memory, 0, MEM_RELEASE);
+}
+
+void* PlatformAllocateSharedMemory(const size_t)
+{
+    return nullptr;
+}
+
+int PlatformForkProcess()
+{
+    return -1;
+}
+
+bool PlatformWaitForProcess(const int)
+{
+    return false;
+}
+
+int PlatformListenSocket(const char*)
+{
+    return -1;
+}
+
+int PlatformAcceptSocket(const int)
+{
+    return -1;
+}
+
+int PlatformConnectSocket(const char*)
+{
+    return -1;
+}
+
+int64_t PlatformSendSocket(const int, const void*, const size_t, const bool)
+{
+    return -1;
+}
+
+int64_t PlatformReceiveSocket(const int, void*, const size_t, const bool)
+{
+    return -1;
+}
+
+void PlatformCloseSocket(const int)
+{
+}
+
+bool PlatformMapFile(const char* path, PlatformMappedFile* file)
+{
+    *file = {};
+
+    HANDLE handle = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr,
+        OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (handle == INVALID_HANDLE_VALUE)
+    {
+        return false;
+    }
+
+    LARGE_INTEGER fileSize = {};
+    file->fileHandle = (intptr_t)handle;
+
+    if (!GetFileSizeEx(handle, &fileSize) || fileSize.QuadPart == 0 || !MapView(file, (size_t)fileSize.QuadPart))
+    {
+        CloseHandle(handle);
+        *file = {};
+        return false;
+    }
+
+    return true;
+}
+
+bool PlatformCreateMappedFile(const char* path, const size_t size, PlatformMappedFile* file)
+{
+    *file = {};
+
+    HANDLE handle = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr,
+        CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (handle == INVALID_HANDLE_VALUE)
+    {
+        return false;
+    }
+
+    file->fileHandle = (intptr_t)handle;
+    file->writable = true;
+
+    // Creating a mapping larger than the file extends the file.
+    if (!MapView(file, size))
+    {
+        CloseHandle(handle);
+        *file = {};
+        return false;
+    }
+
+    return true;
+}
+
+bool PlatformResizeMappedFile(PlatformMappedFile* file, const size_t size)
+{
+    UnmapView(file);
+
+    LARGE_INTEGER newSize = {};
+    newSize.QuadPart = (LONGLONG)size;
+
+    // Shrinking has to be done on the file itself, a mapping can only grow it.
+    if (!SetFilePointerEx((HANDLE)file->fileHandle, newSize, nullptr, FILE_BEGIN) ||
+        !SetEndOfFile((HANDLE)file->fileHandle))
+    {
+        return false;
+    }
+
+    return MapView(file, size);
+}
+
+void PlatformUnmapFile(PlatformMappedFile* file)
+{
+    UnmapView(file);
+
+    if (file->fileHandle)
+    {
+        CloseHandle((HANDLE)file->fileHandle);
+    }
+
+    *file = {};
+}
+
+void PlatformPrefetchMappedRange(const PlatformMappedFile* file, const size_t offset, const size_t size)
+{
+    WIN32_MEMORY_RANGE_ENTRY range = {};
+    range.VirtualAddress = (uint8_t*)file->data + offset;
+    range.NumberOfBytes = size;
+    PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+}
+
+void PlatformEvictMappedRange(const PlatformMappedFile* file, const size_t offset, const size_t size)
+{
+    // Unlocking pages that are not locked removes them from the working set, which is exactly what we want here.
+    VirtualUnlock((uint8_t*)file->data + offset, size);
+}
+
+int PlatformGetNumaNodeCount()
+{
+    ULONG highestNode = 0;
+    return GetNumaHighestNodeNumber(&highestNode) ? (int)highestNode + 1 : 1;
+}
+
+bool PlatformBindThreadToNumaNode(const int node)
+{
+    GROUP_AFFINITY affinity = {};
+    if (!GetNumaNodeProcessorMaskEx((USHORT)node, &affinity) || affinity.Mask == 0)
+    {
+        return false;
+    }
+
+    return SetThreadGroupAffinity(GetCurrentThread(), &affinity, nullptr) != 0;
+}
+
+int PlatformGetCpuNumaNode(const int cpu)
+{
+    // Processors are numbered across groups of 64, the way the Task Manager and the cpu lists count them.
+    PROCESSOR_NUMBER processor = {};
+    processor.Group = (WORD)(cpu / 64);
+    processor.Number = (BYTE)(cpu % 64);
+
+    USHORT node = 0;
+    return GetNumaProcessorNodeEx(&processor, &node) ? (int)node : 0;
+}
+
+bool PlatformPinThreadToCpu(std::thread* thread, const int cpu)
+{
+    if (cpu < 0)
+    {
+        return false;
+    }
+
+    GROUP_AFFINITY affinity = {};
+    affinity.Group = (WORD)(cpu / 64);
+    affinity.Mask = (KAFFINITY)1 << (cpu % 64);
+
+    return SetThreadGroupAffinity((HANDLE)thread->native_handle(), &affinity, nullptr) != 0;
+}
+
+bool PlatformSetThreadRealtimePriority(std::thread* thread)
+{
+    // The highest priority a thread can have without raising the whole process to the real-time class, which needs
+    // administrator rights.
+    return SetThreadPriority((HANDLE)thread->native_handle(), THREAD_PRIORITY_TIME_CRITICAL) != 0;
+}
+
+#else
+
+#include <cerrno>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace
+{
+    struct SocketAddress
+    {
+        int family;
+        sockaddr_storage address;
+        socklen_t size;
+    };
+
+    bool ResolveSocketAddress(const char* address, SocketAddress* socketAddress)
+    {
+        constexpr const char* unixPrefix = "unix:";
+        const size_t unixPrefixLength = std::strlen(unixPrefix);
+
+        if (std::strncmp(address, unixPrefix, unixPrefixLength) == 0)
+        {
+            sockaddr_un* unixAddress = (sockaddr_un*)&socketAddress->address;
+            const char* path = address + unixPrefixLength;
+            if (std::strlen(path) >= sizeof(unixAddress->sun_path))
+            {
+                return false;
+            }
+
+            unixAddress->sun_family = AF_UNIX;
+            std::strcpy(unixAddress->sun_path, path);
+            socketAddress->family = AF_UNIX;
+            socketAddress->size = sizeof(sockaddr_un);
+            return true;
+        }
+
+        const char* colon = std::strrchr(address, ':');
+        if (!colon || colon == address)
+        {
+            return false;
+        }
+
+        char host[256] = {};
+        const size_t hostLength = (size_t)(colon - address);
+        if (hostLength >= sizeof(host))
+        {
+            return false;
+        }
+        std::memcpy(host, address, hostLength);
+
+        addrinfo hints = {};
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+
+        addrinfo* found = nullptr;
+        if (getaddrinfo(host, colon + 1, &hints, &found) != 0 || !found)
+        {
+            return false;
+        }
+
+        socketAddress->family = found->ai_family;
+        std::memcpy(&socketAddress->address, found->ai_addr, found->ai_addrlen);
+        socketAddress->size = (socklen_t)found->ai_addrlen;
+        freeaddrinfo(found);
+        return true;
+    }
+
+    // Messages between domains are latency bound, so they go out as soon as they are written.
+    void SetSocketNoDelay(const int socket)
+    {
+        const int noDelay = 1;
+        setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+    }
+
+    bool MapView(PlatformMappedFile* file, const size_t size)
+    {
+        const int protect = file->writable ? (PROT_READ | PROT_WRITE) : PROT_READ;
+
+        void* data = mmap(nullptr, size, protect, MAP_SHARED, (int)file->fileHandle, 0);
+        if (data == MAP_FAILED)
+        {
+            return false;
+        }
+
+        file->data = data;
+        file->size = size;
+        return true;
+    }
+
+    void UnmapView(PlatformMappedFile* file)
+    {
+        if (file->data)
+        {
+            munmap(file->data, file->size);
+        }
+
+        file->data = nullptr;
+    }
+}
+
+void* PlatformAllocateMemory(const size_t size)
+{
+    void* memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return (memory == MAP_FAILED) ? nullptr : memory;
+}
+
+void PlatformFreeMemory(void* memory, const size_t size)
+{
+    munmap(memory, size);
+}
+
+void* PlatformAllocateSharedMemory(const size_t size)
+{
+    void* memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    return (memory == MAP_FAILED) ? nullptr : memory;
+}
+
+int PlatformForkProcess()
+{
+    return (int)fork();
+}
+
+bool PlatformWaitForProcess(const int process)
+{
+    int status = 0;
+    return waitpid((pid_t)process, &status, 0) == (pid_t)process && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+int PlatformListenSocket(const char* address)
+{
+    SocketAddress socketAddress = {};
+    if (!ResolveSocketAddress(address, &socketAddress))
+    {
+        return -1;
+    }
+
+    const int listener = socket(socketAddress.family, SOCK_STREAM, 0);
+    if (listener < 0)
+    {
+        return -1;
+    }
+
+    // A listener from an earlier run may have left its port waiting to close, or its path behind.
+    const int reuse = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    if (socketAddress.family == AF_UNIX)
+    {
+        unlink(((const sockaddr_un*)&socketAddress.address)->sun_path);
+    }
+
+    if (bind(listener, (const sockaddr*)&socketAddress.address, socketAddress.size) != 0 ||
+        listen(listener, SOMAXCONN) != 0)
+    {
+        close(listener);
+        return -1;
+    }
+
+    return listener;
+}
+
+int PlatformAcceptSocket(const int listener)
+{
+    const int connection = accept(listener, nullptr, nullptr);
+    if (connection >= 0)
+    {
+        SetSocketNoDelay(connection);
+    }
+
+    return connection;
+}
+
+int PlatformConnectSocket(const char* address)
+{
+    SocketAddress socketAddress = {};
+    if (!ResolveSocketAddress(address, &socketAddress))
+    {
+        return -1;
+    }
+
+    const int connection = socket(socketAddress.family, SOCK_STREAM, 0);
+    if (connection < 0)
+    {
+        return -1;
+    }
+
+    if (connect(connection, (const sockaddr*)&socketAddress.address, socketAddress.size) != 0)
+    {
+        close(connection);
+        return -1;
+    }
+
+    SetSocketNoDelay(connection);
+    return connection;
+}
+
+int64_t PlatformSendSocket(const int socket, const void* data, const size_t size, const bool wait)
+{
+    // No SIGPIPE when the other end has gone away; that shows up as an error instead.
+    const ssize_t sent = send(socket, data, size, MSG_NOSIGNAL | (wait ? 0 : MSG_DONTWAIT));
+    if (sent < 0)
+    {
+        return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? 0 : -1;
+    }
+
+    return sent;
+}
+
+int64_t PlatformReceiveSocket(const int socket, void* data, const size_t size, const bool wait)
+{
+    const ssize_t received = recv(socket, data, size, wait ? 0 : MSG_DONTWAIT);
+    if (received < 0)
+    {
+        return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? 0 : -1;
+    }
+
+    // A closed connection reads as zero bytes even when asked not to wait.
+    return (received == 0 && size > 0) ? -1 : received;
+}
+
+void PlatformCloseSocket(const int socket)
+{
+    if (socket >= 0)
+    {
+        close(socket);
+    }
+}
+
+bool PlatformMapFile(const char* path, PlatformMappedFile* file)
+{
+    *file = {};
+
+    const int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        return false;
+    }
+
+    struct stat fileStat = {};
+    file->fileHandle = fd;
+
+    if (fstat(fd, &fileStat) != 0 || fileStat.st_size == 0 || !MapView(file, (size_t)fileStat.st_size))
+    {
+        close(fd);
+        *file = {};
+        return false;
+    }
+
+    return true;
+}
+
+bool PlatformCreateMappedFile(const char* path, const size_t size, PlatformMappedFile* file)
+{
+    *file = {};
+
+    const int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        return false;
+    }
+
+    file->fileHandle = fd;
+    file->writable = true;
+
+    if (ftruncate(fd, (off_t)size) != 0 || !MapView(file, size))
+    {
+        close(fd);
+        *file = {};
+        return false;
+    }
+
+    return true;
+}
+
+bool PlatformResizeMappedFile(PlatformMappedFile* file, const size_t size)
+{
+    UnmapView(file);
+
+    if (ftruncate((int)file->fileHandle, (off_t)size) != 0)
+    {
+        return false;
+    }
+
+    return MapView(file, size);
+}
+
+void PlatformUnmapFile(PlatformMappedFile* file)
+{
+    UnmapView(file);
+
+    if (file->fileHandle)
+    {
+        close((int)file->fileHandle);
+    }
+
+    *file = {};
+}
+
+namespace
+{
+    void AdviseRange(const PlatformMappedFile* file, const size_t offset, const size_t size, const int advice)
+    {
+        const size_t pageSize = (size_t)sysconf(_SC_PAGESIZE);
+        const size_t begin = offset & ~(pageSize - 1);
+        size_t end = (offset + size + pageSize - 1) & ~(pageSize - 1);
+        end = (end > file->size) ? file->size : end;
+
+        if (begin < end)
+        {
+            madvise((uint8_t*)file->data + begin, end - begin, advice);
+        }
+    }
+}
+
+void PlatformPrefetchMappedRange(const PlatformMappedFile* file, const size_t offset, const size_t size)
+{
+    AdviseRange(file, offset, size, MADV_WILLNEED);
+}
+
+void PlatformEvictMappedRange(const PlatformMappedFile* file, const size_t offset, const size_t size)
+{
+    // The mapping is shared and clean, so the pages stay in the page cache and are simply unmapped from us.
+    AdviseRange(file, offset, size, MADV_DONTNEED);
+}
+
+namespace
+{
+    // Reads a cpu or node list file, which the kernel writes in the same format PlatformParseCpuList reads.
+    int ReadSysfsList(const char* path, int* values, const int maxValues)
+    {
+        std::FILE* file = std::fopen(path, "r");
+        if (!file)
+        {
+            return 0;
+        }
+
+        char text[1024] = {};
+        const bool read = std::fgets(text, sizeof(text), file) != nullptr;
+        std::fclose(file);
+
+        return read ? PlatformParseCpuList(text, values, maxValues) : 0;
+    }
+}
+
+int PlatformGetNumaNodeCount()
+{
+    int nodes[256];
+    const int count = ReadSysfsList("/sys/devices/system/node/online", nodes, 256);
+
+    int numNodes = 1;
+    for (int i = 0; i < count; i++)
+    {
+        numNodes = (nodes[i] + 1 > numNodes) ? nodes[i] + 1 : numNodes;
+    }
+
+    return numNodes;
+}
+
+int PlatformGetCpuNumaNode(const int cpu)
+{
+    const int numNodes = PlatformGetNumaNodeCount();
+    for (int node = 0; node < numNodes; node++)
+    {
+        char path[64];
+        std::snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+
+        int cpus[CPU_SETSIZE];
+        const int count = ReadSysfsList(path, cpus, CPU_SETSIZE);
+        for (int i = 0; i < count; i++)
+        {
+            if (cpus[i] == cpu)
+            {
+                return node;
+            }
+        }
+    }
+
+    return 0;
+}
+
+bool PlatformBindThreadToNumaNode(const int node)
+{
+    char path[64];
+    std::snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+
+    int nodeCpus[CPU_SETSIZE];
+    const int count = ReadSysfsList(path, nodeCpus, CPU_SETSIZE);
+
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    for (int i = 0; i < count; i++)
+    {
+        if (nodeCpus[i] < CPU_SETSIZE)
+        {
+            CPU_SET(nodeCpus[i], &cpus);
+        }
+    }
+
+    // With no thread id, sched_setaffinity applies to the calling thread only.
+    return CPU_COUNT(&cpus) > 0 && sched_setaffinity(0, sizeof(cpus), &cpus) == 0;
+}
+
+bool PlatformPinThreadToCpu(std::thread* thread, const int cpu)
+{
+    if (cpu < 0 || cpu >= CPU_SETSIZE)
+    {
+        return false;
+    }
+
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(cpu, &cpus);
+
+    return pthread_setaffinity_np(thread->native_handle(), sizeof(cpus), &cpus) == 0;
+}
+
+bool PlatformSetThreadRealtimePriority(std::thread* thread)
+{
+    // Low in the real-time range, which is still above every normal thread, so the kernel's own real-time threads
+    // keep their place. Needs CAP_SYS_NICE or an RLIMIT_RTPRIO allowance, and fails with EPERM otherwise.
+    sched_param param = {};
+    param.sched_priority = sched_get_priority_min(SCHED_FIFO) + 1;
+
+    return pthread_setschedparam(thread->native_handle(), SCHED_FIFO, &param) == 0;
+}
+
+#endif
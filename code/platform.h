@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <thread>
+
+// Thin wrapper over the few OS services the game needs, implemented for Win32 and POSIX in platform.cpp.
+
+void* PlatformAllocateMemory(const size_t size);
+void PlatformFreeMemory(void* memory, const size_t size);
+// Memory that stays shared with the child processes PlatformForkProcess starts after it is allocated. Freed with
+// PlatformFreeMemory. Only on POSIX; returns null on Windows.
+void* PlatformAllocateSharedMemory(const size_t size);
+
+// Starts a copy of this process, as fork() does: returns 0 in the copy, and an id for PlatformWaitForProcess in the
+// original. Returns -1 if it fails, and always on Windows. The copy should leave with std::_Exit, since everything
+// from before the fork is still the original's to clean up.
+int PlatformForkProcess();
+// Waits for a process started by PlatformForkProcess to exit. Returns true if it exited with status 0.
+bool PlatformWaitForProcess(const int process);
+
+// Stream sockets between processes, possibly on different machines. An address is "host:port" for TCP, or
+// "unix:<path>" for a Unix domain socket. Sockets are ints, -1 when a call fails. Only on POSIX; they all fail on
+// Windows.
+int PlatformListenSocket(const char* address);
+// Waits for the next connection to a listening socket.
+int PlatformAcceptSocket(const int listener);
+// A single attempt, which fails if nothing is listening at the address yet.
+int PlatformConnectSocket(const char* address);
+// Send and receive as much as they can. Without `wait` they return 0 instead of blocking; with it they block until
+// at least one byte has moved. Both return -1 when the connection is broken or closed.
+int64_t PlatformSendSocket(const int socket, const void* data, const size_t size, const bool wait);
+int64_t PlatformReceiveSocket(const int socket, void* data, const size_t size, const bool wait);
+void PlatformCloseSocket(const int socket);
+
+struct PlatformMappedFile
+{
+    void* data;
+    size_t size;
+    bool writable;
+    intptr_t fileHandle;
+    intptr_t mappingHandle; // Only used on Windows.
+};
+
+// Maps an existing file read-only. Pages are only read from disk as they are touched.
+bool PlatformMapFile(const char* path, PlatformMappedFile* file);
+// Creates (or truncates) a file of the given size and maps it read-write.
+bool PlatformCreateMappedFile(const char* path, const size_t size, PlatformMappedFile* file);
+// Grows or shrinks a writable mapping. `file->data` may move.
+bool PlatformResizeMappedFile(PlatformMappedFile* file, const size_t size);
+void PlatformUnmapFile(PlatformMappedFile* file);
+// Hints for streaming through a large mapping: start reading a range in ahead of time, or drop a range that is no
+// longer needed from the process' working set. Both round the range out to whole pages and are safe to ignore.
+void PlatformPrefetchMappedRange(const PlatformMappedFile* file, const size_t offset, const size_t size);
+void PlatformEvictMappedRange(const PlatformMappedFile* file, const size_t offset, const size_t size);
+
+// Reads a list of processors in the format Linux uses for them, like "2-5,8", into `cpus`. Returns how many were read;
+// anything after the last well-formed entry is ignored.
+int PlatformParseCpuList(const char* text, int* cpus, const int maxCpus);
+
+// NUMA nodes are numbered from 0. Machines without NUMA, or where it can't be queried, count as a single node.
+int PlatformGetNumaNodeCount();
+int PlatformGetCpuNumaNode(const int cpu);
+// Restricts the calling thread to the processors of one node, so that memory it touches first is placed there too.
+bool PlatformBindThreadToNumaNode(const int node);
+
+// Keeps a thread on one processor for good, and raises a thread to real-time priority, so that it isn't held up by
+// ordinary threads. Both return false when the OS refuses, which for real-time priority is the usual outcome
+// without extra privileges.
+bool PlatformPinThreadToCpu(std::thread* thread, const int cpu);
+bool PlatformSetThreadRealtimePriority(std::thread* thread);
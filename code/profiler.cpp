@@ -0,0 +1,185 @@
+#include "profiler.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <mutex>
+#include <new>
+
+#include "platform.h"
+
+namespace
+{
+    constexpr int maxProfiledThreads = 256;
+    constexpr uint64_t eventsPerThread = 1 << 18;
+
+    struct ProfileEvent
+    {
+        const char* name;
+        uint64_t begin;
+        uint64_t end;
+    };
+
+    struct ProfileThreadBuffer
+    {
+        const char* threadName;
+        // Total number of events ever recorded. The ring holds the last eventsPerThread of them.
+        std::atomic<uint64_t> numEvents;
+        ProfileEvent events[eventsPerThread];
+    };
+
+    std::mutex registryMutex;
+    ProfileThreadBuffer* threadBuffers[maxProfiledThreads];
+    std::atomic<int> numThreadBuffers;
+
+    uint64_t startTimestamp;
+    std::chrono::steady_clock::time_point startTime;
+
+    thread_local ProfileThreadBuffer* threadBuffer;
+    thread_local const char* pendingThreadName;
+
+    ProfileThreadBuffer* GetThreadBuffer()
+    {
+        if (!threadBuffer)
+        {
+            std::lock_guard<std::mutex> lock(registryMutex);
+
+            const int index = numThreadBuffers.load(std::memory_order_relaxed);
+            if (index == maxProfiledThreads)
+            {
+                return nullptr;
+            }
+
+            void* memory = PlatformAllocateMemory(sizeof(ProfileThreadBuffer));
+            if (!memory)
+            {
+                return nullptr;
+            }
+
+            ProfileThreadBuffer* buffer = new (memory) ProfileThreadBuffer();
+
+            buffer->threadName = pendingThreadName;
+            threadBuffers[index] = buffer;
+            numThreadBuffers.store(index + 1, std::memory_order_release);
+            threadBuffer = buffer;
+        }
+
+        return threadBuffer;
+    }
+
+    void WriteJsonString(std::FILE* file, const char* text)
+    {
+        std::fputc('"', file);
+        for (const char* c = text; *c; c++)
+        {
+            if (*c == '"' || *c == '\\')
+            {
+                std::fputc('\\', file);
+            }
+            std::fputc(*c, file);
+        }
+        std::fputc('"', file);
+    }
+}
+
+void RecordProfileZone(const char* name, const uint64_t begin, const uint64_t end)
+{
+    ProfileThreadBuffer* buffer = GetThreadBuffer();
+    if (!buffer)
+    {
+        return;
+    }
+
+    const uint64_t index = buffer->numEvents.load(std::memory_order_relaxed);
+    buffer->events[index % eventsPerThread] = { name, begin, end };
+    buffer->numEvents.store(index + 1, std::memory_order_release);
+}
+
+void InitProfiler()
+{
+    startTimestamp = ReadProfileTimestamp();
+    startTime = std::chrono::steady_clock::now();
+    SetProfileThreadName("Main");
+}
+
+void SetProfileThreadName(const char* name)
+{
+    if (threadBuffer)
+    {
+        threadBuffer->threadName = name;
+    }
+    else
+    {
+        pendingThreadName = name;
+    }
+}
+
+bool WriteProfileTrace(const char* path)
+{
+#if defined(BOIDS_PROFILING)
+    // Work out how fast the timestamp counter runs by comparing it against the wall clock since startup.
+    const uint64_t nowTimestamp = ReadProfileTimestamp();
+    const double elapsedMicroseconds =
+        std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - startTime).count();
+    const double ticksPerMicrosecond =
+        (elapsedMicroseconds > 0.0) ? (double)(nowTimestamp - startTimestamp) / elapsedMicroseconds : 1.0;
+
+    std::FILE* file = std::fopen(path, "w");
+    if (!file)
+    {
+        std::printf("ERROR: Could not create trace file '%s'.\n", path);
+        return false;
+    }
+
+    std::fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n", file);
+
+    bool first = true;
+    uint64_t numWritten = 0;
+
+    const int numThreads = numThreadBuffers.load(std::memory_order_acquire);
+    for (int thread = 0; thread < numThreads; thread++)
+    {
+        ProfileThreadBuffer* buffer = threadBuffers[thread];
+
+        std::fprintf(file, "%s{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":",
+            first ? "" : ",\n", thread);
+        char defaultName[32];
+        std::snprintf(defaultName, sizeof(defaultName), "Thread %d", thread);
+        WriteJsonString(file, buffer->threadName ? buffer->threadName : defaultName);
+        std::fputs("}}", file);
+        first = false;
+
+        // A thread that is still running may overwrite the oldest events while we read them; that only costs a
+        // few garbled zones at the start of its timeline.
+        const uint64_t numEvents = buffer->numEvents.load(std::memory_order_acquire);
+        const uint64_t firstEvent = (numEvents > eventsPerThread) ? numEvents - eventsPerThread : 0;
+
+        for (uint64_t i = firstEvent; i < numEvents; i++)
+        {
+            const ProfileEvent event = buffer->events[i % eventsPerThread];
+
+            const double begin = (double)(int64_t)(event.begin - startTimestamp) / ticksPerMicrosecond;
+            const double duration = (double)(event.end - event.begin) / ticksPerMicrosecond;
+
+            std::fputs(",\n{\"ph\":\"X\",\"name\":", file);
+            WriteJsonString(file, event.name);
+            std::fprintf(file, ",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}", thread, begin, duration);
+            numWritten++;
+        }
+    }
+
+    std::fputs("\n]}\n", file);
+
+    if (std::fclose(file) != 0)
+    {
+        std::printf("ERROR: Failed to write trace file '%s'.\n", path);
+        return false;
+    }
+
+    std::printf("Wrote %llu zones from %d threads to '%s'.\n", (unsigned long long)numWritten, numThreads, path);
+    return true;
+#else
+    std::printf("Profiling is compiled out of this build, define BOIDS_PROFILE to enable it. '%s' not written.\n", path);
+    return false;
+#endif
+}
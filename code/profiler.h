@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstdint>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#else
+#include <chrono>
+#endif
+
+// Scoped timing zones. Each thread appends the start and end timestamp of every zone it leaves to its own ring
+// buffer, so recording a zone is two timestamp reads and a store with no locking. WriteProfileTrace() dumps the
+// most recent zones of every thread in the Chrome trace event format, for chrome://tracing or ui.perfetto.dev.
+//
+// Zones are compiled in for debug builds, and for release builds only when BOIDS_PROFILE is defined.
+#if !defined(NDEBUG) || defined(BOIDS_PROFILE)
+#define BOIDS_PROFILING 1
+#endif
+
+inline uint64_t ReadProfileTimestamp()
+{
+#if defined(_MSC_VER) || defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return (uint64_t)std::chrono::steady_clock::now().time_since_epoch().count();
+#endif
+}
+
+void RecordProfileZone(const char* name, const uint64_t begin, const uint64_t end);
+
+#if defined(BOIDS_PROFILING)
+
+struct ProfileZone
+{
+    const char* name;
+    uint64_t begin;
+
+    explicit ProfileZone(const char* zoneName) : name(zoneName), begin(ReadProfileTimestamp()) {}
+    ~ProfileZone() { RecordProfileZone(name, begin, ReadProfileTimestamp()); }
+};
+
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+#define PROFILE_ZONE(name) ProfileZone PROFILE_CONCAT(profileZone, __LINE__)(name)
+
+#else
+
+#define PROFILE_ZONE(name)
+
+#endif
+
+// Call once at startup, from the main thread, before any zones are recorded.
+void InitProfiler();
+// Names the calling thread in the trace output.
+void SetProfileThreadName(const char* name);
+// Writes the zones currently held in every thread's ring buffer. Returns false if profiling is compiled out or the
+// file could not be written.
+bool WriteProfileTrace(const char* path);
@@ -0,0 +1,194 @@
+#include "snapshot.h"
+
+#include <cstdio>
+
+#include "boid.h"
+#include "mathutils.h"
+#include "params.h"
+
+namespace
+{
+    bool ReadAndValidateHeader(std::FILE* file, const char* path, SnapshotHeader* header)
+    {
+        if (std::fread(header, sizeof(SnapshotHeader), 1, file) != 1)
+        {
+            std::printf("ERROR: '%s' is too small to be a snapshot.\n", path);
+            return false;
+        }
+
+        if (header->magic != snapshotMagic)
+        {
+            std::printf("ERROR: '%s' is not a snapshot file.\n", path);
+            return false;
+        }
+
+        if (header->version != snapshotVersion)
+        {
+            std::printf("ERROR: '%s' is snapshot version %u, this build reads version %u.\n",
+                path, header->version, snapshotVersion);
+            return false;
+        }
+
+        if (header->headerSize != sizeof(SnapshotHeader) || header->boidSize != sizeof(Boid))
+        {
+            std::printf("ERROR: '%s' has a %u byte header and %u byte boids, this build uses %u and %u.\n",
+                path, header->headerSize, header->boidSize, (uint32_t)sizeof(SnapshotHeader), (uint32_t)sizeof(Boid));
+            return false;
+        }
+
+        if (header->numBoids < 0)
+        {
+            std::printf("ERROR: '%s' has an invalid boid count.\n", path);
+            return false;
+        }
+
+        return true;
+    }
+}
+
+bool ReadSnapshotHeader(const char* path, SnapshotHeader* header)
+{
+    std::FILE* file = std::fopen(path, "rb");
+    if (!file)
+    {
+        std::printf("ERROR: Could not open snapshot '%s'.\n", path);
+        return false;
+    }
+
+    const bool result = ReadAndValidateHeader(file, path, header);
+    std::fclose(file);
+
+    return result;
+}
+
+bool SaveSnapshot(const char* path, const GameState* gameState)
+{
+    SnapshotHeader header = {};
+    header.magic = snapshotMagic;
+    header.version = snapshotVersion;
+    header.headerSize = sizeof(SnapshotHeader);
+    header.boidSize = sizeof(Boid);
+    header.numBoids = gameState->numBoids;
+    header.worldSize = gameState->worldSize;
+    header.deterministic = gameState->deterministic ? 1 : 0;
+    header.tick = gameState->tick;
+    header.randomState = GetRandomState();
+    header.stateHash = HashBoids(gameState->boids, gameState->numBoids);
+    header.alignRadius = gameState->params.alignRadius;
+    header.cohereRadius = gameState->params.cohereRadius;
+    header.alignWeight = gameState->params.alignWeight;
+    header.cohereWeight = gameState->params.cohereWeight;
+    header.separateWeight = gameState->params.separateWeight;
+    header.separationDistance = gameState->params.separationDistance;
+    header.maxForce = gameState->params.maxForce;
+    header.maxSpeed = gameState->params.maxSpeed;
+    header.boundaryThreshold = gameState->params.boundaryThreshold;
+    header.rules = gameState->params.rules;
+    header.neighborMode = gameState->params.neighborMode;
+    header.topologicalNeighbors = (uint32_t)gameState->params.topologicalNeighbors;
+    header.boundaryMode = gameState->params.boundaryMode;
+
+    std::FILE* file = std::fopen(path, "wb");
+    if (!file)
+    {
+        std::printf("ERROR: Could not create snapshot '%s'.\n", path);
+        return false;
+    }
+
+    const size_t numBoids = (size_t)gameState->numBoids;
+    const bool written =
+        std::fwrite(&header, sizeof(header), 1, file) == 1 &&
+        std::fwrite(gameState->boids, sizeof(Boid), numBoids, file) == numBoids;
+
+    if (std::fclose(file) != 0 || !written)
+    {
+        std::printf("ERROR: Failed to write snapshot '%s'.\n", path);
+        return false;
+    }
+
+    return true;
+}
+
+bool LoadSnapshot(const char* path, GameState* gameState)
+{
+    std::FILE* file = std::fopen(path, "rb");
+    if (!file)
+    {
+        std::printf("ERROR: Could not open snapshot '%s'.\n", path);
+        return false;
+    }
+
+    SnapshotHeader header = {};
+    if (!ReadAndValidateHeader(file, path, &header))
+    {
+        std::fclose(file);
+        return false;
+    }
+
+    if (header.numBoids > gameState->maxBoids)
+    {
+        std::printf("ERROR: '%s' holds %d boids but memory was reserved for only %d.\n",
+            path, header.numBoids, gameState->maxBoids);
+        std::fclose(file);
+        return false;
+    }
+
+    // Read straight into the spare buffer, so the live flock is left untouched if the file turns out to be bad.
+    Boid* loadedBoids = gameState->nextBoids;
+
+    const size_t numBoids = (size_t)header.numBoids;
+    const bool read = std::fread(loadedBoids, sizeof(Boid), numBoids, file) == numBoids;
+    std::fclose(file);
+
+    if (!read)
+    {
+        std::printf("ERROR: Snapshot '%s' is truncated.\n", path);
+        return false;
+    }
+
+    if (HashBoids(loadedBoids, header.numBoids) != header.stateHash)
+    {
+        std::printf("ERROR: Snapshot '%s' is corrupt, its hash does not match.\n", path);
+        return false;
+    }
+
+    gameState->nextBoids = gameState->boids;
+    gameState->boids = loadedBoids;
+    gameState->numBoids = header.numBoids;
+    gameState->worldSize = header.worldSize;
+
+    // The snapshot's mode wins, since its flock and random state only continue the same way in the mode they came
+    // from, but a run that asked for the other mode should know it isn't getting it.
+    const bool deterministic = header.deterministic != 0;
+    if (deterministic != gameState->deterministic)
+    {
+        std::printf("WARNING: Snapshot '%s' was saved in %s mode, so the run continues in that mode.\n", path,
+            deterministic ? "deterministic" : "non-deterministic");
+    }
+    gameState->deterministic = deterministic;
+
+    SimParams params = gameState->params;
+    SetSimParam(&params, SIM_PARAM_ALIGN_RADIUS, header.alignRadius);
+    SetSimParam(&params, SIM_PARAM_COHERE_RADIUS, header.cohereRadius);
+    SetSimParam(&params, SIM_PARAM_ALIGN_WEIGHT, header.alignWeight);
+    SetSimParam(&params, SIM_PARAM_COHERE_WEIGHT, header.cohereWeight);
+    SetSimParam(&params, SIM_PARAM_SEPARATE_WEIGHT, header.separateWeight);
+    SetSimParam(&params, SIM_PARAM_SEPARATION_DISTANCE, header.separationDistance);
+    SetSimParam(&params, SIM_PARAM_MAX_FORCE, header.maxForce);
+    SetSimParam(&params, SIM_PARAM_MAX_SPEED, header.maxSpeed);
+    SetSimParam(&params, SIM_PARAM_BOUNDARY_THRESHOLD, header.boundaryThreshold);
+    params.rules = header.rules & SIM_RULE_ALL;
+    params.neighborMode = (header.neighborMode < NEIGHBOR_MODE_COUNT) ? (NeighborMode)header.neighborMode :
+        NEIGHBOR_MODE_METRIC;
+    const bool validNeighborCount =
+        header.topologicalNeighbors >= 1 && header.topologicalNeighbors <= (uint32_t)maxTopologicalNeighbors;
+    params.topologicalNeighbors = validNeighborCount ? (int)header.topologicalNeighbors : params.topologicalNeighbors;
+    params.boundaryMode = (header.boundaryMode < BOUNDARY_MODE_COUNT) ? (BoundaryMode)header.boundaryMode :
+        BOUNDARY_MODE_STEER;
+    gameState->params = params;
+    gameState->tick = header.tick;
+    gameState->stateHash = header.stateHash;
+    SetRandomState(header.randomState);
+
+    return true;
+}
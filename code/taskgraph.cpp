@@ -0,0 +1,329 @@
+#include "taskgraph.h"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+
+#include "profiler.h"
+
+namespace
+{
+    constexpr int64_t notStarted = INT64_MAX;
+
+    // The nodes of one wave, with their tasks numbered one after the other.
+    struct TaskGraphWave
+    {
+        TaskGraphNode* nodes[maxTaskGraphNodes];
+        int firstTask[maxTaskGraphNodes + 1];
+        int numNodes;
+        std::chrono::steady_clock::time_point start;
+    };
+
+    int64_t NanosecondsSince(const std::chrono::steady_clock::time_point start)
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    // Lowers or raises `value` to `candidate`, against other threads doing the same. A failed compare-and-swap reloads
+    // `current`, so each loop ends once the stored value is already at least as far as `candidate`.
+    void StoreMin(std::atomic<int64_t>* value, const int64_t candidate)
+    {
+        int64_t current = value->load(std::memory_order_relaxed);
+        while (candidate < current && !value->compare_exchange_weak(current, candidate, std::memory_order_relaxed))
+        {
+        }
+    }
+
+    void StoreMax(std::atomic<int64_t>* value, const int64_t candidate)
+    {
+        int64_t current = value->load(std::memory_order_relaxed);
+        while (candidate > current && !value->compare_exchange_weak(current, candidate, std::memory_order_relaxed))
+        {
+        }
+    }
+
+    void ResetCounters(TaskGraphNode* node)
+    {
+        for (int i = 0; i < PERF_COUNTER_COUNT; i++)
+        {
+            node->counterCounts[i].store(0, std::memory_order_relaxed);
+        }
+        node->counterMask.store(0, std::memory_order_relaxed);
+    }
+
+    void RunWaveTask(void* data, const int taskIndex, const int threadIndex)
+    {
+        TaskGraphWave* wave = (TaskGraphWave*)data;
+
+        int n = 0;
+        while (taskIndex >= wave->firstTask[n + 1])
+        {
+            n++;
+        }
+        TaskGraphNode* node = wave->nodes[n];
+
+        // Each thread reads its own counters, which the job system's workers open when the thread that started them
+        // had, and adds what the task took to the node's totals.
+        PerfCounterValues countersBefore;
+        const bool counting = node->counterMetric != METRIC_COUNT && ReadPerfCounters(&countersBefore);
+
+        const int64_t begin = NanosecondsSince(wave->start);
+        {
+            PROFILE_ZONE(node->name);
+            node->callback(node->data, taskIndex - wave->firstTask[n], threadIndex);
+        }
+        const int64_t end = NanosecondsSince(wave->start);
+
+        PerfCounterValues countersAfter;
+        if (counting && ReadPerfCounters(&countersAfter))
+        {
+            for (int i = 0; i < PERF_COUNTER_COUNT; i++)
+            {
+                if ((countersAfter.availableMask & (1u << i)) && countersAfter.counts[i] >= countersBefore.counts[i])
+                {
+                    node->counterCounts[i].fetch_add(countersAfter.counts[i] - countersBefore.counts[i],
+                        std::memory_order_relaxed);
+                    node->counterMask.fetch_or(1u << i, std::memory_order_relaxed);
+                }
+            }
+        }
+
+        StoreMin(&node->startNanoseconds, begin);
+        StoreMax(&node->endNanoseconds, end);
+    }
+
+    // Adds up the counters of the nodes in each metric group and records one sample per group.
+    void RecordTaskGraphCounters(const TaskGraph* graph)
+    {
+        for (int i = 0; i < graph->numNodes; i++)
+        {
+            const MetricId metric = graph->nodes[i].counterMetric;
+
+            bool seen = metric == METRIC_COUNT;
+            for (int j = 0; j < i && !seen; j++)
+            {
+                seen = graph->nodes[j].counterMetric == metric;
+            }
+
+            if (seen)
+            {
+                continue;
+            }
+
+            PerfCounterValues total = {};
+            for (int j = i; j < graph->numNodes; j++)
+            {
+                const TaskGraphNode& node = graph->nodes[j];
+                if (node.counterMetric != metric)
+                {
+                    continue;
+                }
+
+                for (int c = 0; c < PERF_COUNTER_COUNT; c++)
+                {
+                    total.counts[c] += node.counterCounts[c].load(std::memory_order_relaxed);
+                }
+                total.availableMask |= node.counterMask.load(std::memory_order_relaxed);
+            }
+
+            for (int c = 0; c < PERF_COUNTER_COUNT; c++)
+            {
+                if (total.availableMask & (1u << c))
+                {
+                    RecordMetric((MetricId)(metric + c), (double)total.counts[c]);
+                }
+            }
+        }
+    }
+}
+
+void ResetTaskGraph(TaskGraph* graph)
+{
+    graph->numNodes = 0;
+    graph->numWaves = 0;
+    graph->milliseconds = 0.0;
+}
+
+int AddTaskGraphNode(TaskGraph* graph, const char* name, JobCallback* callback, void* data, const int numTasks,
+    const MetricId counterMetric)
+{
+    if (graph->numNodes == maxTaskGraphNodes)
+    {
+        return -1;
+    }
+
+    const int index = graph->numNodes++;
+    TaskGraphNode* node = &graph->nodes[index];
+
+    node->name = name;
+    node->callback = callback;
+    node->data = data;
+    node->numTasks = (numTasks > 0) ? numTasks : 0;
+    node->numDependencies = 0;
+    node->counterMetric = counterMetric;
+    node->shares = nullptr;
+    node->wave = 0;
+    node->startNanoseconds.store(notStarted, std::memory_order_relaxed);
+    node->endNanoseconds.store(0, std::memory_order_relaxed);
+    ResetCounters(node);
+
+    return index;
+}
+
+void SetTaskGraphNodeShares(TaskGraph* graph, const int node, JobShares* shares)
+{
+    if (node >= 0 && node < graph->numNodes)
+    {
+        graph->nodes[node].shares = shares;
+        if (shares)
+        {
+            shares->used = false;
+        }
+    }
+}
+
+void AddTaskGraphDependency(TaskGraph* graph, const int node, const int dependency)
+{
+    if (node < 0 || node >= graph->numNodes || dependency < 0 || dependency >= node)
+    {
+        return;
+    }
+
+    TaskGraphNode* dependent = &graph->nodes[node];
+    if (dependent->numDependencies < maxTaskGraphDependencies)
+    {
+        dependent->dependencies[dependent->numDependencies++] = dependency;
+    }
+}
+
+void RunTaskGraph(TaskGraph* graph, JobSystem* jobs)
+{
+    PROFILE_ZONE("RunTaskGraph");
+
+    // Dependencies always point back to earlier nodes, so one pass in order puts every node one wave after the last
+    // of the nodes it waits for.
+    graph->numWaves = 0;
+    for (int i = 0; i < graph->numNodes; i++)
+    {
+        TaskGraphNode* node = &graph->nodes[i];
+
+        node->wave = 0;
+        for (int d = 0; d < node->numDependencies; d++)
+        {
+            const int wave = graph->nodes[node->dependencies[d]].wave + 1;
+            node->wave = (wave > node->wave) ? wave : node->wave;
+        }
+
+        node->startNanoseconds.store(notStarted, std::memory_order_relaxed);
+        node->endNanoseconds.store(0, std::memory_order_relaxed);
+        ResetCounters(node);
+
+        graph->numWaves = (node->wave + 1 > graph->numWaves) ? node->wave + 1 : graph->numWaves;
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+
+    for (int w = 0; w < graph->numWaves; w++)
+    {
+        TaskGraphWave wave;
+        wave.numNodes = 0;
+        wave.firstTask[0] = 0;
+        wave.start = start;
+
+        for (int i = 0; i < graph->numNodes; i++)
+        {
+            TaskGraphNode* node = &graph->nodes[i];
+            if (node->wave == w && node->numTasks > 0)
+            {
+                wave.nodes[wave.numNodes] = node;
+                wave.firstTask[wave.numNodes + 1] = wave.firstTask[wave.numNodes] + node->numTasks;
+                wave.numNodes++;
+            }
+        }
+
+        const int numTasks = wave.firstTask[wave.numNodes];
+
+        for (int n = 0; n < wave.numNodes; n++)
+        {
+            if (wave.nodes[n]->shares)
+            {
+                wave.nodes[n]->shares->used = false;
+            }
+        }
+
+        if (jobs)
+        {
+            JobShares* shares = (wave.numNodes == 1) ? wave.nodes[0]->shares : nullptr;
+            RunJobs(jobs, RunWaveTask, &wave, numTasks, shares);
+        }
+        else
+        {
+            for (int t = 0; t < numTasks; t++)
+            {
+                RunWaveTask(&wave, t, 0);
+            }
+        }
+    }
+
+    graph->milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    RecordTaskGraphCounters(graph);
+}
+
+double GetTaskGraphNodeMilliseconds(const TaskGraph* graph, const int node)
+{
+    return GetTaskGraphSpanMilliseconds(graph, node, node);
+}
+
+double GetTaskGraphSpanMilliseconds(const TaskGraph* graph, const int firstNode, const int lastNode)
+{
+    int64_t start = notStarted;
+    int64_t end = 0;
+
+    for (int i = (firstNode > 0) ? firstNode : 0; i <= lastNode && i < graph->numNodes; i++)
+    {
+        const int64_t nodeStart = graph->nodes[i].startNanoseconds.load(std::memory_order_relaxed);
+        const int64_t nodeEnd = graph->nodes[i].endNanoseconds.load(std::memory_order_relaxed);
+
+        start = (nodeStart < start) ? nodeStart : start;
+        end = (nodeEnd > end) ? nodeEnd : end;
+    }
+
+    return (start < end) ? (end - start) / 1e6 : 0.0;
+}
+
+void PrintTaskGraph(const TaskGraph* graph)
+{
+    std::printf("Task graph: %d nodes in %d waves, %.3f ms\n", graph->numNodes, graph->numWaves, graph->milliseconds);
+
+    for (int w = 0; w < graph->numWaves; w++)
+    {
+        for (int i = 0; i < graph->numNodes; i++)
+        {
+            const TaskGraphNode& node = graph->nodes[i];
+            if (node.wave != w)
+            {
+                continue;
+            }
+
+            const int64_t start = node.startNanoseconds.load(std::memory_order_relaxed);
+            const int64_t end = node.endNanoseconds.load(std::memory_order_relaxed);
+
+            std::printf("  wave %d  %-16s %6d tasks", w, node.name, node.numTasks);
+            if (start < end)
+            {
+                std::printf("  %9.3f - %9.3f ms", start / 1e6, end / 1e6);
+            }
+            else
+            {
+                std::printf("  %25s", "not run");
+            }
+
+            for (int d = 0; d < node.numDependencies; d++)
+            {
+                std::printf("%s%s", (d == 0) ? "  after " : ", ", graph->nodes[node.dependencies[d]].name);
+            }
+            std::putchar('\n');
+        }
+    }
+}
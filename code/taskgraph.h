@@ -0,0 +1,71 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+#include "jobs.h"
+#include "metrics.h"
+#include "perfcounters.h"
+
+// A small graph of work for the job system, built afresh for every frame. Each node is a batch of independent tasks,
+// a JobCallback run for every task index in [0, numTasks), and can wait for other nodes to finish first. The nodes run
+// in waves: each wave holds every node whose dependencies all ran in earlier waves, and goes to the job system as a
+// single batch, so independent nodes share the threads and overlap instead of taking turns.
+//
+// Every task is recorded as a profiling zone named after its node, so a trace shows which threads ran which stage and
+// when. The start and end time of every node in the last run are kept for GetTaskGraphNodeMilliseconds and
+// PrintTaskGraph.
+
+constexpr int maxTaskGraphNodes = 16;
+constexpr int maxTaskGraphDependencies = 4;
+
+struct TaskGraphNode
+{
+    const char* name;
+    JobCallback* callback;
+    void* data;
+    int numTasks;
+    int dependencies[maxTaskGraphDependencies];
+    int numDependencies;
+
+    // The hardware counters of every thread's share of the work are recorded into this metric group (see
+    // perfcounters.h), added up with any other nodes that use the same group. METRIC_COUNT for none.
+    MetricId counterMetric;
+
+    // How the threads share the node's tasks out to start with (see jobs.h), or null for evenly. Only used while the
+    // node is the only one in its wave.
+    JobShares* shares;
+
+    // Filled in by RunTaskGraph.
+    int wave;
+    std::atomic<int64_t> startNanoseconds; // Since the start of the run.
+    std::atomic<int64_t> endNanoseconds;
+    // The counters added up over the threads that ran the node's tasks, and which of them were read.
+    std::atomic<uint64_t> counterCounts[PERF_COUNTER_COUNT];
+    std::atomic<uint32_t> counterMask;
+};
+
+struct TaskGraph
+{
+    TaskGraphNode nodes[maxTaskGraphNodes];
+    int numNodes;
+    int numWaves;
+    double milliseconds; // The whole of the last run.
+};
+
+void ResetTaskGraph(TaskGraph* graph);
+// Returns the index of the new node, to add dependencies with. Returns -1 if the graph is full.
+int AddTaskGraphNode(TaskGraph* graph, const char* name, JobCallback* callback, void* data, const int numTasks,
+    const MetricId counterMetric = METRIC_COUNT);
+void SetTaskGraphNodeShares(TaskGraph* graph, const int node, JobShares* shares);
+// Makes `node` wait for `dependency`, which has to have been added before it. That keeps the graph free of cycles.
+void AddTaskGraphDependency(TaskGraph* graph, const int node, const int dependency);
+// Runs every node, spread over the job system's threads, or all on the calling thread when `jobs` is null.
+void RunTaskGraph(TaskGraph* graph, JobSystem* jobs);
+
+// How long the node took in the last run, from its first task starting to its last task finishing.
+double GetTaskGraphNodeMilliseconds(const TaskGraph* graph, const int node);
+// The same from the start of the first of the nodes to the end of the last, for a stage made of several nodes.
+double GetTaskGraphSpanMilliseconds(const TaskGraph* graph, const int firstNode, const int lastNode);
+// Lists the nodes by wave, with what each waits for and when it ran in the last run.
+void PrintTaskGraph(const TaskGraph* graph);
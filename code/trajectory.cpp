@@ -0,0 +1,582 @@
+#include "trajectory.h"
+
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+#include "boid.h"
+#include "profiler.h"
+
+namespace
+{
+    constexpr uint32_t headerSize = 64;
+    constexpr uint64_t initialFrameCapacity = 64;
+    constexpr uint32_t keyframeInterval = 60;
+    constexpr float quantizedRange = 32767.0f;
+
+    static_assert(sizeof(TrajectoryHeader) <= headerSize, "Trajectory header no longer fits in its reserved space.");
+
+    size_t AlignUp(const size_t value, const size_t alignment)
+    {
+        return (value + alignment - 1) & ~(alignment - 1);
+    }
+
+    size_t PositionsSize(const int numBoids, const bool quantized)
+    {
+        const size_t componentSize = quantized ? sizeof(int16_t) : sizeof(float);
+        return AlignUp(componentSize * 3 * numBoids, sizeof(float));
+    }
+
+    size_t FrameSize(const int numBoids, const bool quantized)
+    {
+        const size_t size = sizeof(TrajectoryFrameHeader) +
+            PositionsSize(numBoids, quantized) +
+            sizeof(float) * 3 * numBoids;
+        return AlignUp(size, 16);
+    }
+
+    bool IsCompressed(const TrajectoryHeader* header)
+    {
+        return (header->flags & trajectoryFlagCompressed) != 0;
+    }
+
+    uint64_t FrameOffset(const TrajectoryReader* reader, const uint64_t frameIndex)
+    {
+        const TrajectoryHeader* header = reader->header;
+        return IsCompressed(header) ? reader->frameOffsets[frameIndex] : header->headerSize + frameIndex * header->frameSize;
+    }
+
+    uint64_t RecordSize(const TrajectoryReader* reader, const uint64_t frameIndex)
+    {
+        const TrajectoryHeader* header = reader->header;
+        if (!IsCompressed(header))
+        {
+            return header->frameSize;
+        }
+
+        const uint8_t* record = (const uint8_t*)reader->file.data + reader->frameOffsets[frameIndex];
+        return sizeof(TrajectoryCompressedFrameHeader) + ((const TrajectoryCompressedFrameHeader*)record)->encodedSize;
+    }
+
+    void WriteFrame(uint8_t* frame, const TrajectoryHeader* header, const TrajectoryFrameHeader* frameHeader,
+        const Boid* boids)
+    {
+        const int numBoids = header->numBoids;
+        const bool quantized = (header->flags & trajectoryFlagQuantizedPositions) != 0;
+
+        std::memcpy(frame, frameHeader, sizeof(TrajectoryFrameHeader));
+        uint8_t* positions = frame + sizeof(TrajectoryFrameHeader);
+        float* velocities = (float*)(positions + PositionsSize(numBoids, quantized));
+
+        if (quantized)
+        {
+            int16_t* quantizedPositions = (int16_t*)positions;
+            const float invScale = 1.0f / header->positionScale;
+
+            for (int i = 0; i < numBoids; i++)
+            {
+                const float p[3] = { boids[i].position.x, boids[i].position.y, boids[i].position.z };
+                for (int c = 0; c < 3; c++)
+                {
+                    float q = p[c] * invScale;
+                    q = (q > quantizedRange) ? quantizedRange : ((q < -quantizedRange) ? -quantizedRange : q);
+                    quantizedPositions[i * 3 + c] = (int16_t)std::lrintf(q);
+                }
+            }
+        }
+        else
+        {
+            float* floatPositions = (float*)positions;
+            for (int i = 0; i < numBoids; i++)
+            {
+                floatPositions[i * 3 + 0] = boids[i].position.x;
+                floatPositions[i * 3 + 1] = boids[i].position.y;
+                floatPositions[i * 3 + 2] = boids[i].position.z;
+            }
+        }
+
+        for (int i = 0; i < numBoids; i++)
+        {
+            velocities[i * 3 + 0] = boids[i].velocity.x;
+            velocities[i * 3 + 1] = boids[i].velocity.y;
+            velocities[i * 3 + 2] = boids[i].velocity.z;
+        }
+    }
+
+    // Makes sure there is room for `size` more bytes at the write offset, doubling the file as needed.
+    bool ReserveRecordSpace(TrajectoryRecorder* recorder, const size_t size)
+    {
+        size_t fileSize = recorder->file.size;
+        while (recorder->writeOffset + size > fileSize)
+        {
+            fileSize *= 2;
+        }
+
+        if (fileSize == recorder->file.size)
+        {
+            return true;
+        }
+
+        if (!PlatformResizeMappedFile(&recorder->file, fileSize))
+        {
+            return false;
+        }
+
+        recorder->header = (TrajectoryHeader*)recorder->file.data;
+        return true;
+    }
+
+    // Returns the number of bytes the frame took up in the file.
+    size_t AppendFrame(TrajectoryRecorder* recorder, const TrajectoryFrameHeader* frameHeader, const Boid* boids)
+    {
+        if (!recorder->compressed)
+        {
+            const size_t frameSize = recorder->header->frameSize;
+            if (!ReserveRecordSpace(recorder, frameSize))
+            {
+                return 0;
+            }
+
+            WriteFrame((uint8_t*)recorder->file.data + recorder->writeOffset, recorder->header, frameHeader, boids);
+            return frameSize;
+        }
+
+        const size_t maxRecordSize = sizeof(TrajectoryCompressedFrameHeader) + MaxEncodedFrameSize(&recorder->codec);
+        if (!ReserveRecordSpace(recorder, AlignUp(maxRecordSize, 16)))
+        {
+            return 0;
+        }
+
+        uint8_t* record = (uint8_t*)recorder->file.data + recorder->writeOffset;
+        const bool keyframe = (recorder->header->frameCount % keyframeInterval) == 0;
+        const size_t encodedSize = EncodeFrame(&recorder->codec, boids, keyframe,
+            record + sizeof(TrajectoryCompressedFrameHeader));
+
+        TrajectoryCompressedFrameHeader recordHeader = {};
+        recordHeader.frame = *frameHeader;
+        recordHeader.encodedSize = encodedSize;
+        std::memcpy(record, &recordHeader, sizeof(recordHeader));
+
+        return AlignUp(sizeof(TrajectoryCompressedFrameHeader) + encodedSize, 16);
+    }
+
+    void WriterThread(TrajectoryRecorder* recorder)
+    {
+        SetProfileThreadName("Trajectory writer");
+
+        for (;;)
+        {
+            uint8_t* slot = nullptr;
+            {
+                std::unique_lock<std::mutex> lock(recorder->mutex);
+                recorder->slotFilled.wait(lock, [recorder] { return recorder->numQueued > 0 || recorder->stopping; });
+
+                if (recorder->numQueued == 0)
+                {
+                    return;
+                }
+
+                slot = recorder->slotMemory + recorder->readIndex * recorder->slotStride;
+            }
+
+            // The slot is ours until we hand it back below, so the expensive part runs without the lock.
+            if (!recorder->failed)
+            {
+                const TrajectoryFrameHeader* frameHeader = (const TrajectoryFrameHeader*)slot;
+                const Boid* boids = (const Boid*)(slot + sizeof(TrajectoryFrameHeader));
+
+                PROFILE_ZONE("WriteTrajectoryFrame");
+                const size_t recordSize = AppendFrame(recorder, frameHeader, boids);
+                if (recordSize > 0)
+                {
+                    recorder->writeOffset += recordSize;
+
+                    // Publish the frame only once all of it is in place.
+                    std::atomic_thread_fence(std::memory_order_release);
+                    recorder->header->frameCount++;
+                }
+                else
+                {
+                    std::puts("ERROR: Failed to grow the trajectory file, recording stopped.");
+                    recorder->failed = true;
+                }
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(recorder->mutex);
+                recorder->readIndex = (recorder->readIndex + 1) % TrajectoryRecorder::numSlots;
+                recorder->numQueued--;
+            }
+            recorder->slotFreed.notify_one();
+        }
+    }
+}
+
+bool BeginTrajectoryRecording(TrajectoryRecorder* recorder, const char* path, const GameState* gameState,
+    const TrajectoryFormat format)
+{
+    const int numBoids = gameState->numBoids;
+    const bool quantized = format == TRAJECTORY_FORMAT_QUANTIZED;
+
+    recorder->compressed = format == TRAJECTORY_FORMAT_COMPRESSED;
+
+    recorder->encodeJobs.numWorkers = 0;
+
+    if (recorder->compressed)
+    {
+        // Frames are encoded on the writer thread while the simulation runs, so it only gets help from cores that
+        // neither the simulation's threads nor the writer itself are using.
+        const int numSimThreads = gameState->jobs ? GetJobThreadCount(gameState->jobs) : 1;
+        const int numSpareCores = (int)std::thread::hardware_concurrency() - numSimThreads - 1;
+        if (numSpareCores > 0)
+        {
+            StartJobSystem(&recorder->encodeJobs, numSpareCores);
+        }
+
+        if (!InitFrameCodec(&recorder->codec, numBoids, gameState->worldSize, gameState->params.maxSpeed,
+            (recorder->encodeJobs.numWorkers > 0) ? &recorder->encodeJobs : nullptr))
+        {
+            std::puts("ERROR: Failed to allocate memory for trajectory compression.");
+            StopJobSystem(&recorder->encodeJobs);
+            return false;
+        }
+    }
+
+    // Compressed frames vary in size, so start from the raw size of a few frames and let the file grow from there.
+    const size_t frameSize = recorder->compressed ? 0 : FrameSize(numBoids, quantized);
+    const size_t initialSize = headerSize + initialFrameCapacity * FrameSize(numBoids, quantized);
+
+    if (!PlatformCreateMappedFile(path, initialSize, &recorder->file))
+    {
+        std::printf("ERROR: Could not create trajectory file '%s'.\n", path);
+        if (recorder->compressed)
+        {
+            FreeFrameCodec(&recorder->codec);
+            StopJobSystem(&recorder->encodeJobs);
+        }
+        return false;
+    }
+
+    recorder->slotStride = AlignUp(sizeof(TrajectoryFrameHeader) + sizeof(Boid) * numBoids, 64);
+    recorder->slotMemorySize = recorder->slotStride * TrajectoryRecorder::numSlots;
+    recorder->slotMemory = (uint8_t*)PlatformAllocateMemory(recorder->slotMemorySize);
+
+    if (!recorder->slotMemory)
+    {
+        std::puts("ERROR: Failed to allocate memory for trajectory recording.");
+        PlatformUnmapFile(&recorder->file);
+        if (recorder->compressed)
+        {
+            FreeFrameCodec(&recorder->codec);
+            StopJobSystem(&recorder->encodeJobs);
+        }
+        return false;
+    }
+
+    TrajectoryHeader* header = (TrajectoryHeader*)recorder->file.data;
+    header->magic = trajectoryMagic;
+    header->version = trajectoryVersion;
+    header->headerSize = headerSize;
+    header->flags = quantized ? trajectoryFlagQuantizedPositions : 0;
+    header->flags |= recorder->compressed ? trajectoryFlagCompressed : 0;
+    header->numBoids = numBoids;
+    header->worldSize = gameState->worldSize;
+    // Leave headroom for boids that drift past the walls before they are turned around.
+    header->positionScale = (2.0f * gameState->worldSize) / quantizedRange;
+    header->frameSize = (uint32_t)frameSize;
+    header->frameCount = 0;
+    header->firstTick = gameState->tick;
+    header->maxSpeed = gameState->params.maxSpeed;
+    header->keyframeInterval = recorder->compressed ? keyframeInterval : 0;
+
+    recorder->header = header;
+    recorder->writeOffset = headerSize;
+    recorder->readIndex = 0;
+    recorder->writeIndex = 0;
+    recorder->numQueued = 0;
+    recorder->stopping = false;
+    recorder->failed = false;
+    recorder->numStalls = 0;
+
+    recorder->writer = std::thread(WriterThread, recorder);
+
+    return true;
+}
+
+void RecordTrajectoryFrame(TrajectoryRecorder* recorder, const GameState* gameState)
+{
+    PROFILE_ZONE("RecordTrajectoryFrame");
+
+    uint8_t* slot = nullptr;
+    {
+        std::unique_lock<std::mutex> lock(recorder->mutex);
+
+        if (recorder->numQueued == TrajectoryRecorder::numSlots)
+        {
+            recorder->numStalls++;
+            recorder->slotFreed.wait(lock, [recorder] { return recorder->numQueued < TrajectoryRecorder::numSlots; });
+        }
+
+        slot = recorder->slotMemory + recorder->writeIndex * recorder->slotStride;
+    }
+
+    TrajectoryFrameHeader frameHeader = {};
+    frameHeader.tick = gameState->tick;
+    frameHeader.stateHash = gameState->stateHash;
+
+    std::memcpy(slot, &frameHeader, sizeof(frameHeader));
+    std::memcpy(slot + sizeof(frameHeader), gameState->boids, sizeof(Boid) * gameState->numBoids);
+
+    {
+        std::lock_guard<std::mutex> lock(recorder->mutex);
+        recorder->writeIndex = (recorder->writeIndex + 1) % TrajectoryRecorder::numSlots;
+        recorder->numQueued++;
+    }
+    recorder->slotFilled.notify_one();
+}
+
+void EndTrajectoryRecording(TrajectoryRecorder* recorder)
+{
+    {
+        std::lock_guard<std::mutex> lock(recorder->mutex);
+        recorder->stopping = true;
+    }
+    recorder->slotFilled.notify_one();
+    recorder->writer.join();
+
+    if (recorder->compressed)
+    {
+        FreeFrameCodec(&recorder->codec);
+        StopJobSystem(&recorder->encodeJobs);
+    }
+
+    if (!recorder->file.data)
+    {
+        // Growing the file failed and left nothing mapped, so there is no header left to finalize.
+        PlatformUnmapFile(&recorder->file);
+        PlatformFreeMemory(recorder->slotMemory, recorder->slotMemorySize);
+        recorder->header = nullptr;
+        recorder->slotMemory = nullptr;
+        return;
+    }
+
+    const uint64_t frameCount = recorder->header->frameCount;
+    const size_t fileSize = recorder->writeOffset;
+
+    std::printf("Recorded %llu frames (%.1f MB), the simulation waited on the writer %llu times.\n",
+        (unsigned long long)frameCount, fileSize / (1024.0 * 1024.0), (unsigned long long)recorder->numStalls);
+
+    // Trim the unused capacity off the end.
+    PlatformResizeMappedFile(&recorder->file, fileSize);
+    PlatformUnmapFile(&recorder->file);
+    PlatformFreeMemory(recorder->slotMemory, recorder->slotMemorySize);
+
+    recorder->header = nullptr;
+    recorder->slotMemory = nullptr;
+}
+
+bool OpenTrajectory(const char* path, TrajectoryReader* reader)
+{
+    reader->header = nullptr;
+    reader->frameOffsets = nullptr;
+    reader->frameOffsetsSize = 0;
+    reader->codec = {};
+
+    if (!PlatformMapFile(path, &reader->file))
+    {
+        std::printf("ERROR: Could not open trajectory '%s'.\n", path);
+        return false;
+    }
+
+    const TrajectoryHeader* header = (const TrajectoryHeader*)reader->file.data;
+    const bool compressed = reader->file.size >= headerSize && header->version >= 2 && IsCompressed(header);
+
+    // Every frame takes up at least a record header, or a whole frame when uncompressed, so a file can't claim more
+    // frames than that lets it hold. Checking this first also keeps the sizes below from overflowing.
+    const bool hasHeader = reader->file.size >= headerSize;
+    const uint64_t bodySize = hasHeader ? reader->file.size - headerSize : 0;
+    const uint64_t minFrameSize = compressed ? AlignUp(sizeof(TrajectoryCompressedFrameHeader), 16) :
+        (hasHeader ? header->frameSize : 0);
+
+    const bool valid =
+        hasHeader &&
+        header->magic == trajectoryMagic &&
+        header->version >= 1 && header->version <= trajectoryVersion &&
+        header->headerSize == headerSize &&
+        header->numBoids >= 0 &&
+        (minFrameSize == 0 || header->frameCount <= bodySize / minFrameSize) &&
+        (compressed ?
+            header->keyframeInterval > 0 :
+            header->frameSize == FrameSize(header->numBoids, (header->flags & trajectoryFlagQuantizedPositions) != 0));
+
+    if (!valid)
+    {
+        std::printf("ERROR: '%s' is not a valid trajectory of version %u or older.\n", path, trajectoryVersion);
+        PlatformUnmapFile(&reader->file);
+        return false;
+    }
+
+    reader->header = header;
+
+    if (compressed)
+    {
+        // Records vary in size, so find where each one starts up front. This only touches the record headers.
+        reader->frameOffsetsSize = sizeof(uint64_t) * (header->frameCount + 1);
+        reader->frameOffsets = (uint64_t*)PlatformAllocateMemory(reader->frameOffsetsSize);
+
+        if (!reader->frameOffsets ||
+            !InitFrameCodec(&reader->codec, header->numBoids, header->worldSize, header->maxSpeed, nullptr))
+        {
+            std::puts("ERROR: Failed to allocate memory for trajectory decompression.");
+            CloseTrajectory(reader);
+            return false;
+        }
+
+        uint64_t offset = header->headerSize;
+        for (uint64_t frame = 0; frame < header->frameCount; frame++)
+        {
+            if (offset + sizeof(TrajectoryCompressedFrameHeader) > reader->file.size)
+            {
+                break;
+            }
+
+            const TrajectoryCompressedFrameHeader* record =
+                (const TrajectoryCompressedFrameHeader*)((const uint8_t*)reader->file.data + offset);
+            const uint64_t recordSize = sizeof(TrajectoryCompressedFrameHeader) + record->encodedSize;
+
+            if (offset + recordSize > reader->file.size)
+            {
+                break;
+            }
+
+            reader->frameOffsets[frame] = offset;
+            offset += AlignUp(recordSize, 16);
+
+            if (frame + 1 == header->frameCount)
+            {
+                reader->frameOffsets[header->frameCount] = offset;
+            }
+        }
+
+        if (header->frameCount > 0 && reader->frameOffsets[header->frameCount] == 0)
+        {
+            std::printf("ERROR: Trajectory '%s' is truncated.\n", path);
+            CloseTrajectory(reader);
+            return false;
+        }
+
+        reader->lastDecodedFrame = UINT64_MAX;
+    }
+
+    return true;
+}
+
+void CloseTrajectory(TrajectoryReader* reader)
+{
+    if (reader->frameOffsets)
+    {
+        PlatformFreeMemory(reader->frameOffsets, reader->frameOffsetsSize);
+    }
+
+    if (reader->codec.memory)
+    {
+        FreeFrameCodec(&reader->codec);
+    }
+
+    PlatformUnmapFile(&reader->file);
+    reader->header = nullptr;
+    reader->frameOffsets = nullptr;
+    reader->frameOffsetsSize = 0;
+}
+
+void SetTrajectoryDecodeJobs(TrajectoryReader* reader, JobSystem* jobs)
+{
+    reader->codec.jobs = jobs;
+}
+
+const TrajectoryFrameHeader* GetTrajectoryFrame(const TrajectoryReader* reader, const uint64_t frameIndex)
+{
+    return (const TrajectoryFrameHeader*)((const uint8_t*)reader->file.data + FrameOffset(reader, frameIndex));
+}
+
+bool DecodeTrajectoryFrame(TrajectoryReader* reader, const uint64_t frameIndex, Boid* boids)
+{
+    const TrajectoryHeader* header = reader->header;
+    const int numBoids = header->numBoids;
+
+    if (IsCompressed(header))
+    {
+        // Delta frames need the frame before them, so unless we are just stepping forward, start over from the
+        // keyframe at or before the one asked for.
+        uint64_t frame = frameIndex - (frameIndex % header->keyframeInterval);
+        if (reader->lastDecodedFrame < frameIndex && reader->lastDecodedFrame >= frame)
+        {
+            frame = reader->lastDecodedFrame + 1;
+        }
+
+        for (; frame <= frameIndex; frame++)
+        {
+            const uint8_t* record = (const uint8_t*)reader->file.data + reader->frameOffsets[frame];
+            const TrajectoryCompressedFrameHeader* recordHeader = (const TrajectoryCompressedFrameHeader*)record;
+
+            if (!DecodeFrame(&reader->codec, record + sizeof(TrajectoryCompressedFrameHeader),
+                recordHeader->encodedSize, boids))
+            {
+                reader->lastDecodedFrame = UINT64_MAX;
+                return false;
+            }
+
+            reader->lastDecodedFrame = frame;
+        }
+
+        return true;
+    }
+
+    const bool quantized = (header->flags & trajectoryFlagQuantizedPositions) != 0;
+
+    const uint8_t* positions = (const uint8_t*)GetTrajectoryFrame(reader, frameIndex) + sizeof(TrajectoryFrameHeader);
+    const float* velocities = (const float*)(positions + PositionsSize(numBoids, quantized));
+
+    if (quantized)
+    {
+        const int16_t* quantizedPositions = (const int16_t*)positions;
+        const float scale = header->positionScale;
+
+        for (int i = 0; i < numBoids; i++)
+        {
+            boids[i].position.x = quantizedPositions[i * 3 + 0] * scale;
+            boids[i].position.y = quantizedPositions[i * 3 + 1] * scale;
+            boids[i].position.z = quantizedPositions[i * 3 + 2] * scale;
+        }
+    }
+    else
+    {
+        const float* floatPositions = (const float*)positions;
+        for (int i = 0; i < numBoids; i++)
+        {
+            boids[i].position.x = floatPositions[i * 3 + 0];
+            boids[i].position.y = floatPositions[i * 3 + 1];
+            boids[i].position.z = floatPositions[i * 3 + 2];
+        }
+    }
+
+    for (int i = 0; i < numBoids; i++)
+    {
+        boids[i].velocity.x = velocities[i * 3 + 0];
+        boids[i].velocity.y = velocities[i * 3 + 1];
+        boids[i].velocity.z = velocities[i * 3 + 2];
+    }
+
+    return true;
+}
+
+void PrefetchTrajectoryFrame(const TrajectoryReader* reader, const uint64_t frameIndex)
+{
+    PlatformPrefetchMappedRange(&reader->file, FrameOffset(reader, frameIndex), RecordSize(reader, frameIndex));
+}
+
+void EvictTrajectoryFrame(const TrajectoryReader* reader, const uint64_t frameIndex)
+{
+    PlatformEvictMappedRange(&reader->file, FrameOffset(reader, frameIndex), RecordSize(reader, frameIndex));
+}
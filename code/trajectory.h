@@ -0,0 +1,130 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+
+#include "framecodec.h"
+#include "game.h"
+#include "jobs.h"
+#include "platform.h"
+
+class Boid;
+
+// A trajectory file is a header followed by fixed-size frame records, one per recorded tick, so frame N always lives
+// at `headerSize + N * frameSize` and can be read straight out of a memory mapping. Within a frame the data is stored
+// as arrays: all positions, then all velocities. Positions can optionally be quantized to 16 bits per component.
+//
+// Compressed trajectories instead hold variable-size records, each a frame header, the encoded size and a frame
+// encoded with the frame codec. Every `keyframeInterval`th frame is a keyframe, so seeking only ever has to decode
+// forward from the closest keyframe before it.
+constexpr uint32_t trajectoryMagic = 0x4A525442; // "BTRJ" in little-endian
+constexpr uint32_t trajectoryVersion = 2;
+
+constexpr uint32_t trajectoryFlagQuantizedPositions = 1 << 0;
+constexpr uint32_t trajectoryFlagCompressed = 1 << 1;
+
+enum TrajectoryFormat
+{
+    TRAJECTORY_FORMAT_FLOAT,
+    TRAJECTORY_FORMAT_QUANTIZED,
+    TRAJECTORY_FORMAT_COMPRESSED,
+};
+
+struct TrajectoryHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t headerSize;
+    uint32_t flags;
+
+    int32_t numBoids;
+    float worldSize;
+    float positionScale; // World units per quantization step when positions are quantized.
+    uint32_t frameSize; // Zero for compressed trajectories.
+
+    // Number of complete frames in the file. Bumped after each frame is fully written, so a reader (or a recording
+    // that was cut short) never sees a partial frame.
+    uint64_t frameCount;
+    uint64_t firstTick;
+
+    // Added in version 2, only used by compressed trajectories. The maximum speed when recording started; if it is
+    // raised while recording, faster velocities are clamped to it.
+    float maxSpeed;
+    uint32_t keyframeInterval;
+};
+
+struct TrajectoryFrameHeader
+{
+    uint64_t tick;
+    uint64_t stateHash;
+};
+
+struct TrajectoryCompressedFrameHeader
+{
+    TrajectoryFrameHeader frame;
+    uint64_t encodedSize;
+};
+
+// Records frames from the simulation thread and writes them into the mapped file from a background thread. The
+// simulation only copies the flock into a free staging slot; it only ever waits if every slot is still queued.
+struct TrajectoryRecorder
+{
+    static constexpr int numSlots = 4;
+
+    PlatformMappedFile file;
+    TrajectoryHeader* header;
+    uint64_t writeOffset;
+
+    // Compressed recordings encode on the writer thread, plus a pool of workers when the machine has cores beyond
+    // the ones the simulation's threads and the writer use, so encoding never competes with the simulation for cores.
+    bool compressed;
+    JobSystem encodeJobs;
+    FrameCodec codec;
+
+    size_t slotStride;
+    uint8_t* slotMemory;
+    size_t slotMemorySize;
+
+    std::thread writer;
+    std::mutex mutex;
+    std::condition_variable slotFilled;
+    std::condition_variable slotFreed;
+    int readIndex;
+    int writeIndex;
+    int numQueued;
+    bool stopping;
+    bool failed;
+
+    uint64_t numStalls;
+};
+
+bool BeginTrajectoryRecording(TrajectoryRecorder* recorder, const char* path, const GameState* gameState,
+    const TrajectoryFormat format);
+void RecordTrajectoryFrame(TrajectoryRecorder* recorder, const GameState* gameState);
+void EndTrajectoryRecording(TrajectoryRecorder* recorder);
+
+struct TrajectoryReader
+{
+    PlatformMappedFile file;
+    const TrajectoryHeader* header;
+
+    // Compressed trajectories only: where each record starts, and the decoder along with the frame it last decoded.
+    uint64_t* frameOffsets;
+    size_t frameOffsetsSize;
+    FrameCodec codec;
+    uint64_t lastDecodedFrame;
+};
+
+bool OpenTrajectory(const char* path, TrajectoryReader* reader);
+void CloseTrajectory(TrajectoryReader* reader);
+// Compressed frames are decoded on the calling thread unless given a job system to spread them over, which must not
+// be running anything else while a frame is decoded.
+void SetTrajectoryDecodeJobs(TrajectoryReader* reader, JobSystem* jobs);
+const TrajectoryFrameHeader* GetTrajectoryFrame(const TrajectoryReader* reader, const uint64_t frameIndex);
+// Expands a frame back into a boids array of `header->numBoids` elements. Returns false if the frame is corrupt.
+bool DecodeTrajectoryFrame(TrajectoryReader* reader, const uint64_t frameIndex, Boid* boids);
+// Streaming hints, so playing back a recording never keeps more than a few frames of it resident.
+void PrefetchTrajectoryFrame(const TrajectoryReader* reader, const uint64_t frameIndex);
+void EvictTrajectoryFrame(const TrajectoryReader* reader, const uint64_t frameIndex);